@@ -0,0 +1,422 @@
+/*
+ * Benchmarks for the per-report paths of the driver. "make bench" builds this
+ * with release flags and no sanitizers. Each benchmark is timed over many
+ * calls, and the fastest of BENCH_REPEATS runs is kept. Cycles, instructions
+ * and cache misses are read with perf_event_open when the kernel allows it.
+ *
+ * Output is CSV with one line per benchmark, so runs from different commits
+ * can be compared with any tool that reads CSV. Counters that could not be
+ * read are left empty.
+ */
+
+#define _GNU_SOURCE
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libusb-1.0/libusb.h>
+#include <linux/input-event-codes.h>
+#include <linux/perf_event.h>
+#include <linux/uinput.h>
+
+#include "src/config.h"
+#include "src/loading_util.h"
+#include "src/marley_map.h"
+#include "src/mouse_accel.h"
+#include "src/mouse_driver.h"
+#include "src/output_sink.h"
+#include "src/report_layout.h"
+
+/* Inputs each benchmark cycles through, a power of two */
+#define BENCH_INPUTS 1024
+/* Runs of each benchmark, the fastest is reported */
+#define BENCH_REPEATS 5
+/* Calls per run, unless given with -n */
+#define BENCH_DEFAULT_CALLS 1000000
+/* load_config reads a file, so it gets this many times fewer calls */
+#define BENCH_CONFIG_DIVISOR 100
+
+typedef void (*bench_func)(void *, uint64_t);
+
+static const struct {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+} counter_events[] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache_misses"}};
+#define BENCH_COUNTERS (sizeof(counter_events) / sizeof(counter_events[0]))
+
+/* Counter fds, -1 if the counter is not available */
+static int counter_fds[BENCH_COUNTERS];
+
+/* Results are added here so the compiler can't drop the calls */
+static volatile int64_t sink;
+static volatile scalar_t sink_scalar;
+
+static delta_t input_dx[BENCH_INPUTS];
+static delta_t input_dy[BENCH_INPUTS];
+static unsigned char input_reports[BENCH_INPUTS][4];
+
+/**
+ * Deltas like a mouse at a range of speeds, from a fixed seed so every run
+ * sees the same inputs.
+ */
+static void make_inputs(void) {
+  uint32_t state = 0x9e3779b9;
+  for (int idx = 0; idx < BENCH_INPUTS; ++idx) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    input_dx[idx] = (int8_t)(state & 0xff) / 2;
+    input_dy[idx] = (int8_t)(state >> 8 & 0xff) / 2;
+    input_reports[idx][0] = idx & 0x1; // press and release the left button
+    input_reports[idx][1] = input_dx[idx];
+    input_reports[idx][2] = input_dy[idx];
+    input_reports[idx][3] = 0;
+  }
+}
+
+static void counters_open(void) {
+  for (size_t idx = 0; idx < BENCH_COUNTERS; ++idx) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = counter_events[idx].type;
+    attr.config = counter_events[idx].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    counter_fds[idx] =
+        syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+  }
+}
+
+static void counters_close(void) {
+  for (size_t idx = 0; idx < BENCH_COUNTERS; ++idx) {
+    if (counter_fds[idx] >= 0) {
+      close(counter_fds[idx]);
+    }
+  }
+}
+
+static void counters_start(void) {
+  for (size_t idx = 0; idx < BENCH_COUNTERS; ++idx) {
+    if (counter_fds[idx] >= 0) {
+      ioctl(counter_fds[idx], PERF_EVENT_IOC_RESET, 0);
+      ioctl(counter_fds[idx], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+static void counters_stop(uint64_t *counts) {
+  for (size_t idx = 0; idx < BENCH_COUNTERS; ++idx) {
+    counts[idx] = 0;
+    if (counter_fds[idx] >= 0) {
+      ioctl(counter_fds[idx], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(counter_fds[idx], &counts[idx], sizeof(uint64_t)) !=
+          sizeof(uint64_t)) {
+        counts[idx] = 0;
+      }
+    }
+  }
+}
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * Time calls to func and print one CSV line with the fastest run.
+ */
+static void bench_run(const char *label, const char *name, bench_func func,
+                      void *arg, uint64_t calls) {
+  uint64_t best_ns = UINT64_MAX;
+  uint64_t best_counts[BENCH_COUNTERS] = {0};
+  // one untimed run to warm the caches and branch predictors.
+  func(arg, calls / 10 + 1);
+  for (int repeat = 0; repeat < BENCH_REPEATS; ++repeat) {
+    uint64_t counts[BENCH_COUNTERS];
+    counters_start();
+    const uint64_t start = now_ns();
+    func(arg, calls);
+    const uint64_t elapsed = now_ns() - start;
+    counters_stop(counts);
+    if (elapsed < best_ns) {
+      best_ns = elapsed;
+      memcpy(best_counts, counts, sizeof(counts));
+    }
+  }
+
+  printf("%s,%s,%" PRIu64 ",%.2f", label, name, calls,
+         (double)best_ns / calls);
+  for (size_t idx = 0; idx < BENCH_COUNTERS; ++idx) {
+    if (counter_fds[idx] >= 0) {
+      printf(",%.2f", (double)best_counts[idx] / calls);
+    } else {
+      printf(",");
+    }
+  }
+  printf("\n");
+}
+
+static void bench_accelerate(void *arg, uint64_t calls) {
+  accel_settings_t *as = arg;
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  int64_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    delta_t dx = input_dx[call & (BENCH_INPUTS - 1)];
+    delta_t dy = input_dy[call & (BENCH_INPUTS - 1)];
+    accelerate(&dx, &dy, as, &state);
+    total += dx + dy;
+  }
+  sink = total;
+}
+
+static void bench_plan_run(void *arg, uint64_t calls) {
+  accel_settings_t *as = arg;
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  int64_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    delta_t dx = input_dx[call & (BENCH_INPUTS - 1)];
+    delta_t dy = input_dy[call & (BENCH_INPUTS - 1)];
+    accel_plan_run(&as->plan, &state, &dx, &dy);
+    total += dx + dy;
+  }
+  sink = total;
+}
+
+/* Polling interval the timed plan is run at, 8 kHz */
+#define BENCH_TIMED_INTERVAL_US 125
+
+static void bench_plan_run_timed(void *arg, uint64_t calls) {
+  accel_settings_t *as = arg;
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  int64_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    delta_t dx = input_dx[call & (BENCH_INPUTS - 1)];
+    delta_t dy = input_dy[call & (BENCH_INPUTS - 1)];
+    state.time_us += BENCH_TIMED_INTERVAL_US;
+    accel_plan_run(&as->plan, &state, &dx, &dy);
+    total += dx + dy;
+  }
+  sink = total;
+}
+
+static void bench_quake_accel(void *arg, uint64_t calls) {
+  accel_settings_t *as = arg;
+  scalar_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    total += quake_accel(input_dx[call & (BENCH_INPUTS - 1)],
+                         input_dy[call & (BENCH_INPUTS - 1)], as);
+  }
+  sink_scalar = total;
+}
+
+static void bench_pow_accel(void *arg, uint64_t calls) {
+  accel_settings_t *as = arg;
+  scalar_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    total += pow_accel(input_dx[call & (BENCH_INPUTS - 1)],
+                       input_dy[call & (BENCH_INPUTS - 1)], as);
+  }
+  sink_scalar = total;
+}
+
+typedef struct map_args {
+  output_sink_t sink;
+  report_plan_t decode;
+  accel_settings_t *as;
+} map_args_t;
+
+static void bench_map_to_uinput(void *arg, uint64_t calls) {
+  map_args_t *args = arg;
+  mouse_state_t state = {.accel = {.carry_dx = 0, .carry_dy = 0},
+                         .buttons = 0};
+  for (uint64_t call = 0; call < calls; ++call) {
+    map_to_uinput(&args->sink, input_reports[call & (BENCH_INPUTS - 1)], 4,
+                  &args->decode, &args->as->plan, &state);
+  }
+  sink = state.buttons;
+}
+
+static char *map_keys[] = {"quake", "quake_accel", "pow",
+                           "pow_accel", "curve", "curve_accel"};
+#define MAP_KEYS (sizeof(map_keys) / sizeof(map_keys[0]))
+
+static void bench_marley_map_lookup(void *arg, uint64_t calls) {
+  marley_map *map = arg;
+  int64_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    total += marley_map_lookup(map, map_keys[call % MAP_KEYS]) != NULL;
+  }
+  sink = total;
+}
+
+/* Keys in the large map, a power of two */
+#define LARGE_MAP_KEYS 16384
+#define LARGE_MAP_KEY_LENGTH 16
+
+static char large_map_keys[LARGE_MAP_KEYS][LARGE_MAP_KEY_LENGTH];
+
+static void bench_marley_map_lookup_large(void *arg, uint64_t calls) {
+  marley_map *map = arg;
+  int64_t total = 0;
+  // stride through the keys so consecutive lookups don't share a cache line.
+  for (uint64_t call = 0; call < calls; ++call) {
+    const uint64_t key = (call * 7919) & (LARGE_MAP_KEYS - 1);
+    total += marley_map_lookup(map, large_map_keys[key]) != NULL;
+  }
+  sink = total;
+}
+
+static void bench_load_config(void *arg, uint64_t calls) {
+  const char *path = arg;
+  int64_t total = 0;
+  for (uint64_t call = 0; call < calls; ++call) {
+    accel_settings_t as = {.accel = quake_accel};
+    total += load_config(&as, path);
+    free_config(&as);
+  }
+  sink = total;
+}
+
+/* Config parsed from memory by the parse_config benchmark */
+static const char parse_text[] = "ap=quake\n"
+                                 "base=1.0      # base sens\n"
+                                 "offset=5\n"
+                                 "upper_bound=100\n"
+                                 "accel_rate=1.1\n"
+                                 "power=2\n"
+                                 "overflow_lim=127\n"
+                                 "[fast]\n"
+                                 "accel_rate=1.5\n"
+                                 "points=0:1, 10:1.5, 40:3\n";
+
+static void bench_parse_config(void *arg, uint64_t calls) {
+  (void)arg;
+  int64_t total = 0;
+  config_profile_t profiles[2];
+  for (uint64_t call = 0; call < calls; ++call) {
+    int count, line;
+    profiles[0].settings = (accel_settings_t){.accel = quake_accel};
+    total += parse_config(parse_text, profiles, 2, &count, &line) + count;
+  }
+  sink = total;
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [-n calls] [-c config_file] [-l label]\n", name);
+  printf("  -n N     calls per run (default %d)\n", BENCH_DEFAULT_CALLS);
+  printf("  -c PATH  config file for load_config (default configs/ex.cfg)\n");
+  printf("  -l NAME  first column of each line, like a commit id\n");
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t calls = BENCH_DEFAULT_CALLS;
+  const char *config_path = "configs/ex.cfg";
+  const char *label = "local";
+  int opt;
+  while ((opt = getopt(argc, argv, "n:c:l:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      calls = strtoull(optarg, NULL, 10);
+      break;
+    case 'c':
+      config_path = optarg;
+      break;
+    case 'l':
+      label = optarg;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (calls == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  make_inputs();
+  counters_open();
+
+  accel_settings_t quake = {.accel = quake_accel,
+                            .overflow_lim = 127,
+                            .base = 1,
+                            .offset = 5,
+                            .upper_bound = 100,
+                            .accel_rate = 1.1,
+                            .power = 2.5,
+                            .game_sens = 1,
+                            .pre_scalar_x = 1,
+                            .pre_scalar_y = 1,
+                            .post_scalar_x = 1,
+                            .post_scalar_y = 1};
+  accel_plan_compile(&quake);
+  accel_settings_t power = quake;
+  power.accel = pow_accel;
+  accel_plan_compile(&power);
+  accel_settings_t timed = quake;
+  timed.vel_window = 2;
+  accel_plan_compile(&timed);
+
+  // the null sink makes no syscall, so this times the driver and not the
+  // kernel.
+  map_args_t map_args = {.as = &quake};
+  output_sink_null(&map_args.sink);
+  report_layout_t layout;
+  report_layout_preset(&layout, 8);
+  report_plan_compile(&map_args.decode, &layout);
+
+  marley_map *map = marley_map_alloc(MAP_KEYS);
+  for (size_t idx = 0; idx < MAP_KEYS; ++idx) {
+    marley_map_set(map, map_keys[idx], map_keys[idx]);
+  }
+  marley_map *large_map = marley_map_alloc(MAP_KEYS);
+  for (int idx = 0; idx < LARGE_MAP_KEYS; ++idx) {
+    snprintf(large_map_keys[idx], LARGE_MAP_KEY_LENGTH, "curve_%d", idx);
+    marley_map_set(large_map, large_map_keys[idx], large_map_keys[idx]);
+  }
+
+  printf("label,benchmark,calls,ns_per_call");
+  for (size_t idx = 0; idx < BENCH_COUNTERS; ++idx) {
+    printf(",%s_per_call", counter_events[idx].name);
+  }
+  printf("\n");
+  bench_run(label, "accelerate", bench_accelerate, &quake, calls);
+  bench_run(label, "accel_plan_run", bench_plan_run, &quake, calls);
+  bench_run(label, "accel_plan_run_timed", bench_plan_run_timed, &timed,
+            calls);
+  bench_run(label, "quake_accel", bench_quake_accel, &quake, calls);
+  bench_run(label, "pow_accel", bench_pow_accel, &power, calls);
+  bench_run(label, "map_to_uinput", bench_map_to_uinput, &map_args, calls);
+  bench_run(label, "marley_map_lookup", bench_marley_map_lookup, map, calls);
+  bench_run(label, "marley_map_lookup_16k", bench_marley_map_lookup_large,
+            large_map, calls);
+  const uint64_t config_calls = calls / BENCH_CONFIG_DIVISOR + 1;
+  bench_run(label, "load_config", bench_load_config, (void *)config_path,
+            config_calls);
+  bench_run(label, "parse_config", bench_parse_config, NULL, config_calls);
+
+  marley_map_free(map);
+  marley_map_free(large_map);
+  output_sink_close(&map_args.sink);
+  counters_close();
+  return 0;
+}
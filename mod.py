@@ -1,4 +1,10 @@
 import argparse
+import collections
+import ctypes
+import math
+import mmap
+import os
+import struct
 import numpy as np
 import tkinter as tk
 from matplotlib.figure import Figure
@@ -8,6 +14,9 @@ from matplotlib.backends.backend_tkagg import (FigureCanvasTkAgg,
 parser = argparse.ArgumentParser(
     description="Configure your configuration settings.")
 parser.add_argument("config_file_path")
+parser.add_argument("--live",
+                    action="store_true",
+                    help="show the reports of a driver started with --live")
 args = parser.parse_args()
 
 
@@ -52,21 +61,56 @@ def main():
 
     # map entries to dict of name to value. Use to draw accel plot
     settings = entries_to_dict(entries)
-    draw_accel_plot(window, settings)
+    draw_accel_plot(window, settings,
+                    curve_knots(read_config(config_file_name)),
+                    entries_text(config_file_name, entries, field_names))
+    if args.live:
+        start_live_view(window, settings,
+                        entries_text(config_file_name, entries, field_names))
 
     window.mainloop()
 
 
-def init_entries(entries, config_file_name):
+def read_config(config_file_name):
     """
-    initialize entries to values in the config file
+    Read the top-level settings of the config file into a dict of raw
+    strings. Lines are cleaned the same way the driver cleans them. The
+    GUI only edits the top-level profile, so reading stops at the first
+    [profile] section.
+    """
+    config = {}
+    with open(config_file_name, 'r') as config_file:
+        for line in config_file:
+            line = ''.join(line.lower().split('#')[0].split())
+            if line.startswith('['):
+                break
+            if '=' in line:
+                key, value = line.split('=', 1)
+                config[key] = value
+    return config
+
+
+def read_sections(config_file_name):
+    """
+    Text of the config file from the first [profile] section on.
     """
     with open(config_file_name, 'r') as config_file:
         lines = config_file.readlines()
-        config_map = dict([line.split('=') for line in lines])
-        for name in entries.keys():
-            entries[name].delete(0, tk.END)
-            entries[name].insert(0, config_map[name].strip())
+    for idx, line in enumerate(lines):
+        if line.split('#')[0].strip().startswith('['):
+            return ''.join(lines[idx:])
+    return ''
+
+
+def init_entries(entries, config_file_name):
+    """
+    initialize entries to values in the config file
+    """
+    config_map = read_config(config_file_name)
+    defaults = DefaultSettings().get()
+    for name in entries.keys():
+        entries[name].delete(0, tk.END)
+        entries[name].insert(0, config_map.get(name, defaults[name]))
 
 
 def entries_to_dict(entries):
@@ -97,20 +141,62 @@ def draw_command(window, entries):
     return draw_func
 
 
-def draw_accel_plot(window, settings):
+def draw_accel_plot(window, settings, curve=None, text=None):
     fig = Figure(dpi=100, tight_layout=False)
     fig.suptitle("Acceleration Grids")
-    rate = np.arange(0, 25, .1)
-    accel_sens = [
-        simple_accel(rate[i], settings) for i in range(rate.shape[0])
-    ]
-    fig.add_subplot(111, xlabel='Mouse Velocity',
-                    ylabel='Sensitivity').plot(rate, accel_sens)
+    profile = parse_profile(text) if text is not None else None
+    if profile is not None:
+        # the curve and heatmap come from the driver's own code.
+        try:
+            draw_driver_plots(fig, profile)
+        finally:
+            LIBRARY.marley_profile_free(profile)
+        canvas = FigureCanvasTkAgg(fig, master=window)
+        canvas.draw()
+        canvas.get_tk_widget().place(x=450, y=10)
+        return
+    plot = fig.add_subplot(111, xlabel='Mouse Velocity', ylabel='Sensitivity')
+    if curve is None:
+        rate = np.arange(0, 25, .1)
+        accel_sens = [
+            simple_accel(rate[i], settings) for i in range(rate.shape[0])
+        ]
+        plot.plot(rate, accel_sens)
+    else:
+        # plot the knots the driver interpolates between.
+        knot_vel, knot_sens = curve
+        plot.plot(knot_vel, knot_sens / settings['game_sens'], marker='.')
     canvas = FigureCanvasTkAgg(fig, master=window)
     canvas.draw()
     canvas.get_tk_widget().place(x=450, y=10)
 
 
+def draw_driver_plots(fig, profile):
+    """
+    Plot the x gain over PLOT_VELOCITIES velocities, and the sens over a
+    PLOT_GRID x PLOT_GRID grid of (dx, dy), evaluated by libmarleyaccel.
+    """
+    kernel = LIBRARY.marley_profile_kernel(profile).decode()
+    vel = np.linspace(0, PLOT_MAX_VEL, PLOT_VELOCITIES)
+    gain = np.empty_like(vel)
+    LIBRARY.marley_eval_curve(profile, vel, gain, vel.size)
+    plot = fig.add_subplot(121, xlabel='Mouse Velocity', ylabel='Gain (x)',
+                           title='kernel=' + kernel)
+    plot.plot(vel, gain)
+
+    axis = np.linspace(-PLOT_MAX_VEL, PLOT_MAX_VEL, PLOT_GRID)
+    dx, dy = np.meshgrid(axis, axis)
+    dx = np.ascontiguousarray(dx.ravel())
+    dy = np.ascontiguousarray(dy.ravel())
+    sens = np.empty_like(dx)
+    LIBRARY.marley_eval_sens(profile, dx, dy, sens, sens.size)
+    heatmap = fig.add_subplot(122, xlabel='dx', ylabel='dy', title='Sensitivity')
+    image = heatmap.imshow(sens.reshape(PLOT_GRID, PLOT_GRID), origin='lower',
+                           extent=(-PLOT_MAX_VEL, PLOT_MAX_VEL, -PLOT_MAX_VEL,
+                                   PLOT_MAX_VEL))
+    fig.colorbar(image, ax=heatmap)
+
+
 def reset_entries(entries, default_settings):
     def reset_func():
         for name in default_settings:
@@ -122,17 +208,89 @@ def reset_entries(entries, default_settings):
 
 def submit_entries(config_file_name, entries, names, draw_func, window):
     def submission():
-        # write entries to config file.
+        text = entries_text(config_file_name, entries, names)
+        sections = read_sections(config_file_name)
+        # write entries to config file, followed by the other profiles.
         with open(config_file_name, 'w+') as config_file:
-            for name in names:
-                config_file.write(name + '=' + entries[name].get() + '\n')
+            config_file.write(text)
+            config_file.write(sections)
         # redraw the accel plot
         settings = entries_to_dict(entries)
-        draw_func(window, settings)
+        draw_func(window, settings, curve_knots(read_config(config_file_name)),
+                  text)
 
     return submission
 
 
+def entries_text(config_file_name, entries, names):
+    """
+    Top-level profile of the config with the values in the entries. Settings
+    that don't have an entry, like the accel function, are kept from the
+    config file.
+    """
+    extra = {
+        key: value
+        for (key, value) in read_config(config_file_name).items()
+        if key not in names
+    }
+    lines = [name + '=' + entries[name].get() for name in names]
+    lines += [key + '=' + value for key, value in extra.items()]
+    return ''.join(line + '\n' for line in lines)
+
+
+# Matches MARLEY_API_VERSION in src/marley_api.h
+MARLEY_API_VERSION = 1
+# Range and resolution of the plots drawn with libmarleyaccel
+PLOT_MAX_VEL = 25
+PLOT_VELOCITIES = 2000
+PLOT_GRID = 201
+
+
+def load_library():
+    """
+    Load libmarleyaccel.so from next to this script. Returns None if it has
+    not been built with `make lib`, so the plot falls back to simple_accel.
+    """
+    path = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                        'libmarleyaccel.so')
+    try:
+        lib = ctypes.CDLL(path)
+    except OSError:
+        print('libmarleyaccel.so not found, run `make lib` to plot the '
+              'curve the driver uses.')
+        return None
+    if lib.marley_api_version() != MARLEY_API_VERSION:
+        print('libmarleyaccel.so is out of date, run `make lib`.')
+        return None
+    doubles = np.ctypeslib.ndpointer(dtype=np.float64, flags='C_CONTIGUOUS')
+    lib.marley_profile_parse.restype = ctypes.c_void_p
+    lib.marley_profile_parse.argtypes = [ctypes.c_char_p,
+                                         ctypes.POINTER(ctypes.c_int)]
+    lib.marley_profile_free.argtypes = [ctypes.c_void_p]
+    lib.marley_profile_kernel.restype = ctypes.c_char_p
+    lib.marley_profile_kernel.argtypes = [ctypes.c_void_p]
+    lib.marley_eval_curve.argtypes = [ctypes.c_void_p, doubles, doubles,
+                                      ctypes.c_size_t]
+    lib.marley_eval_sens.argtypes = [ctypes.c_void_p, doubles, doubles,
+                                     doubles, ctypes.c_size_t]
+    return lib
+
+
+def parse_profile(text):
+    """
+    Profile handle for config text, or None if the library is missing or the
+    text has an error. Free it with LIBRARY.marley_profile_free.
+    """
+    if LIBRARY is None:
+        return None
+    line = ctypes.c_int(0)
+    profile = LIBRARY.marley_profile_parse(text.encode(), ctypes.byref(line))
+    if not profile:
+        print('Error in the settings at line', line.value)
+        return None
+    return profile
+
+
 class DefaultSettings:
     """
     Stronger guarantee that default settings won't be changed during 
@@ -168,5 +326,170 @@ def simple_accel(rate, args):
     return sens
 
 
+# Matches CURVE_DEFAULT_KNOTS in src/mouse_accel.h
+CURVE_DEFAULT_KNOTS = 64
+
+
+def curve_knots(config):
+    """
+    Resample the curve points in the config onto evenly spaced knots, the
+    same way accel_curve_build does. Returns None if the config does not use
+    a point curve.
+    """
+    if not {'curve', 'curve_accel'} & set(config.values()):
+        return None
+    points = [[float(v) for v in p.split(':')]
+              for p in config.get('points', '').split(',') if p]
+    if not points:
+        return None
+    vel = np.array([p[0] for p in points])
+    sens = np.array([p[1] for p in points])
+    knots = int(config.get('curve_knots', 0))
+    knots = knots if knots > 1 else CURVE_DEFAULT_KNOTS
+    max_vel = vel[-1] if vel[-1] > 0 else 1
+    knot_vel = np.arange(knots) / ((knots - 1) / max_vel)
+    if config.get('curve_interp') == 'spline' and len(points) > 2:
+        return knot_vel, monotone_spline(vel, sens, knot_vel)
+    # np.interp uses the nearest point outside the range, like the driver.
+    return knot_vel, np.interp(knot_vel, vel, sens)
+
+
+def monotone_spline(xs, ys, at):
+    """
+    Fritsch-Carlson monotone cubic spline through (xs, ys), evaluated at the
+    velocities in at.
+    """
+    n = len(xs)
+    secants = np.diff(ys) / np.diff(xs)
+    tangents = np.empty(n)
+    tangents[0] = secants[0]
+    tangents[-1] = secants[-1]
+    for i in range(1, n - 1):
+        turns = secants[i - 1] * secants[i] <= 0
+        tangents[i] = 0 if turns else (secants[i - 1] + secants[i]) / 2
+    for i in range(n - 1):
+        if secants[i] == 0:
+            tangents[i] = tangents[i + 1] = 0
+            continue
+        a = tangents[i] / secants[i]
+        b = tangents[i + 1] / secants[i]
+        norm = a * a + b * b
+        if norm > 9:
+            scale = 3 / np.sqrt(norm)
+            tangents[i] = scale * a * secants[i]
+            tangents[i + 1] = scale * b * secants[i]
+
+    at = np.clip(at, xs[0], xs[-1])
+    idx = np.clip(np.searchsorted(xs, at) - 1, 0, n - 2)
+    width = xs[idx + 1] - xs[idx]
+    t = (at - xs[idx]) / width
+    t2 = t * t
+    t3 = t2 * t
+    return ((2 * t3 - 3 * t2 + 1) * ys[idx] +
+            (t3 - 2 * t2 + t) * width * tangents[idx] +
+            (-2 * t3 + 3 * t2) * ys[idx + 1] +
+            (t3 - t2) * width * tangents[idx + 1])
+
+
+# Matches live_ring_t in src/live_ring.h
+LIVE_RING_PATH = '/dev/shm/marley_accel'
+LIVE_RING_MAGIC = 0x4c52414d
+LIVE_RING_VERSION = 1
+LIVE_HEADER = struct.Struct('=IIII')
+LIVE_SEQ = struct.Struct('=Q')
+LIVE_HEAD_OFFSET = 64
+LIVE_SLOTS_OFFSET = 128
+LIVE_SLOT = struct.Struct('=QQiiiifffI')
+# How often the live view reads the ring, and how many speeds it keeps
+LIVE_POLL_MS = 50
+LIVE_HISTORY = 2000
+
+
+class LiveRing:
+    """
+    Reader of the ring the driver publishes its reports to. A sample the
+    driver overwrote while it was read is skipped.
+    """
+
+    def __init__(self, path=LIVE_RING_PATH):
+        with open(path, 'rb') as ring_file:
+            self.map = mmap.mmap(ring_file.fileno(), 0,
+                                 access=mmap.ACCESS_READ)
+        magic, version, self.size, slot_size = LIVE_HEADER.unpack_from(
+            self.map, 0)
+        if (magic != LIVE_RING_MAGIC or version != LIVE_RING_VERSION or
+                slot_size != LIVE_SLOT.size):
+            raise ValueError('the live ring has an unknown layout')
+        self.next = LIVE_SEQ.unpack_from(self.map, LIVE_HEAD_OFFSET)[0]
+
+    def read(self):
+        """
+        Samples published since the last read, as tuples of (time_ns, in_dx,
+        in_dy, out_dx, out_dy, vel_dx, vel_dy, sens, device).
+        """
+        head = LIVE_SEQ.unpack_from(self.map, LIVE_HEAD_OFFSET)[0]
+        samples = []
+        for idx in range(max(self.next, head - self.size), head):
+            offset = LIVE_SLOTS_OFFSET + (idx % self.size) * LIVE_SLOT.size
+            slot = LIVE_SLOT.unpack_from(self.map, offset)
+            seq = LIVE_SEQ.unpack_from(self.map, offset)[0]
+            if slot[0] == seq == 2 * idx + 2:
+                samples.append(slot[1:])
+        self.next = head
+        return samples
+
+
+def start_live_view(window, settings, text):
+    """
+    Open a window with a dot on the curve at the velocity and sens of the
+    newest report, and a histogram of recent velocities.
+    """
+    try:
+        ring = LiveRing()
+    except (OSError, ValueError) as err:
+        print('Could not open the live ring, start the driver with --live:',
+              err)
+        return
+    live = tk.Toplevel(window)
+    live.title('Marley Accel Live')
+    fig = Figure(dpi=100, tight_layout=True)
+    curve_plot = fig.add_subplot(121, xlabel='Velocity', ylabel='Sensitivity')
+    hist_plot = fig.add_subplot(122, xlabel='Velocity', ylabel='Reports')
+    profile = parse_profile(text)
+    if profile is not None:
+        # samples are after the pre scalar, the library applies it again.
+        vel = np.linspace(0, PLOT_MAX_VEL, PLOT_VELOCITIES)
+        pre_scalar = settings['pre_scalar_x'] or 1.0
+        dx = np.ascontiguousarray(vel / pre_scalar)
+        dy = np.zeros_like(vel)
+        sens = np.empty_like(vel)
+        LIBRARY.marley_eval_sens(profile, dx, dy, sens, sens.size)
+        LIBRARY.marley_profile_free(profile)
+        curve_plot.plot(vel, sens)
+    dot, = curve_plot.plot([], [], 'o', color='red')
+    canvas = FigureCanvasTkAgg(fig, master=live)
+    canvas.get_tk_widget().pack(fill=tk.BOTH, expand=True)
+    speeds = collections.deque(maxlen=LIVE_HISTORY)
+
+    def update():
+        if not live.winfo_exists():
+            return
+        samples = ring.read()
+        for sample in samples:
+            speeds.append(math.hypot(sample[5], sample[6]))
+        if samples:
+            dot.set_data([speeds[-1]], [samples[-1][7]])
+            hist_plot.cla()
+            hist_plot.set_xlabel('Velocity')
+            hist_plot.set_ylabel('Reports')
+            hist_plot.hist(speeds, bins=50)
+            canvas.draw_idle()
+        live.after(LIVE_POLL_MS, update)
+
+    update()
+
+
+LIBRARY = load_library()
+
 if __name__ == '__main__':
     main()
@@ -0,0 +1,421 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "mouse_accel.h"
+
+/**
+ * How the value of a key is parsed.
+ */
+typedef enum config_type {
+  CONFIG_SCALAR, /* scalar_t */
+  CONFIG_DELTA,  /* delta_t */
+  CONFIG_INT,    /* int */
+  CONFIG_BOOL,   /* bool, 0 is false and any other number true */
+  CONFIG_CHOICE, /* bool, false for the first choice and true for the second */
+  CONFIG_ACCEL,  /* accel_func, by name */
+  CONFIG_POINTS  /* Curve points, velocity:sens pairs separated by commas */
+} config_type_t;
+
+typedef struct config_key {
+  const char *name;
+  config_type_t type;
+  size_t offset;          /* Of the setting in accel_settings_t */
+  const char *choices[2]; /* Values of a CONFIG_CHOICE */
+} config_key_t;
+
+#define KEY(name, type, field)                                                \
+  { name, type, offsetof(accel_settings_t, field), {NULL, NULL} }
+#define CHOICE(name, field, off, on)                                          \
+  { name, CONFIG_CHOICE, offsetof(accel_settings_t, field), {off, on} }
+
+/* Sorted by name, so a key is found with a binary search */
+static const config_key_t config_keys[] = {
+    KEY("accel", CONFIG_ACCEL, accel),
+    KEY("accel_rate", CONFIG_SCALAR, accel_rate),
+    KEY("ap", CONFIG_ACCEL, accel),
+    KEY("base", CONFIG_SCALAR, base),
+    CHOICE("curve_interp", curve_spline, "linear", "spline"),
+    KEY("curve_knots", CONFIG_INT, curve_knots),
+    KEY("fixed_point", CONFIG_BOOL, fixed_point),
+    KEY("game_sens", CONFIG_SCALAR, game_sens),
+    KEY("lut_max_vel", CONFIG_SCALAR, lut_max_vel),
+    KEY("lut_size", CONFIG_INT, lut_size),
+    CHOICE("lut_type", lut_single, "double", "float"),
+    KEY("offset", CONFIG_SCALAR, offset),
+    KEY("overflow_lim", CONFIG_DELTA, overflow_lim),
+    KEY("points", CONFIG_POINTS, curve_points),
+    KEY("post_scalar_x", CONFIG_SCALAR, post_scalar_x),
+    KEY("post_scalar_y", CONFIG_SCALAR, post_scalar_y),
+    KEY("power", CONFIG_SCALAR, power),
+    KEY("pre_scalar_x", CONFIG_SCALAR, pre_scalar_x),
+    KEY("pre_scalar_y", CONFIG_SCALAR, pre_scalar_y),
+    KEY("upper_bound", CONFIG_SCALAR, upper_bound),
+    KEY("vel_window", CONFIG_SCALAR, vel_window)};
+
+static const struct {
+  const char *name;
+  accel_func accel;
+} accel_names[] = {{"quake", quake_accel}, {"quake_accel", quake_accel},
+                   {"pow", pow_accel},     {"pow_accel", pow_accel},
+                   {"curve", curve_accel}, {"curve_accel", curve_accel}};
+
+/**
+ * Part of the config text, which is not NUL terminated.
+ */
+typedef struct token {
+  const char *start;
+  size_t len;
+} token_t;
+
+/**
+ * Token from start to end without the whitespace around it.
+ */
+static token_t trim(const char *start, const char *end) {
+  while (start < end && isspace((unsigned char)*start)) {
+    ++start;
+  }
+  while (end > start && isspace((unsigned char)end[-1])) {
+    --end;
+  }
+  return (token_t){.start = start, .len = end - start};
+}
+
+static bool token_is(const token_t *token, const char *word) {
+  return strlen(word) == token->len &&
+         strncasecmp(token->start, word, token->len) == 0;
+}
+
+/**
+ * Compare a token to the name of a config_key_t, ignoring the token's case.
+ */
+static int key_compare(const void *token_ptr, const void *key_ptr) {
+  const token_t *token = token_ptr;
+  const char *name = ((const config_key_t *)key_ptr)->name;
+  for (size_t idx = 0; idx < token->len; ++idx) {
+    const int diff =
+        tolower((unsigned char)token->start[idx]) - (unsigned char)name[idx];
+    if (diff != 0) {
+      return diff;
+    }
+  }
+  return -(unsigned char)name[token->len];
+}
+
+/**
+ * Parse a token that is a number and nothing else. The text after the token
+ * stops strtod, since it is whitespace, a comment or the end of the text.
+ */
+static int parse_number(const token_t *value, double *number) {
+  char *end;
+  *number = strtod(value->start, &end);
+  return value->len > 0 && end == value->start + value->len ? 0 : -1;
+}
+
+/**
+ * Parse curve points written as velocity:sens pairs separated by commas,
+ * e.g. points=0:1, 10:1.5, 40:3
+ */
+static int parse_curve_points(const token_t *value, accel_settings_t *as) {
+  int count = 0;
+  const char *pos = value->start;
+  const char *end = value->start + value->len;
+  while (pos < end) {
+    if (count == CURVE_MAX_POINTS) {
+      return -1;
+    }
+    char *next;
+    as->curve_vel[count] = strtod(pos, &next);
+    if (next == pos || next >= end || *next != ':') {
+      return -1;
+    }
+    pos = next + 1;
+    as->curve_sens[count] = strtod(pos, &next);
+    if (next == pos || next > end) {
+      return -1;
+    }
+    pos = trim(next, end).start;
+    if (pos < end && *pos++ != ',') {
+      return -1;
+    }
+    ++count;
+  }
+  as->curve_points = count;
+  return 0;
+}
+
+static int assign_setting(accel_settings_t *as, const config_key_t *key,
+                          const token_t *value) {
+  void *field = (char *)as + key->offset;
+  double number;
+  switch (key->type) {
+  case CONFIG_SCALAR:
+  case CONFIG_DELTA:
+  case CONFIG_INT:
+  case CONFIG_BOOL:
+    if (parse_number(value, &number) != 0) {
+      return -1;
+    }
+    if (key->type == CONFIG_SCALAR) {
+      *(scalar_t *)field = number;
+    } else if (key->type == CONFIG_DELTA) {
+      *(delta_t *)field = number;
+    } else if (key->type == CONFIG_INT) {
+      *(int *)field = number;
+    } else {
+      *(bool *)field = number != 0;
+    }
+    return 0;
+  case CONFIG_CHOICE:
+    for (int idx = 0; idx < 2; ++idx) {
+      if (token_is(value, key->choices[idx])) {
+        *(bool *)field = idx == 1;
+        return 0;
+      }
+    }
+    return -1;
+  case CONFIG_ACCEL:
+    for (size_t idx = 0; idx < sizeof(accel_names) / sizeof(*accel_names);
+         ++idx) {
+      if (token_is(value, accel_names[idx].name)) {
+        *(accel_func *)field = accel_names[idx].accel;
+        return 0;
+      }
+    }
+    return -1;
+  case CONFIG_POINTS:
+    return parse_curve_points(value, as);
+  }
+  return -1;
+}
+
+/**
+ * Start the profile named by a section header, from the top-level settings.
+ * The tables of the top-level settings are not shared, since building the
+ * profile's tables would free them. Names are stored in lowercase.
+ */
+static int start_profile(config_profile_t *profile, const token_t *name,
+                         const accel_settings_t *top) {
+  if (name->len == 0 || name->len >= CONFIG_NAME_LENGTH) {
+    return -1;
+  }
+  for (size_t idx = 0; idx < name->len; ++idx) {
+    profile->name[idx] = tolower((unsigned char)name->start[idx]);
+  }
+  profile->name[name->len] = '\0';
+  if (&profile->settings != top) {
+    profile->settings = *top;
+    profile->settings.lut = NULL;
+    profile->settings.curve = NULL;
+    profile->settings.fixed = NULL;
+  }
+  return 0;
+}
+
+/**
+ * Parse the NUL terminated config text in one pass, without allocating.
+ * profiles[0] is the top-level profile, and its settings must be set to the
+ * values used for anything the config does not set, so max is at least 1.
+ * Each section fills the next profile. Sections past max are still checked
+ * but not kept. count is set to the number of profiles in the text, which may
+ * be more than max. Tables are not built.
+ * Returns 0 on success. Otherwise returns -1 and line is set to the line
+ * with the error, counted from 1.
+ */
+int parse_config(const char *text, config_profile_t *profiles, int max,
+                 int *count, int *line) {
+  config_profile_t scratch;
+  config_profile_t *profile = &profiles[0];
+  const accel_settings_t *top = &profile->settings;
+  profile->name[0] = '\0';
+  *count = 1;
+  *line = 0;
+  for (const char *pos = text; *pos != '\0';) {
+    ++*line;
+    const char *eol = pos + strcspn(pos, "\n");
+    const char *comment = memchr(pos, '#', eol - pos);
+    const token_t content = trim(pos, comment ? comment : eol);
+    pos = *eol ? eol + 1 : eol;
+    if (content.len == 0) {
+      continue;
+    }
+
+    const char *last = content.start + content.len - 1;
+    if (*content.start == '[') {
+      const token_t name = trim(content.start + 1, last);
+      profile = *count < max ? &profiles[*count] : &scratch;
+      if (*last != ']' || start_profile(profile, &name, top) != 0) {
+        return -1;
+      }
+      for (int idx = 1; idx < *count && idx < max; ++idx) {
+        if (strcmp(profiles[idx].name, profile->name) == 0) {
+          return -1;
+        }
+      }
+      ++*count;
+      continue;
+    }
+
+    const char *eq = memchr(content.start, '=', content.len);
+    if (!eq) {
+      return -1;
+    }
+    const token_t key = trim(content.start, eq);
+    const token_t value = trim(eq + 1, last + 1);
+    const config_key_t *found =
+        bsearch(&key, config_keys, sizeof(config_keys) / sizeof(*config_keys),
+                sizeof(*config_keys), key_compare);
+    if (!found || assign_setting(&profile->settings, found, &value) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Read the file at path into text, which holds size bytes, and NUL
+ * terminate it.
+ * Returns 0 on success, EFBIG if the file does not fit, otherwise errno.
+ */
+static int read_config(const char *path, char *text, size_t size) {
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return errno;
+  }
+  size_t len = 0;
+  ssize_t got;
+  while (len < size - 1 &&
+         (got = read(fd, text + len, size - 1 - len)) != 0) {
+    if (got < 0 && errno != EINTR) {
+      const int err = errno;
+      close(fd);
+      return err;
+    }
+    len += got > 0 ? got : 0;
+  }
+  close(fd);
+  if (len == size - 1) {
+    return EFBIG;
+  }
+  text[len] = '\0';
+  return 0;
+}
+
+/**
+ * Build the tables and plan of loaded settings. The tables and plan depend
+ * on every other setting, so they are built last.
+ * Returns 0 on success, otherwise the error building a table.
+ */
+int build_config(accel_settings_t *as) {
+  // default to quake accel if nothing specified.
+  if (!as->accel) {
+    as->accel = quake_accel;
+  }
+  int err = accel_curve_build(as);
+  if (err) {
+    return err;
+  }
+  err = accel_lut_build(as);
+  if (err) {
+    return err;
+  }
+  err = accel_fixed_build(as);
+  if (err) {
+    return err;
+  }
+  accel_plan_compile(as);
+  return 0;
+}
+
+/**
+ * Load every profile in the config at path, as parse_config does, and build
+ * the tables of the profiles that are kept. Every profile is checked before
+ * any table is built.
+ * Returns 0 on success, -1 if the config has an error, otherwise the error
+ * reading the file or building a table.
+ */
+int load_profiles(const char *path, config_profile_t *profiles, int max,
+                  int *count) {
+  char text[CONFIG_MAX_SIZE];
+  int err = read_config(path, text, sizeof(text));
+  if (err) {
+    return err;
+  }
+  int line;
+  if (parse_config(text, profiles, max, count, &line) != 0) {
+    printf("Marley-Accel: Error in %s at line %d.\n", path, line);
+    return -1;
+  }
+  const int kept = *count < max ? *count : max;
+  for (int idx = 0; idx < kept; ++idx) {
+    err = build_config(&profiles[idx].settings);
+    if (err) {
+      for (int built = 0; built <= idx; ++built) {
+        free_config(&profiles[built].settings);
+      }
+      return err;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Settings used for anything the config file does not set.
+ */
+void default_config(accel_settings_t *as) {
+  const accel_settings_t defaults = {.accel = quake_accel,
+                                     .overflow_lim = 10,
+                                     .base = 1,
+                                     .offset = 0,
+                                     .upper_bound = 8,
+                                     .accel_rate = 2,
+                                     .power = 2,
+                                     .game_sens = 1,
+                                     .pre_scalar_x = 1,
+                                     .pre_scalar_y = 1,
+                                     .post_scalar_x = 1,
+                                     .post_scalar_y = 1};
+  *as = defaults;
+  accel_plan_compile(as);
+}
+
+/**
+ * Load the top-level profile of the config at path over as. The sections of
+ * the config are checked too. The tables of as are replaced on success and
+ * kept otherwise.
+ */
+int load_config(accel_settings_t *as, const char *path) {
+  config_profile_t top;
+  top.settings = *as;
+  top.settings.lut = NULL;
+  top.settings.curve = NULL;
+  top.settings.fixed = NULL;
+  int count;
+  const int err = load_profiles(path, &top, 1, &count);
+  if (err) {
+    return err;
+  }
+  free_config(as);
+  *as = top.settings;
+  // the plan of a custom accel function points back at its settings.
+  accel_plan_compile(as);
+  return 0;
+}
+
+/**
+ * Free the tables load_config built for as.
+ */
+void free_config(accel_settings_t *as) {
+  accel_curve_free(as);
+  accel_lut_free(as);
+  accel_fixed_free(as);
+}
@@ -0,0 +1,34 @@
+/**
+ * Config files. Each line is a key=value setting, a [name] section header or
+ * blank, and # starts a comment. Settings before the first section make up
+ * the top-level profile. Each section is another profile that starts from
+ * the top-level settings. Keys and names are not case sensitive.
+ */
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mouse_accel.h"
+
+/* Largest config file that can be loaded */
+#define CONFIG_MAX_SIZE (64 * 1024)
+/* Longest profile name, including the terminating NUL */
+#define CONFIG_NAME_LENGTH 32
+
+typedef struct config_profile {
+  char name[CONFIG_NAME_LENGTH]; /* Empty for the top-level profile */
+  accel_settings_t settings;
+} config_profile_t;
+
+int parse_config(const char *, config_profile_t *, int, int *, int *);
+int load_profiles(const char *, config_profile_t *, int, int *);
+int build_config(accel_settings_t *);
+
+void default_config(accel_settings_t *);
+int load_config(accel_settings_t *, const char *);
+void free_config(accel_settings_t *);
+
+#endif
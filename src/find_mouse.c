@@ -11,32 +11,47 @@
 #define MOUSE_INTERFACE_PROTOCOL 2
 
 /**
- * Searches for a mouse and returns info on the first one that it finds.
- * It goes through all devices in all busses until it finds a mouse.
+ * Searches for mice and fills info with up to max of them, in bus order.
+ * It goes through all devices in all busses.
  * Documentation for device description pointers at
  * https://www.kernel.org/doc/html/v4.17/driver-api/usb/usb.html
+ * Returns the number of mice found.
  */
-mouse_info_t find_mouse() {
+int find_mice(mouse_info_t *info, int max) {
   usb_init(); // there does not seem to be a usb_exit
   usb_find_busses();
   usb_find_devices();
 
+  int count = 0;
   for (struct usb_bus *bus = usb_busses; bus; bus = bus->next) {
     for (struct usb_device *dev = bus->devices; dev; dev = dev->next) {
       const struct usb_interface *interface = dev->config->interface;
       const struct usb_interface_descriptor *uid = interface->altsetting;
-      if (uid->bInterfaceProtocol == MOUSE_INTERFACE_PROTOCOL) {
-        const mouse_info_t info = {.found = true,
-                                   .vendor_id = dev->descriptor.idVendor,
-                                   .product_id = dev->descriptor.idProduct,
-                                   .endpoint_in =
-                                       uid->endpoint->bEndpointAddress,
-                                   .interface = uid->iInterface,
-                                   .buf_size = uid->endpoint->wMaxPacketSize};
-        return info;
+      if (uid->bInterfaceProtocol == MOUSE_INTERFACE_PROTOCOL &&
+          count < max) {
+        const mouse_info_t found = {.found = true,
+                                    .vendor_id = dev->descriptor.idVendor,
+                                    .product_id = dev->descriptor.idProduct,
+                                    .endpoint_in =
+                                        uid->endpoint->bEndpointAddress,
+                                    .interface = uid->bInterfaceNumber,
+                                    .buf_size = uid->endpoint->wMaxPacketSize,
+                                    .interval = uid->endpoint->bInterval,
+                                    .bus_number =
+                                        strtol(bus->dirname, NULL, 10),
+                                    .device_address = dev->devnum};
+        info[count++] = found;
       }
     }
   }
-  const mouse_info_t fail = {.found = false};
-  return fail;
+  return count;
+}
+
+/**
+ * Searches for a mouse and returns info on the first one that it finds.
+ */
+mouse_info_t find_mouse() {
+  mouse_info_t info = {.found = false};
+  find_mice(&info, 1);
+  return info;
 }
@@ -8,8 +8,12 @@ typedef struct mouse_info {
   uint16_t endpoint_in;
   uint16_t interface;
   uint16_t buf_size;
+  uint8_t interval;       /* bInterval of the interrupt endpoint */
+  uint8_t bus_number;     /* Tells apart mice with the same ids */
+  uint8_t device_address;
 } mouse_info_t;
 
 mouse_info_t find_mouse();
+int find_mice(mouse_info_t *, int);
 
 #endif
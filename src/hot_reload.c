@@ -0,0 +1,246 @@
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "errmsg.h"
+#include "hot_reload.h"
+#include "mouse_accel.h"
+
+/* Events that mean a config was written: closed after writing, or renamed
+ * over, which is how most editors save */
+#define HOT_WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+/**
+ * Read profile through initial until it is swapped. path may be NULL if the
+ * profile is never reloaded.
+ */
+void hot_profile_init(hot_profile_t *profile, accel_settings_t *initial,
+                      const char *path) {
+  atomic_init(&profile->current, initial);
+  atomic_init(&profile->generation, 1);
+  profile->initial = initial;
+  profile->path = path;
+  for (int idx = 0; idx < HOT_MAX_READERS; ++idx) {
+    atomic_init(&profile->readers[idx].generation, 0);
+  }
+  atomic_init(&profile->reader_count, 0);
+}
+
+/**
+ * Reader slot for one more reader of profile.
+ * Returns NULL if every slot is taken.
+ */
+hot_reader_t *hot_profile_reader(hot_profile_t *profile) {
+  const int idx = atomic_fetch_add(&profile->reader_count, 1);
+  if (idx >= HOT_MAX_READERS) {
+    atomic_fetch_sub(&profile->reader_count, 1);
+    return NULL;
+  }
+  return &profile->readers[idx];
+}
+
+static void settings_free(hot_profile_t *profile, accel_settings_t *as) {
+  if (as != profile->initial) {
+    free_config(as);
+    free(as);
+  }
+}
+
+/**
+ * Publish as as the settings of profile, then wait until every reader that
+ * could have the old settings has left them, and free them. Waiting only
+ * takes as long as the report being handled. Only one thread may swap a
+ * profile.
+ */
+void hot_profile_swap(hot_profile_t *profile, accel_settings_t *as) {
+  accel_settings_t *old = atomic_exchange(&profile->current, as);
+  const uint64_t generation = atomic_fetch_add(&profile->generation, 1) + 1;
+  const int count = atomic_load(&profile->reader_count);
+  const struct timespec delay = {.tv_sec = 0,
+                                 .tv_nsec = HOT_GRACE_POLL_US * 1000};
+  for (int idx = 0; idx < count && idx < HOT_MAX_READERS; ++idx) {
+    uint64_t seen;
+    while ((seen = atomic_load(&profile->readers[idx].generation)) != 0 &&
+           seen < generation) {
+      nanosleep(&delay, NULL);
+    }
+  }
+  settings_free(profile, old);
+}
+
+/**
+ * Load the config of profile into new settings and swap them in. The
+ * settings in use are kept if the config can't be loaded.
+ * Returns 0 on success, otherwise the error from load_config.
+ */
+int hot_profile_reload(hot_profile_t *profile) {
+  accel_settings_t *as = malloc(sizeof(accel_settings_t));
+  if (!as) {
+    return ENOMEM;
+  }
+  default_config(as);
+  const int err = load_config(as, profile->path);
+  if (err) {
+    free_config(as);
+    free(as);
+    return err;
+  }
+  hot_profile_swap(profile, as);
+  return 0;
+}
+
+/**
+ * Free the settings swapped in by reloads. Readers must have stopped.
+ */
+void hot_profile_free(hot_profile_t *profile) {
+  settings_free(profile, atomic_load(&profile->current));
+  atomic_store(&profile->current, profile->initial);
+}
+
+static void reload(hot_profile_t *profile) {
+  const int err = hot_profile_reload(profile);
+  if (err) {
+    errmsg("Could not reload the config, keeping the old settings", err);
+    return;
+  }
+  printf("Reloaded config at %s (kernel=%s)\n", profile->path,
+         accel_plan_name(&atomic_load(&profile->current)->plan));
+}
+
+/**
+ * Reload the profiles whose config is named by an inotify event.
+ */
+static void reload_changed(hot_reload_t *reload_ctx,
+                           const struct inotify_event *event) {
+  for (int idx = 0; idx < reload_ctx->count; ++idx) {
+    hot_profile_t *profile = reload_ctx->profiles[idx];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", profile->path);
+    if (event->wd == reload_ctx->watches[idx] &&
+        strcmp(event->name, basename(path)) == 0) {
+      reload(profile);
+    }
+  }
+}
+
+static void *reload_thread(void *arg) {
+  hot_reload_t *reload_ctx = arg;
+  struct pollfd fds[] = {{.fd = reload_ctx->stop_fd, .events = POLLIN},
+                         {.fd = reload_ctx->inotify_fd, .events = POLLIN},
+                         {.fd = reload_ctx->signal_fd, .events = POLLIN}};
+  _Alignas(struct inotify_event) char buf[4096];
+  while (true) {
+    if (poll(fds, 3, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    if (fds[0].revents) {
+      break;
+    }
+    if (fds[1].revents & POLLIN) {
+      const ssize_t len = read(reload_ctx->inotify_fd, buf, sizeof(buf));
+      for (ssize_t pos = 0; pos < len;) {
+        const struct inotify_event *event = (void *)(buf + pos);
+        if (event->len > 0) {
+          reload_changed(reload_ctx, event);
+        }
+        pos += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    if (fds[2].revents & POLLIN) {
+      struct signalfd_siginfo info;
+      if (read(reload_ctx->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+        for (int idx = 0; idx < reload_ctx->count; ++idx) {
+          reload(reload_ctx->profiles[idx]);
+        }
+      }
+    }
+  }
+  return NULL;
+}
+
+static void close_fds(hot_reload_t *reload_ctx) {
+  if (reload_ctx->inotify_fd >= 0) {
+    close(reload_ctx->inotify_fd);
+  }
+  if (reload_ctx->signal_fd >= 0) {
+    close(reload_ctx->signal_fd);
+  }
+  if (reload_ctx->stop_fd >= 0) {
+    close(reload_ctx->stop_fd);
+  }
+}
+
+/**
+ * Watch the config of each profile and start the reload thread. The
+ * directory of each config is watched rather than the file, so a config
+ * that is replaced by a rename is still seen. SIGHUP is blocked in the
+ * calling thread, and in the threads it starts after this, so that it only
+ * reaches the reload thread.
+ * Returns 0 on success, otherwise errno.
+ */
+int hot_reload_start(hot_reload_t *reload_ctx, hot_profile_t **profiles,
+                     int count) {
+  reload_ctx->profiles = profiles;
+  reload_ctx->count = count < HOT_MAX_PROFILES ? count : HOT_MAX_PROFILES;
+  reload_ctx->inotify_fd = inotify_init1(IN_CLOEXEC);
+  reload_ctx->stop_fd = eventfd(0, EFD_CLOEXEC);
+  sigset_t hup;
+  sigemptyset(&hup);
+  sigaddset(&hup, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &hup, NULL);
+  reload_ctx->signal_fd = signalfd(-1, &hup, SFD_CLOEXEC);
+  if (reload_ctx->inotify_fd < 0 || reload_ctx->stop_fd < 0 ||
+      reload_ctx->signal_fd < 0) {
+    const int err = errno;
+    close_fds(reload_ctx);
+    return err;
+  }
+
+  for (int idx = 0; idx < reload_ctx->count; ++idx) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", profiles[idx]->path);
+    reload_ctx->watches[idx] = inotify_add_watch(
+        reload_ctx->inotify_fd, dirname(dir), HOT_WATCH_EVENTS);
+    if (reload_ctx->watches[idx] < 0) {
+      const int err = errno;
+      close_fds(reload_ctx);
+      return err;
+    }
+  }
+
+  const int err =
+      pthread_create(&reload_ctx->thread, NULL, reload_thread, reload_ctx);
+  if (err) {
+    close_fds(reload_ctx);
+  }
+  return err;
+}
+
+/**
+ * Stop the reload thread. A reload in progress is finished first.
+ */
+void hot_reload_stop(hot_reload_t *reload_ctx) {
+  const uint64_t one = 1;
+  if (write(reload_ctx->stop_fd, &one, sizeof(one)) == sizeof(one)) {
+    pthread_join(reload_ctx->thread, NULL);
+  }
+  close_fds(reload_ctx);
+}
@@ -0,0 +1,86 @@
+/**
+ * Profiles that can be reloaded while the driver runs. The driver reads the
+ * settings of a profile through an atomic pointer. A reload thread parses the
+ * config and builds its tables, then swaps the pointer, like RCU. The old
+ * settings are freed once no reader can still be using them, so the driver
+ * never blocks or takes a lock, and its carry is kept across the swap.
+ */
+
+#ifndef HOT_RELOAD_H
+#define HOT_RELOAD_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "mouse_accel.h"
+
+/* Readers of one profile, at least one for each mouse the driver runs */
+#define HOT_MAX_READERS 16
+/* Profiles one reload thread watches */
+#define HOT_MAX_PROFILES 16
+/* How often a swap checks if readers have finished, in microseconds */
+#define HOT_GRACE_POLL_US 100
+
+/**
+ * Generation of the profile a reader is using. Each reader has its own cache
+ * line, so readers on different threads don't share one.
+ */
+typedef struct hot_reader {
+  _Alignas(64) _Atomic uint64_t generation; /* 0 while between reports */
+} hot_reader_t;
+
+typedef struct hot_profile {
+  accel_settings_t *_Atomic current;
+  _Atomic uint64_t generation;   /* Starts at 1, bumped on each swap */
+  accel_settings_t *initial;     /* Owned by the caller, never freed here */
+  const char *path;              /* Config the profile is reloaded from */
+  hot_reader_t readers[HOT_MAX_READERS];
+  _Atomic int reader_count;
+} hot_profile_t;
+
+/**
+ * Start using the current settings of profile. The generation is published
+ * before the pointer is read, so a swap sees the reader before it can free
+ * what the reader gets.
+ */
+static inline const accel_plan_t *hot_profile_enter(hot_profile_t *profile,
+                                                    hot_reader_t *reader) {
+  atomic_store(&reader->generation,
+               atomic_load_explicit(&profile->generation,
+                                    memory_order_acquire));
+  return &atomic_load(&profile->current)->plan;
+}
+
+/**
+ * Stop using the plan returned by hot_profile_enter.
+ */
+static inline void hot_profile_exit(hot_reader_t *reader) {
+  atomic_store_explicit(&reader->generation, 0, memory_order_release);
+}
+
+void hot_profile_init(hot_profile_t *, accel_settings_t *, const char *);
+hot_reader_t *hot_profile_reader(hot_profile_t *);
+void hot_profile_swap(hot_profile_t *, accel_settings_t *);
+int hot_profile_reload(hot_profile_t *);
+void hot_profile_free(hot_profile_t *);
+
+/**
+ * Thread that reloads profiles when their config file is written or the
+ * driver gets SIGHUP.
+ */
+typedef struct hot_reload {
+  hot_profile_t **profiles;
+  int count;
+  int watches[HOT_MAX_PROFILES]; /* inotify watch of each config's directory */
+  int inotify_fd;
+  int signal_fd; /* SIGHUP, which is blocked while the thread runs */
+  int stop_fd;   /* eventfd written by hot_reload_stop */
+  pthread_t thread;
+} hot_reload_t;
+
+int hot_reload_start(hot_reload_t *, hot_profile_t **, int);
+void hot_reload_stop(hot_reload_t *);
+
+#endif
@@ -0,0 +1,77 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "live_ring.h"
+
+// mod.py reads the segment at these offsets.
+_Static_assert(offsetof(live_ring_t, head) == 64, "head moved");
+_Static_assert(offsetof(live_ring_t, slots) == 128, "slots moved");
+_Static_assert(sizeof(live_slot_t) == 48, "slot size changed");
+
+/**
+ * Create the shared memory segment and map the ring in it. A segment left
+ * by a driver that did not exit cleanly is replaced. The segment can be read
+ * by any user, so the GUI doesn't need root.
+ * Returns 0 on success, otherwise errno.
+ */
+int live_ring_open(live_ring_t **ring) {
+  const int fd = shm_open(LIVE_RING_NAME, O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+  // the reset to 0 clears every slot of an old segment.
+  if (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(live_ring_t)) != 0) {
+    const int err = errno;
+    close(fd);
+    shm_unlink(LIVE_RING_NAME);
+    return err;
+  }
+  live_ring_t *mapped = mmap(NULL, sizeof(live_ring_t), PROT_READ | PROT_WRITE,
+                             MAP_SHARED, fd, 0);
+  const int err = mapped == MAP_FAILED ? errno : 0;
+  close(fd);
+  if (err) {
+    shm_unlink(LIVE_RING_NAME);
+    return err;
+  }
+  mapped->size = LIVE_RING_SIZE;
+  mapped->slot_size = sizeof(live_slot_t);
+  mapped->version = LIVE_RING_VERSION;
+  atomic_store(&mapped->head, 0);
+  // readers check the magic last, so they never see a half set up header.
+  atomic_thread_fence(memory_order_release);
+  mapped->magic = LIVE_RING_MAGIC;
+  *ring = mapped;
+  return 0;
+}
+
+/**
+ * Unmap the ring and remove its segment.
+ */
+void live_ring_close(live_ring_t *ring) {
+  munmap(ring, sizeof(live_ring_t));
+  shm_unlink(LIVE_RING_NAME);
+}
+
+/**
+ * Copy the sample with index idx.
+ * Returns false if it has not been published yet, or was overwritten.
+ */
+bool live_ring_read(const live_ring_t *ring, uint64_t idx,
+                    live_sample_t *sample) {
+  const live_slot_t *slot = &ring->slots[idx & (LIVE_RING_SIZE - 1)];
+  const uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+  if (seq != 2 * idx + 2) {
+    return false;
+  }
+  *sample = slot->sample;
+  atomic_thread_fence(memory_order_acquire);
+  return atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq;
+}
@@ -0,0 +1,80 @@
+/**
+ * Ring of recent samples in shared memory, so a tool like the GUI can watch
+ * the accel curve while the driver runs. Publishing a sample is a few stores
+ * and one atomic add, with no syscall. Readers never block the driver, they
+ * skip samples that were overwritten while they read them.
+ */
+
+#ifndef LIVE_RING_H
+#define LIVE_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Name of the shared memory segment, mapped at /dev/shm/marley_accel */
+#define LIVE_RING_NAME "/marley_accel"
+#define LIVE_RING_MAGIC 0x4c52414du /* "MARL" */
+/* Bumped whenever the layout of the segment changes */
+#define LIVE_RING_VERSION 1
+/* Slots in the ring, a power of two */
+#define LIVE_RING_SIZE 4096
+#define LIVE_RING_CACHE_LINE 64
+
+/**
+ * One report as the driver saw it.
+ */
+typedef struct live_sample {
+  uint64_t time_ns; /* When the report arrived */
+  int32_t in_dx;
+  int32_t in_dy;
+  int32_t out_dx;   /* Accelerated deltas */
+  int32_t out_dy;
+  float vel_dx;     /* Velocity the sens was found from, after pre scalars */
+  float vel_dy;
+  float sens;       /* Before the post scalars */
+  uint32_t device;  /* Index of the mouse */
+} live_sample_t;
+
+/**
+ * seq is 2 * index + 1 while the sample with that index is written, and
+ * 2 * index + 2 once it is done.
+ */
+typedef struct live_slot {
+  _Atomic uint64_t seq;
+  live_sample_t sample;
+} live_slot_t;
+
+/**
+ * The whole segment. Readers in other languages use the header to check the
+ * layout, then read head and the slots at their fixed offsets.
+ */
+typedef struct live_ring {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;      /* Slots in the ring */
+  uint32_t slot_size; /* Bytes in a slot */
+  _Alignas(LIVE_RING_CACHE_LINE) _Atomic uint64_t head; /* Samples so far */
+  _Alignas(LIVE_RING_CACHE_LINE) live_slot_t slots[LIVE_RING_SIZE];
+} live_ring_t;
+
+int live_ring_open(live_ring_t **);
+void live_ring_close(live_ring_t *);
+bool live_ring_read(const live_ring_t *, uint64_t, live_sample_t *);
+
+/**
+ * Publish a sample. Several mice may publish to one ring at once, each takes
+ * its own slot.
+ */
+static inline void live_ring_publish(live_ring_t *ring,
+                                     const live_sample_t *sample) {
+  const uint64_t idx =
+      atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+  live_slot_t *slot = &ring->slots[idx & (LIVE_RING_SIZE - 1)];
+  atomic_store_explicit(&slot->seq, 2 * idx + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->sample = *sample;
+  atomic_store_explicit(&slot->seq, 2 * idx + 2, memory_order_release);
+}
+
+#endif
@@ -1,4 +1,4 @@
-#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdbool.h>
@@ -7,48 +7,66 @@
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <libusb-1.0/libusb.h>
+#include <linux/input.h>
 #include <linux/uinput.h>
 
 #include "errmsg.h"
+#include "key_codes.h"
 #include "loading_util.h"
-#include "marley_map.h"
 #include "mouse_accel.h"
 
-#define CONFIG_LINE_LENGTH 1024
+#define REPORT_DESCRIPTOR_MAX 4096
+#define REPORT_DESCRIPTOR_TIMEOUT_MS 1000
 
-static void make_lowercase(char *);
-static void remove_spaces(char *);
-static void remove_comments(char *);
-static int assign_settings(const char *, accel_settings_t *);
 static void create_bindings(int);
 static int initialize_device(int, uint16_t, uint16_t);
 
 /**
- * Load users accel settings from the specified configuration file.
- * This will automatically perform some cleaning to the config file and remove
- * comments
+ * Polling interval of the device in microseconds. bInterval counts frames of
+ * 1 ms on low and full speed devices. On faster devices it is the exponent of
+ * a count of 125 us microframes. Returns 0 if the interval is unknown.
  */
-int load_config(accel_settings_t *as, const char *config_path) {
-  FILE *config = fopen(config_path, "r");
-  char line[CONFIG_LINE_LENGTH];
-  while (fgets(line, sizeof(line), config) != NULL) {
-    make_lowercase(line);
-    remove_spaces(line);
-    remove_comments(line);
-    int err = assign_settings(line, as);
-    if (err) {
-      return err;
+static uint32_t polling_interval_us(mouse_dev_t *dev) {
+  if (dev->interval == 0) {
+    return 0;
+  }
+  switch (libusb_get_device_speed(libusb_get_device(dev->usb_handle))) {
+  case LIBUSB_SPEED_LOW:
+  case LIBUSB_SPEED_FULL:
+    return dev->interval * 1000;
+  case LIBUSB_SPEED_UNKNOWN:
+    return 0;
+  default:
+    return dev->interval > 16 ? 0 : 125u << (dev->interval - 1);
+  }
+}
+
+/**
+ * Open the device at dev's bus number and address, so that one of several
+ * mice with the same vendor and product ids can be picked.
+ * Returns NULL if it is not there.
+ */
+static libusb_device_handle *open_device_at(mouse_dev_t *dev) {
+  libusb_device **list;
+  const ssize_t count = libusb_get_device_list(dev->usb_ctx, &list);
+  libusb_device_handle *handle = NULL;
+  for (ssize_t idx = 0; idx < count; ++idx) {
+    if (libusb_get_bus_number(list[idx]) == dev->bus_number &&
+        libusb_get_device_address(list[idx]) == dev->device_address) {
+      if (libusb_open(list[idx], &handle) != 0) {
+        handle = NULL;
+      }
+      break;
     }
   }
-  // default to quake accel if nothing specified.
-  if (!as->accel) {
-    as->accel = quake_accel;
+  if (count >= 0) {
+    libusb_free_device_list(list, 1);
   }
-  fclose(config);
-  return 0;
+  return handle;
 }
 
 /**
@@ -63,8 +81,12 @@ int dev_setup(mouse_dev_t *dev) {
 
   // find the device using the vendor and product ids.
   // These can be found using the "usb-devices" command in the terminal.
-  dev->usb_handle = libusb_open_device_with_vid_pid(
-      dev->usb_ctx, dev->vendor_id, dev->product_id);
+  if (dev->device_address) {
+    dev->usb_handle = open_device_at(dev);
+  } else {
+    dev->usb_handle = libusb_open_device_with_vid_pid(
+        dev->usb_ctx, dev->vendor_id, dev->product_id);
+  }
   if (!dev->usb_handle) {
     printf("Marley-Accel: Device not found, try running with sudo.\n");
     return -1;
@@ -92,14 +114,70 @@ int dev_setup(mouse_dev_t *dev) {
     return err;
   }
   dev->usb_claimed = true;
+  dev->interval_us = polling_interval_us(dev);
+
+  return 0;
+}
+
+/**
+ * Read the HID report descriptor of the claimed interface and parse the
+ * layout of the mouse reports from it. dev->layout is only changed if the
+ * descriptor describes a mouse.
+ * Returns 0 on success, -1 if the layout could not be found, or the libusb
+ * error if the descriptor could not be read.
+ */
+int dev_read_layout(mouse_dev_t *dev) {
+  unsigned char desc[REPORT_DESCRIPTOR_MAX];
+  const int len = libusb_control_transfer(
+      dev->usb_handle,
+      LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_STANDARD |
+          LIBUSB_RECIPIENT_INTERFACE,
+      LIBUSB_REQUEST_GET_DESCRIPTOR, LIBUSB_DT_REPORT << 8, dev->interface,
+      desc, sizeof(desc), REPORT_DESCRIPTOR_TIMEOUT_MS);
+  if (len < 0) {
+    return len;
+  }
+  return report_layout_parse(&dev->layout, desc, len);
+}
 
+/**
+ * Device setup for the evdev backend. Opens an event device and grabs it, so
+ * its events only reach the driver and not the rest of the system. Works for
+ * any mouse the kernel has a driver for, not just USB mice. Events are
+ * stamped with CLOCK_MONOTONIC, so the driver can time them.
+ * Returns 0 on success, otherwise errno.
+ */
+int evdev_setup(mouse_dev_t *dev, const char *path) {
+  dev->evdev_fd = open(path, O_RDONLY);
+  if (dev->evdev_fd < 0) {
+    return errno;
+  }
+  const int clock = CLOCK_MONOTONIC;
+  if (ioctl(dev->evdev_fd, EVIOCSCLOCKID, &clock) != 0) {
+    return errno;
+  }
+  struct input_id id;
+  if (ioctl(dev->evdev_fd, EVIOCGID, &id) == 0) {
+    dev->vendor_id = id.vendor;
+    dev->product_id = id.product;
+  }
+  if (ioctl(dev->evdev_fd, EVIOCGRAB, 1) != 0) {
+    return errno;
+  }
+  dev->evdev_grabbed = true;
   return 0;
 }
 
 /**
- * undoes dev_setup. Releases the device and reattaches the kernel driver.
+ * undoes dev_setup or evdev_setup. Releases the device and reattaches the
+ * kernel driver.
  */
 void dev_close(mouse_dev_t *dev) {
+  if (dev->evdev_fd >= 0) {
+    if (dev->evdev_grabbed)
+      ioctl(dev->evdev_fd, EVIOCGRAB, 0);
+    close(dev->evdev_fd);
+  }
   if (dev->usb_handle) {
     if (dev->usb_claimed)
       libusb_release_interface(dev->usb_handle, dev->interface);
@@ -142,107 +220,19 @@ void close_input_device(int fd) {
   close(fd);
 }
 
-static void make_lowercase(char *line) {
-  for (int idx = 0; idx < CONFIG_LINE_LENGTH && line[idx] != '\0'; ++idx) {
-    line[idx] = tolower(line[idx]);
-  }
-}
-
-/**
- * Remove all spaces from the line string. The config files are small. This can
- * be done efficiently enough by shifting text to cover spaces in-place.
- */
-static void remove_spaces(char *line) {
-  for (int idx = 0; idx < CONFIG_LINE_LENGTH && line[idx] != '\0'; ++idx) {
-    // shift text over to remove space.
-    if (isspace(line[idx])) {
-      for (int shift = idx; shift < CONFIG_LINE_LENGTH && line[shift] != '\0';
-           ++shift) {
-        line[shift] = line[shift + 1];
-      }
-    }
-  }
-}
-
-/**
- * Remove comments from a line in a config file
- * This is done by Replace '#' with end of string.
- */
-static void remove_comments(char *line) {
-  for (int idx = 0; idx < CONFIG_LINE_LENGTH; ++idx) {
-    if (line[idx] == '#') {
-      line[idx] = '\0';
-    }
-  }
-}
-
-marley_map *name_to_func_map() {
-  marley_map *map = marley_map_alloc(4);
-  marley_map_set(map, "quake", (void *)quake_accel);
-  marley_map_set(map, "quake_accel", (void *)quake_accel);
-  marley_map_set(map, "pow", (void *)pow_accel);
-  marley_map_set(map, "pow_accel", (void *)pow_accel);
-  return map;
-}
-
-static int assign_settings(const char *line, accel_settings_t *as) {
-  char *eq_ptr = strchr(line, '=');
-  if (eq_ptr == NULL) {
-    return -1;
-  }
-  *eq_ptr = '\0';
-
-  marley_map *map = name_to_func_map();
-  accel_func accel = (accel_func)marley_map_lookup(map, eq_ptr + 1);
-  marley_map_free(map);
-  if (!accel) {
-    return -1;
-  }
-
-  if (accel) {
-    as->accel = accel;
-  } else if (strcmp(line, "base") == 0) {
-    as->base = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "offset") == 0) {
-    as->offset = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "upper_bound") == 0) {
-    as->upper_bound = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "accel_rate") == 0) {
-    as->accel_rate = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "power") == 0) {
-    as->power = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "game_sens") == 0) {
-    as->game_sens = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "overflow_lim") == 0) {
-    as->overflow_lim = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "pre_scalar_x") == 0) {
-    as->pre_scalar_x = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "pre_scalar_y") == 0) {
-    as->pre_scalar_y = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "post_scalar_x") == 0) {
-    as->post_scalar_x = strtof(eq_ptr + 1, NULL);
-  } else if (strcmp(line, "post_scalar_y") == 0) {
-    as->post_scalar_y = strtof(eq_ptr + 1, NULL);
-  } else {
-    return -1;
-  }
-  return 0;
-}
-
 static void create_bindings(int fd) {
   // mouse buttons
   ioctl(fd, UI_SET_EVBIT, EV_KEY);
-  ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
-  ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
-  ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
-  ioctl(fd, UI_SET_KEYBIT, BTN_SIDE);
-  ioctl(fd, UI_SET_KEYBIT, BTN_EXTRA);
+  for (int bit = 0; bit < BUTTON_COUNT; ++bit) {
+    ioctl(fd, UI_SET_KEYBIT, button_codes[bit]);
+  }
 
   // mouse movement and scroll wheel
   ioctl(fd, UI_SET_EVBIT, EV_REL);
   ioctl(fd, UI_SET_RELBIT, REL_X);
   ioctl(fd, UI_SET_RELBIT, REL_Y);
   ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+  ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
 }
 
 static int initialize_device(int fd, uint16_t vendor_id, uint16_t product_id) {
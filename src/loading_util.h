@@ -1,6 +1,8 @@
 #ifndef LOADING_UTIL_H
 #define LOADING_UTIL_H
 
+#include "report_layout.h"
+
 // defined in m_accel.h
 typedef struct accel_settings accel_settings_t;
 
@@ -11,17 +13,26 @@ typedef struct mouse_dev {
   bool usb_claimed;
   uint16_t vendor_id;
   uint16_t product_id;
+  uint8_t bus_number;     /* With device_address, picks one of several mice */
+  uint8_t device_address; /* with the same ids. 0 opens the first match */
   uint16_t endpoint_in;
   uint16_t interface;
   uint16_t buf_size;
+  uint8_t interval;       /* bInterval of endpoint_in */
+  uint32_t interval_us;   /* Polling interval, set by dev_setup */
+  uint16_t transfers;     /* Transfers kept in flight, 0 for blocking reads */
+  int evdev_fd;           /* Event device read instead of USB, -1 if unused */
+  bool evdev_grabbed;
+  report_layout_t layout; /* Where each value is in a report */
+  report_plan_t decode;   /* layout compiled by report_plan_compile */
 } mouse_dev_t;
 
-int load_config(accel_settings_t *, const char *);
-
 /**
  * functions to manage the device with libusb
  */
 int dev_setup(mouse_dev_t *dev);
+int dev_read_layout(mouse_dev_t *dev);
+int evdev_setup(mouse_dev_t *dev, const char *path);
 void dev_close(mouse_dev_t *dev);
 
 /**
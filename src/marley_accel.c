@@ -1,103 +1,739 @@
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <libusb-1.0/libusb.h>
 #include <linux/uinput.h>
 
+#include "config.h"
 #include "errmsg.h"
 #include "find_mouse.h"
+#include "hot_reload.h"
+#include "live_ring.h"
 #include "loading_util.h"
 #include "mouse_accel.h"
 #include "mouse_driver.h"
+#include "output_sink.h"
+#include "report_layout.h"
+#include "report_log.h"
+#include "telemetry.h"
 
-int main(int argc, char *argv[]) {
-  int err;
-  char *config_path;
-
-  // default accel settings
-  accel_settings_t as = {.accel = quake_accel,
-                         .overflow_lim = 10,
-                         .base = 1,
-                         .offset = 0,
-                         .upper_bound = 8,
-                         .accel_rate = 2,
-                         .power = 2,
-                         .game_sens = 1,
-                         .carry_dx = 0,
-                         .carry_dy = 0,
-                         .pre_scalar_x = 1,
-                         .pre_scalar_y = 1,
-                         .post_scalar_x = 1,
-                         .post_scalar_y = 1};
-
-  if (argc == 2) {
-    config_path = argv[1];
-    printf("Loading config at %s\n", config_path);
-    err = load_config(&as, config_path);
-    if (err != 0) {
-      errmsg("There was an error loading the config\n", err);
-      return err;
-    }
-  } else {
-    printf("You did not pass a configuration file\n");
-    printf("Using default settings\n");
+/* Options that only have a long form */
+enum {
+  OPT_READER_CPU = 256,
+  OPT_WRITER_CPU,
+  OPT_BUSY_POLL,
+  OPT_EVDEV,
+  OPT_MERGE,
+  OPT_RECORD,
+  OPT_REPLAY,
+  OPT_TIMED,
+  OPT_SINK,
+  OPT_SWITCH,
+  OPT_LIVE,
+  OPT_TELEMETRY
+};
+
+static void usage(const char *name) {
+  printf("Usage: %s [options] [config_file...]\n", name);
+  printf("Each config file is used for one mouse, in the order the mice are "
+         "opened. Mice\n"
+         "past the last config file use that file's settings.\n");
+  printf("  -b, --delta-bits N   skip the HID report descriptor and read X/Y "
+         "deltas of 8, 12\n"
+         "                       or 16 bits (default %d if the descriptor "
+         "can't be read)\n",
+         REPORT_DELTA_BITS_DEFAULT);
+  printf("  -t, --transfers N    transfers kept in flight, 0 for blocking "
+         "reads (default %d)\n",
+         DRIVER_DEFAULT_TRANSFERS);
+  printf("  -T, --threaded       read and write reports on separate threads\n");
+  printf("  -p, --rt-priority N  run the driver threads as SCHED_FIFO with "
+         "priority N\n");
+  printf("      --reader-cpu N   pin the USB reader thread to CPU N\n");
+  printf("      --writer-cpu N   pin the uinput writer thread to CPU N\n");
+  printf("  -m, --mlock          lock the driver's memory and prefault the "
+         "thread stacks\n");
+  printf("      --busy-poll      spin instead of sleeping while waiting for "
+         "reports\n");
+  printf("      --evdev PATH     read the mouse from an event device, like "
+         "/dev/input/event5,\n"
+         "                       instead of from USB. May be given for "
+         "several mice\n");
+  printf("  -a, --all            drive every USB mouse that is found\n");
+  printf("      --merge          send all mice to one uinput device\n");
+  printf("      --record FILE    write every raw USB report to FILE\n");
+  printf("      --replay FILE    drive uinput from the reports in FILE "
+         "instead of a mouse\n");
+  printf("      --timed          replay reports with their original timing "
+         "instead of at\n"
+         "                       full speed\n");
+  printf("      --sink SINK      where events go: uinput (default), null, "
+         "or file:PATH for\n"
+         "                       a stream of input_event structs\n");
+  printf("      --switch CHORD   cycle through the [profile] sections of the "
+         "config when\n"
+         "                       the buttons in CHORD, like 4+5, are held. "
+         "They are not\n"
+         "                       forwarded\n");
+  printf("      --live           publish every report to /dev/shm%s for "
+         "mod.py --live\n",
+         LIVE_RING_NAME);
+  printf("      --telemetry      time every report and count clips, bounds "
+         "and saturations,\n"
+         "                       printed on SIGUSR1 and when the driver "
+         "stops\n");
+  printf("  -r, --reload         reload config files when they are written or "
+         "on SIGHUP,\n"
+         "                       without stopping the driver\n");
+  printf("  -h, --help           show this message\n");
+}
+
+static void print_field(const char *name, const report_field_t *field) {
+  if (field->bits) {
+    printf("  > %s: %d %s bits at bit %d\n", name, field->bits,
+           field->is_signed ? "signed" : "unsigned", field->offset);
+  }
+}
+
+static void print_layout(const report_layout_t *layout) {
+  printf("Report Layout:\n");
+  if (layout->report_id) {
+    printf("  > report_id=%d\n", layout->report_id);
   }
+  print_field("buttons", &layout->buttons);
+  print_field("x", &layout->x);
+  print_field("y", &layout->y);
+  print_field("wheel", &layout->wheel);
+  print_field("hwheel", &layout->hwheel);
+}
 
+static void print_settings(const accel_settings_t *as) {
   printf("Accel Config Settings:\n");
-  printf("  > overflow_lim=%d\n", as.overflow_lim);
-  printf("  > base=%.4f\n", as.base);
-  printf("  > offset=%.4f\n", as.offset);
-  printf("  > upper_bound=%.4f\n", as.upper_bound);
-  printf("  > accel_rate=%.4f\n", as.accel_rate);
-  printf("  > power=%.4f\n", as.power);
-  printf("  > game_sens=%.4f\n", as.game_sens);
-  printf("  > pre_scalar_x=%.4f\n", as.pre_scalar_x);
-  printf("  > pre_scalar_y=%.4f\n", as.pre_scalar_y);
-  printf("  > post_scalar_x=%.4f\n", as.post_scalar_x);
-  printf("  > post_scalar_y=%.4f\n", as.post_scalar_y);
-
-  mouse_info_t mouse_info = find_mouse();
-  if (!mouse_info.found) {
-    printf("Marley-Accel: No USB mouse was found.\n");
+  printf("  > overflow_lim=%d\n", as->overflow_lim);
+  printf("  > base=%.4f\n", as->base);
+  printf("  > offset=%.4f\n", as->offset);
+  printf("  > upper_bound=%.4f\n", as->upper_bound);
+  printf("  > accel_rate=%.4f\n", as->accel_rate);
+  printf("  > power=%.4f\n", as->power);
+  printf("  > game_sens=%.4f\n", as->game_sens);
+  printf("  > pre_scalar_x=%.4f\n", as->pre_scalar_x);
+  printf("  > pre_scalar_y=%.4f\n", as->pre_scalar_y);
+  printf("  > post_scalar_x=%.4f\n", as->post_scalar_x);
+  printf("  > post_scalar_y=%.4f\n", as->post_scalar_y);
+  if (as->curve) {
+    printf("  > points=");
+    for (int idx = 0; idx < as->curve_points; ++idx) {
+      printf("%s%.4f:%.4f", idx ? "," : "", as->curve_vel[idx],
+             as->curve_sens[idx]);
+    }
+    printf(" (%d knots, %s)\n", as->curve->size,
+           as->curve_spline ? "spline" : "linear");
+  }
+  if (as->lut) {
+    printf("  > lut_size=%d (%s)\n", as->lut_size,
+           as->lut_single ? "float" : "double");
+  }
+  if (as->fixed) {
+    printf("  > fixed_point=Q%d.%d (max sens error %.6f)\n",
+           32 - FIXED_FRAC_BITS, FIXED_FRAC_BITS, accel_fixed_max_error(as));
+  }
+  if (as->plan.window_us) {
+    printf("  > vel_window=%.3f ms\n", as->plan.window_us / 1000.0);
+  }
+  printf("  > kernel=%s\n", accel_plan_name(&as->plan));
+}
+
+/**
+ * Fill the first profile with the default settings, then load the config at
+ * path over them if it is not NULL. Each section of the config fills
+ * another profile, up to DRIVER_MAX_PROFILES, and count is set to the number
+ * of profiles.
+ * Returns 0 on success, otherwise the error from load_profiles.
+ */
+static int load_profile(config_profile_t *profiles, int *count,
+                        const char *path) {
+  default_config(&profiles[0].settings);
+  profiles[0].name[0] = '\0';
+  *count = 1;
+  if (!path) {
+    return 0;
+  }
+  printf("Loading config at %s\n", path);
+  const int err = load_profiles(path, profiles, DRIVER_MAX_PROFILES, count);
+  if (!err && *count > DRIVER_MAX_PROFILES) {
+    printf("Marley-Accel: Only the first %d profiles in %s are used.\n",
+           DRIVER_MAX_PROFILES, path);
+    *count = DRIVER_MAX_PROFILES;
+  }
+  return err;
+}
+
+static const char *profile_name(const config_profile_t *profile) {
+  return profile->name[0] ? profile->name : "default";
+}
+
+/**
+ * Parse a chord of button numbers joined by +, like 4+5, into a mask.
+ * Returns 0 on success, -1 if a button is not between 1 and BUTTON_COUNT.
+ */
+static int parse_chord(const char *spec, uint32_t *chord) {
+  *chord = 0;
+  const char *pos = spec;
+  do {
+    char *end;
+    const long button = strtol(pos, &end, 10);
+    if (end == pos || button < 1 || button > BUTTON_COUNT ||
+        (*end != '+' && *end != '\0')) {
+      return -1;
+    }
+    *chord |= 1u << (button - 1);
+    pos = *end ? end + 1 : end;
+  } while (*pos);
+  return 0;
+}
+
+/**
+ * Open the USB mouse described by info and find the layout of its reports.
+ * Returns 0 on success, otherwise the error. dev must be closed either way.
+ */
+static int usb_open(mouse_dev_t *dev, const mouse_info_t *info,
+                    bool read_descriptor, int delta_bits) {
+  dev->vendor_id = info->vendor_id;
+  dev->product_id = info->product_id;
+  dev->bus_number = info->bus_number;
+  dev->device_address = info->device_address;
+  dev->endpoint_in = info->endpoint_in;
+  dev->interface = info->interface;
+  dev->buf_size = info->buf_size;
+  dev->interval = info->interval;
+
+  const int err = dev_setup(dev);
+  if (err) {
+    libusb_errmsg("Error during device setup", err);
+    return err;
+  }
+
+  // the preset is only used if the report descriptor can't be read.
+  if (read_descriptor && dev_read_layout(dev) != 0) {
+    printf("Marley-Accel: Could not read the HID report descriptor, "
+           "assuming %d bit deltas.\n",
+           delta_bits);
+  }
+  print_layout(&dev->layout);
+  if (report_plan_compile(&dev->decode, &dev->layout) != 0) {
+    printf("Marley-Accel: Reports of this mouse can not be decoded.\n");
+    return 1;
+  }
+  if (dev->transfers > 0) {
+    printf("Polling interval %" PRIu32 " us, %d transfers in flight\n",
+           dev->interval_us, dev->transfers);
+  }
+  return 0;
+}
+
+static bool sink_spec_valid(const char *spec) {
+  return strcmp(spec, "uinput") == 0 || strcmp(spec, "null") == 0 ||
+         (strncmp(spec, "file:", 5) == 0 && spec[5] != '\0');
+}
+
+/**
+ * Set up the sink named by spec, which sink_spec_valid accepted. The ids are
+ * used for a uinput device.
+ * Returns 0 on success, otherwise the error.
+ */
+static int open_sink(output_sink_t *sink, const char *spec, uint16_t vendor_id,
+                     uint16_t product_id) {
+  if (strcmp(spec, "null") == 0) {
+    output_sink_null(sink);
     return 0;
+  } else if (strncmp(spec, "file:", 5) == 0) {
+    const int err = output_sink_file(sink, spec + 5);
+    if (err) {
+      errmsg("Could not open the output file", err);
+    }
+    return err;
   }
+  return output_sink_uinput(sink, vendor_id, product_id);
+}
 
+/**
+ * Replay the log at path through the driver with the settings in as.
+ * Returns 0 on success, otherwise the error.
+ */
+static int replay(const char *path, accel_settings_t *as,
+                  const driver_opts_t *opts, bool timed, bool with_telemetry,
+                  const char *sink_spec) {
+  report_log_t log;
+  int err = report_log_open(&log, path);
+  if (err) {
+    errmsg("Could not open the report log", err);
+    return err;
+  }
   mouse_dev_t md = {.usb_ctx = NULL,
                     .usb_handle = NULL,
-                    .usb_detached = false,
-                    .usb_claimed = false,
-                    .vendor_id = mouse_info.vendor_id,
-                    .product_id = mouse_info.product_id,
-                    .endpoint_in = mouse_info.endpoint_in,
-                    .interface = mouse_info.interface,
-                    .buf_size = mouse_info.buf_size};
-
-  err = dev_setup(&md);
+                    .vendor_id = log.vendor_id,
+                    .product_id = log.product_id,
+                    .interval_us = 0,
+                    .transfers = 0,
+                    .evdev_fd = -1,
+                    .layout = log.layout};
+  print_layout(&md.layout);
+  if (report_plan_compile(&md.decode, &md.layout) != 0) {
+    printf("Marley-Accel: Reports in the log can not be decoded.\n");
+    report_log_close(&log);
+    return 1;
+  }
+
+  output_sink_t sink;
+  err = open_sink(&sink, sink_spec, md.vendor_id, md.product_id);
   if (err) {
-    libusb_errmsg("Error during device setup", err);
-    dev_close(&md);
+    report_log_close(&log);
     return err;
   }
+  telemetry_t *telemetry =
+      with_telemetry ? malloc(sizeof(telemetry_t)) : NULL;
+  if (telemetry) {
+    telemetry_init(telemetry);
+  }
+  driver_stats_t stats = {
+      .reports = 0, .dropped = 0, .late = 0, .telemetry = telemetry};
+  printf("Replaying %s\n", path);
+  err = accel_replay(&sink, &md, as, opts, &stats, &log, timed);
+  if (err) {
+    printf("Marley-Accel: The report log is damaged.\n");
+  }
+  printf("Reports: %" PRIu64 ", events: %" PRIu64 "\n", stats.reports,
+         sink.written);
+  if (telemetry) {
+    telemetry_print(telemetry, stdout);
+  }
 
-  int fd = create_input_device(md.vendor_id, md.product_id);
+  free(telemetry);
+  output_sink_close(&sink);
+  report_log_close(&log);
+  return err;
+}
+
+int main(int argc, char *argv[]) {
+  int err = 0;
+  int mouse_count = 0;
+  int found_count = 0;
+  int delta_bits = REPORT_DELTA_BITS_DEFAULT;
+  bool read_descriptor = true;
+  const char *evdev_paths[DRIVER_MAX_DEVICES];
+  int evdev_count = 0;
+  bool all_mice = false;
+  bool merge = false;
+  const char *record_path = NULL;
+  report_log_t record;
+  const char *replay_path = NULL;
+  bool timed = false;
+  bool live = false;
+  bool with_telemetry = false;
+  const char *sink_spec = "uinput";
+  bool reload = false;
+  uint32_t chord = 0;
+  hot_reload_t reloader;
+  bool reloading = false;
+  int transfers = DRIVER_DEFAULT_TRANSFERS;
+  driver_opts_t opts = {.threaded = false,
+                        .rt_priority = 0,
+                        .reader_cpu = -1,
+                        .writer_cpu = -1,
+                        .lock_memory = false,
+                        .busy_poll = false,
+                        .record = NULL,
+                        .live = NULL};
+
+  static const struct option long_options[] = {
+      {"delta-bits", required_argument, NULL, 'b'},
+      {"transfers", required_argument, NULL, 't'},
+      {"threaded", no_argument, NULL, 'T'},
+      {"rt-priority", required_argument, NULL, 'p'},
+      {"reader-cpu", required_argument, NULL, OPT_READER_CPU},
+      {"writer-cpu", required_argument, NULL, OPT_WRITER_CPU},
+      {"mlock", no_argument, NULL, 'm'},
+      {"busy-poll", no_argument, NULL, OPT_BUSY_POLL},
+      {"evdev", required_argument, NULL, OPT_EVDEV},
+      {"all", no_argument, NULL, 'a'},
+      {"merge", no_argument, NULL, OPT_MERGE},
+      {"record", required_argument, NULL, OPT_RECORD},
+      {"replay", required_argument, NULL, OPT_REPLAY},
+      {"timed", no_argument, NULL, OPT_TIMED},
+      {"sink", required_argument, NULL, OPT_SINK},
+      {"reload", no_argument, NULL, 'r'},
+      {"switch", required_argument, NULL, OPT_SWITCH},
+      {"live", no_argument, NULL, OPT_LIVE},
+      {"telemetry", no_argument, NULL, OPT_TELEMETRY},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}};
+  int opt;
+  while ((opt = getopt_long(argc, argv, "b:t:Tp:marh", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+    case 'b':
+      delta_bits = strtol(optarg, NULL, 10);
+      read_descriptor = false;
+      break;
+    case 't':
+      transfers = strtol(optarg, NULL, 10);
+      break;
+    case 'T':
+      opts.threaded = true;
+      break;
+    case 'p':
+      opts.rt_priority = strtol(optarg, NULL, 10);
+      break;
+    case OPT_READER_CPU:
+      opts.reader_cpu = strtol(optarg, NULL, 10);
+      break;
+    case OPT_WRITER_CPU:
+      opts.writer_cpu = strtol(optarg, NULL, 10);
+      break;
+    case 'm':
+      opts.lock_memory = true;
+      break;
+    case OPT_BUSY_POLL:
+      opts.busy_poll = true;
+      break;
+    case OPT_EVDEV:
+      if (evdev_count == DRIVER_MAX_DEVICES) {
+        printf("Marley-Accel: At most %d mice can be driven.\n",
+               DRIVER_MAX_DEVICES);
+        return 1;
+      }
+      evdev_paths[evdev_count++] = optarg;
+      break;
+    case 'a':
+      all_mice = true;
+      break;
+    case OPT_MERGE:
+      merge = true;
+      break;
+    case OPT_RECORD:
+      record_path = optarg;
+      break;
+    case OPT_REPLAY:
+      replay_path = optarg;
+      break;
+    case OPT_TIMED:
+      timed = true;
+      break;
+    case OPT_SINK:
+      if (!sink_spec_valid(optarg)) {
+        printf("Marley-Accel: Unknown sink %s.\n", optarg);
+        return 1;
+      }
+      sink_spec = optarg;
+      break;
+    case 'r':
+      reload = true;
+      break;
+    case OPT_LIVE:
+      live = true;
+      break;
+    case OPT_TELEMETRY:
+      with_telemetry = true;
+      break;
+    case OPT_SWITCH:
+      if (parse_chord(optarg, &chord) != 0) {
+        printf("Marley-Accel: Invalid chord %s.\n", optarg);
+        return 1;
+      }
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (transfers < 0 || transfers > UINT16_MAX) {
+    printf("Marley-Accel: Invalid transfer count %d.\n", transfers);
+    return 1;
+  }
+
+  report_layout_t layout;
+  if (report_layout_preset(&layout, delta_bits) != 0) {
+    printf("Marley-Accel: No report layout for %d bit deltas.\n", delta_bits);
+    return 1;
+  }
+
+  // one set of profiles per config file, the top-level settings and then
+  // one for each section. Mice past the last file share its profiles, and
+  // only read their tables, so they are not copied. Every table is built
+  // here, so switching profiles never allocates.
+  static config_profile_t profiles[DRIVER_MAX_DEVICES][DRIVER_MAX_PROFILES];
+  int profile_sizes[DRIVER_MAX_DEVICES];
+  const char *profile_paths[DRIVER_MAX_DEVICES];
+  int profile_count = 0;
+  if (optind == argc) {
+    printf("You did not pass a configuration file\n");
+    printf("Using default settings\n");
+    profile_paths[profile_count] = NULL;
+    load_profile(profiles[profile_count], &profile_sizes[profile_count], NULL);
+    profile_count++;
+  }
+  for (; optind < argc && profile_count < DRIVER_MAX_DEVICES; ++optind) {
+    profile_paths[profile_count] = argv[optind];
+    err = load_profile(profiles[profile_count], &profile_sizes[profile_count],
+                       argv[optind]);
+    if (err != 0) {
+      errmsg("There was an error loading the config\n", err);
+      goto free_profiles;
+    }
+    profile_count++;
+  }
+  for (int idx = 0; idx < profile_count; ++idx) {
+    print_settings(&profiles[idx][0].settings);
+    if (profile_sizes[idx] > 1) {
+      printf("  > profiles=");
+      for (int entry = 0; entry < profile_sizes[idx]; ++entry) {
+        printf("%s%s", entry ? "," : "", profile_name(&profiles[idx][entry]));
+      }
+      printf("\n");
+    }
+  }
+
+  if (live) {
+    err = live_ring_open(&opts.live);
+    if (err) {
+      errmsg("Could not create the live ring", err);
+      goto free_profiles;
+    }
+    printf("Publishing reports to /dev/shm%s\n", LIVE_RING_NAME);
+  }
+
+  if (replay_path) {
+    err = replay(replay_path, &profiles[0][0].settings, &opts, timed,
+                 with_telemetry, sink_spec);
+    goto free_profiles;
+  }
+
+  mouse_dev_t mice[DRIVER_MAX_DEVICES];
+  const mouse_dev_t closed = {.usb_ctx = NULL,
+                              .usb_handle = NULL,
+                              .usb_detached = false,
+                              .usb_claimed = false,
+                              .bus_number = 0,
+                              .device_address = 0,
+                              .interval_us = 0,
+                              .transfers = transfers,
+                              .evdev_fd = -1,
+                              .evdev_grabbed = false,
+                              .layout = layout};
+
+  // event devices come first, then USB mice in bus order.
+  for (int idx = 0; idx < evdev_count; ++idx) {
+    mouse_dev_t *md = &mice[mouse_count++];
+    *md = closed;
+    err = evdev_setup(md, evdev_paths[idx]);
+    if (err) {
+      errmsg("Error opening the event device", err);
+      goto close_mice;
+    }
+  }
+
+  mouse_info_t found[DRIVER_MAX_DEVICES];
+  if (all_mice) {
+    found_count = find_mice(found, DRIVER_MAX_DEVICES - evdev_count);
+  } else if (evdev_count == 0) {
+    found_count = find_mice(found, 1);
+  }
+  if (evdev_count == 0 && found_count == 0) {
+    printf("Marley-Accel: No USB mouse was found.\n");
+    goto free_profiles;
+  }
+  for (int idx = 0; idx < found_count; ++idx) {
+    mouse_dev_t *md = &mice[mouse_count++];
+    *md = closed;
+    err = usb_open(md, &found[idx], read_descriptor, delta_bits);
+    if (err) {
+      goto close_mice;
+    }
+  }
+
+  if (opts.threaded && (evdev_count > 0 || mouse_count > 1)) {
+    printf("Marley-Accel: --threaded only applies to a single USB mouse.\n");
+  }
+
+  if (record_path && (mouse_count > 1 || mice[0].evdev_fd >= 0)) {
+    printf("Marley-Accel: --record only applies to a single USB mouse.\n");
+  } else if (record_path) {
+    record.vendor_id = mice[0].vendor_id;
+    record.product_id = mice[0].product_id;
+    record.layout = mice[0].layout;
+    err = report_log_create(&record, record_path);
+    if (err) {
+      errmsg("Could not create the report log", err);
+      goto close_mice;
+    }
+    opts.record = &record;
+    printf("Recording reports to %s\n", record_path);
+  }
+
+  // telemetry is optional, the driver runs without it if this fails.
+  telemetry_t *telemetry =
+      with_telemetry ? malloc(sizeof(telemetry_t) * mouse_count) : NULL;
+  if (with_telemetry && !telemetry) {
+    printf("Marley-Accel: Not enough memory for telemetry.\n");
+  }
+
+  // each mouse gets its own uinput device unless they are merged. Null and
+  // file sinks are always shared.
+  const bool shared_sink = merge || strcmp(sink_spec, "uinput") != 0;
+  output_sink_t sinks[DRIVER_MAX_DEVICES];
+  int sink_count = 0;
+  driver_device_t devices[DRIVER_MAX_DEVICES];
+  for (int idx = 0; idx < mouse_count; ++idx) {
+    mouse_dev_t *md = &mice[idx];
+    const int profile = idx < profile_count ? idx : profile_count - 1;
+    if (!shared_sink || idx == 0) {
+      err = open_sink(&sinks[sink_count], sink_spec, md->vendor_id,
+                      md->product_id);
+      if (err) {
+        goto close_sinks;
+      }
+      sink_count++;
+    }
+    const driver_device_t device = {
+        .dev = md,
+        .as = &profiles[profile][0].settings,
+        .hot = NULL,
+        .profiles = NULL,
+        .sink = &sinks[sink_count - 1],
+        .stats = {.reports = 0,
+                  .dropped = 0,
+                  .late = 0,
+                  .telemetry = telemetry ? &telemetry[idx] : NULL}};
+    devices[idx] = device;
+    if (telemetry) {
+      telemetry_init(&telemetry[idx]);
+    }
+    // the shared loop needs transfers to wait on.
+    if (mouse_count > 1 && md->evdev_fd < 0 && md->transfers == 0) {
+      md->transfers = DRIVER_DEFAULT_TRANSFERS;
+    }
+  }
+
+  // with a chord, each mouse switches between the profiles of its file.
+  profile_set_t sets[DRIVER_MAX_DEVICES];
+  for (int idx = 0; chord && idx < profile_count; ++idx) {
+    sets[idx].count = profile_sizes[idx];
+    sets[idx].chord = chord;
+    for (int entry = 0; entry < profile_sizes[idx]; ++entry) {
+      sets[idx].plans[entry] = &profiles[idx][entry].settings.plan;
+      sets[idx].names[entry] = profile_name(&profiles[idx][entry]);
+    }
+  }
+  for (int idx = 0; chord && idx < mouse_count; ++idx) {
+    const int profile = idx < profile_count ? idx : profile_count - 1;
+    devices[idx].profiles = &sets[profile];
+  }
+
+  // the driver reads each profile through its hot profile, which the reload
+  // thread swaps when the config is written. The default profile has no
+  // config to reload.
+  hot_profile_t hot[DRIVER_MAX_DEVICES];
+  hot_profile_t *watched[DRIVER_MAX_DEVICES];
+  if (reload && !profile_paths[0]) {
+    printf("Marley-Accel: --reload needs a config file.\n");
+  } else if (reload && chord) {
+    printf("Marley-Accel: --reload does not apply with --switch.\n");
+  } else if (reload) {
+    for (int idx = 0; idx < profile_count; ++idx) {
+      hot_profile_init(&hot[idx], &profiles[idx][0].settings,
+                       profile_paths[idx]);
+      watched[idx] = &hot[idx];
+    }
+    err = hot_reload_start(&reloader, watched, profile_count);
+    if (err) {
+      errmsg("Could not watch the config files", err);
+      goto close_sinks;
+    }
+    reloading = true;
+    for (int idx = 0; idx < mouse_count; ++idx) {
+      devices[idx].hot = &hot[idx < profile_count ? idx : profile_count - 1];
+    }
+  }
 
   printf("\nStop with Ctrl-c.\n");
+  if (telemetry) {
+    printf("Print telemetry with kill -USR1 %d.\n", (int)getpid());
+  }
+  if (reloading) {
+    printf("Configs are reloaded when written, or with kill -HUP %d.\n",
+           (int)getpid());
+  }
 
-  err = accel_driver(fd, &md, &as);
-  if (err) {
+  if (mouse_count == 1) {
+    err = accel_driver(&devices[0], &opts);
+  } else {
+    err = accel_driver_multi(devices, mouse_count, &opts);
+  }
+  if (reloading) {
+    hot_reload_stop(&reloader);
+    for (int idx = 0; idx < profile_count; ++idx) {
+      hot_profile_free(&hot[idx]);
+    }
+  }
+  printf("\n");
+  for (int idx = 0; idx < mouse_count; ++idx) {
+    const driver_stats_t *stats = &devices[idx].stats;
+    printf("Mouse %d reports: %" PRIu64 ", dropped: %" PRIu64
+           ", late: %" PRIu64 "\n",
+           idx, stats->reports, stats->dropped, stats->late);
+    if (devices[idx].profiles) {
+      printf("Mouse %d profile switches: %" PRIu64 ", last profile: %s\n",
+             idx, stats->switches,
+             devices[idx].profiles->names[stats->profile]);
+    }
+    if (stats->telemetry) {
+      telemetry_print(stats->telemetry, stdout);
+    }
+  }
+  if (err && mouse_count > 1) {
+    errmsg("Error reading the mice", err);
+  } else if (err && mice[0].evdev_fd >= 0) {
+    errmsg("Error reading the event device", err);
+  } else if (err) {
     libusb_errmsg("Error during device execution", err);
-    dev_close(&md);
-    return err;
   }
 
-  dev_close(&md);
+close_sinks:
+  free(telemetry);
+  for (int idx = 0; idx < sink_count; ++idx) {
+    output_sink_close(&sinks[idx]);
+  }
+  if (opts.record) {
+    report_log_close(opts.record);
+  }
 
-  if (fd)
-    close_input_device(fd);
+close_mice:
+  for (int idx = 0; idx < mouse_count; ++idx) {
+    dev_close(&mice[idx]);
+  }
+free_profiles:
+  if (opts.live) {
+    live_ring_close(opts.live);
+  }
+  for (int idx = 0; idx < profile_count; ++idx) {
+    for (int entry = 0; entry < profile_sizes[idx]; ++entry) {
+      free_config(&profiles[idx][entry].settings);
+    }
+  }
 
-  printf("Reattaching kernel driver.\n");
+  if (found_count > 0) {
+    printf("Reattaching kernel driver.\n");
+  }
 
-  return 0;
+  return err;
 }
@@ -0,0 +1,104 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "marley_api.h"
+#include "mouse_accel.h"
+
+/**
+ * The top-level profile of a config, built with its tables. It is allocated
+ * so the plan of a custom accel function can point back at it.
+ */
+struct marley_profile {
+  accel_settings_t settings;
+};
+
+int marley_api_version(void) { return MARLEY_API_VERSION; }
+
+/**
+ * Load the top-level profile of the config at path, or the default settings
+ * if path is NULL.
+ * Returns the profile, or NULL with the error from load_config in err.
+ */
+marley_profile_t *marley_profile_load(const char *path, int *err) {
+  marley_profile_t *profile = malloc(sizeof(marley_profile_t));
+  if (!profile) {
+    *err = ENOMEM;
+    return NULL;
+  }
+  default_config(&profile->settings);
+  *err = path ? load_config(&profile->settings, path) : 0;
+  if (*err) {
+    free(profile);
+    return NULL;
+  }
+  return profile;
+}
+
+/**
+ * Load the top-level profile of config text, like the config file would be.
+ * Returns the profile, or NULL with the line of the error in line, or 0 if
+ * the tables could not be built.
+ */
+marley_profile_t *marley_profile_parse(const char *text, int *line) {
+  marley_profile_t *profile = malloc(sizeof(marley_profile_t));
+  config_profile_t top;
+  int count;
+  *line = 0;
+  if (!profile) {
+    return NULL;
+  }
+  default_config(&top.settings);
+  if (parse_config(text, &top, 1, &count, line) != 0) {
+    free(profile);
+    return NULL;
+  }
+  profile->settings = top.settings;
+  if (build_config(&profile->settings) != 0) {
+    free_config(&profile->settings);
+    free(profile);
+    return NULL;
+  }
+  return profile;
+}
+
+void marley_profile_free(marley_profile_t *profile) {
+  if (profile) {
+    free_config(&profile->settings);
+    free(profile);
+  }
+}
+
+/**
+ * Name of the kernel the profile's plan was compiled to.
+ */
+const char *marley_profile_kernel(const marley_profile_t *profile) {
+  return accel_plan_name(&profile->settings.plan);
+}
+
+/**
+ * Gain on the x axis at each of n velocities, for motion along x: the sens
+ * the driver finds with the pre scalar applied, times the post scalar.
+ */
+void marley_eval_curve(const marley_profile_t *profile, const double *vel,
+                       double *gain, size_t n) {
+  const accel_plan_t *plan = &profile->settings.plan;
+  for (size_t idx = 0; idx < n; ++idx) {
+    gain[idx] = accel_plan_sens(plan, vel[idx], 0) * plan->post_scalar_x;
+  }
+}
+
+/**
+ * Sens the driver applies to each of n (dx, dy) pairs, before the post
+ * scalars. The deltas don't have to be whole counts.
+ */
+void marley_eval_sens(const marley_profile_t *profile, const double *dx,
+                      const double *dy, double *sens, size_t n) {
+  const accel_plan_t *plan = &profile->settings.plan;
+  for (size_t idx = 0; idx < n; ++idx) {
+    sens[idx] = accel_plan_sens(plan, dx[idx], dy[idx]);
+  }
+}
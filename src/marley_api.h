@@ -0,0 +1,33 @@
+/**
+ * Stable C API of libmarleyaccel. Tools like the GUI load a config through
+ * it and evaluate the accel curve with the same code the driver runs. Only
+ * the declarations here are part of the API, so the driver's structs can
+ * change without breaking programs built against it.
+ */
+
+#ifndef MARLEY_API_H
+#define MARLEY_API_H
+
+#include <stddef.h>
+
+/* Bumped whenever a declaration here changes */
+#define MARLEY_API_VERSION 1
+
+/* The library is built with hidden visibility, so only these are exported */
+#define MARLEY_API __attribute__((visibility("default")))
+
+typedef struct marley_profile marley_profile_t;
+
+MARLEY_API int marley_api_version(void);
+
+MARLEY_API marley_profile_t *marley_profile_load(const char *, int *);
+MARLEY_API marley_profile_t *marley_profile_parse(const char *, int *);
+MARLEY_API void marley_profile_free(marley_profile_t *);
+MARLEY_API const char *marley_profile_kernel(const marley_profile_t *);
+
+MARLEY_API void marley_eval_curve(const marley_profile_t *, const double *,
+                                  double *, size_t);
+MARLEY_API void marley_eval_sens(const marley_profile_t *, const double *,
+                                 const double *, double *, size_t);
+
+#endif
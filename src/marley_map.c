@@ -1,5 +1,6 @@
-
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -7,23 +8,88 @@
 
 key_value_pair *key_value_pair_constr(char *key, void *value) {
   key_value_pair *kv = malloc(sizeof(key_value_pair));
-  kv->key = malloc(sizeof(char) * strlen(key));
-  kv->value = malloc(sizeof(value));
-  *kv->key = *key;
-  *((char *)kv->value) = *((char *)value);
+  if (!kv) {
+    return NULL;
+  }
+  kv->key = strdup(key);
+  if (!kv->key) {
+    free(kv);
+    return NULL;
+  }
+  kv->value = value;
   return kv;
 }
 
-void key_value_pair_write(key_value_pair *kv, char *key, void *value) {
-  kv->key = malloc(sizeof(char) * strlen(key));
-  kv->value = malloc(sizeof(value));
-  *kv->key = *key;
-  *((char *)kv->value) = *((char *)value);
-}
-
+/**
+ * Free a pair made by key_value_pair_constr. The value is not owned by the
+ * pair, so it is not freed.
+ */
 void key_value_pair_free(key_value_pair *kv) {
   free(kv->key);
-  free(kv->value);
+  free(kv);
+}
+
+/**
+ * FNV-1a hash of a string.
+ */
+static uint32_t hash_key(const char *key) {
+  uint32_t hash = 2166136261u;
+  for (; *key != '\0'; ++key) {
+    hash = (hash ^ (unsigned char)*key) * 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * Copy key into the map's arena. A new block is started when the newest one
+ * is full, so keys never move once they are copied.
+ * Returns the copy, or NULL if a block could not be allocated.
+ */
+static char *intern_key(marley_map *map, const char *key) {
+  const size_t len = strlen(key) + 1;
+  marley_arena_block *block = map->keys;
+  if (!block || block->size - block->used < len) {
+    const size_t size = len > MARLEY_ARENA_BLOCK ? len : MARLEY_ARENA_BLOCK;
+    block = malloc(sizeof(marley_arena_block) + size);
+    if (!block) {
+      return NULL;
+    }
+    block->next = map->keys;
+    block->used = 0;
+    block->size = size;
+    map->keys = block;
+  }
+  char *copy = memcpy(block->data + block->used, key, len);
+  block->used += len;
+  return copy;
+}
+
+/**
+ * Slots for a map of reserved_size entries: a power of two, at least twice
+ * reserved_size.
+ */
+static uint32_t slot_count(int reserved_size) {
+  uint32_t slots = MARLEY_MAP_MIN_SLOTS;
+  while (slots < 2 * (uint32_t)reserved_size) {
+    slots *= 2;
+  }
+  return slots;
+}
+
+/**
+ * Slot holding key, or the empty slot where it would be inserted.
+ */
+static uint32_t find_slot(const marley_map *map, const char *key,
+                          uint32_t hash) {
+  uint32_t slot = hash & map->mask;
+  while (map->slots[slot] != 0) {
+    const uint32_t entry = map->slots[slot] - 1;
+    if (map->hashes[entry] == hash && strcmp(map->data[entry].key, key) == 0) {
+      break;
+    }
+    slot = (slot + 1) & map->mask;
+  }
+  return slot;
 }
 
 marley_map *marley_map_alloc(int size) {
@@ -31,17 +97,40 @@ marley_map *marley_map_alloc(int size) {
     return NULL;
   }
   marley_map *map = malloc(sizeof(marley_map));
+  if (!map) {
+    return NULL;
+  }
+  const uint32_t slots = slot_count(size);
   map->data = malloc(sizeof(key_value_pair) * size);
+  map->hashes = malloc(sizeof(uint32_t) * size);
+  map->slots = calloc(slots, sizeof(uint32_t));
+  map->mask = slots - 1;
   map->reserved_size = size;
   map->size = 0;
+  map->keys = NULL;
+  if (!map->data || !map->hashes || !map->slots) {
+    marley_map_free(map);
+    return NULL;
+  }
   return map;
 }
 
 void marley_map_free(marley_map *map) {
+  while (map->keys) {
+    marley_arena_block *next = map->keys->next;
+    free(map->keys);
+    map->keys = next;
+  }
   free(map->data);
+  free(map->hashes);
+  free(map->slots);
   free(map);
 }
 
+/**
+ * Make room for new_reserved_size entries. Entries are moved at most once,
+ * and the slots are rebuilt from the cached hashes without hashing any key.
+ */
 int marley_map_resize(marley_map *map, int new_reserved_size) {
   if (new_reserved_size < map->size) {
     return MARLEY_MAP_RESIZE_FAILED;
@@ -49,69 +138,77 @@ int marley_map_resize(marley_map *map, int new_reserved_size) {
     return MARLEY_MAP_RESERVED_SIZE_NOT_POSITIVE;
   }
 
-  const int size = map->size;
-  if (size == 0) {
-    free(map->data);
-    map->data = NULL;
-    map->data = malloc(sizeof(key_value_pair) * new_reserved_size);
-    map->reserved_size = new_reserved_size;
-    // map->size = size;
-    return 0;
+  const uint32_t slots = slot_count(new_reserved_size);
+  key_value_pair *data =
+      realloc(map->data, sizeof(key_value_pair) * new_reserved_size);
+  if (!data) {
+    return MARLEY_MAP_RESIZE_FAILED;
   }
-
-  key_value_pair *replace = malloc(sizeof(key_value_pair) * new_reserved_size);
-  for (int idx = 0; idx < size; ++idx) {
-    replace[idx] = map->data[idx];
+  map->data = data;
+  uint32_t *hashes = realloc(map->hashes, sizeof(uint32_t) * new_reserved_size);
+  if (!hashes) {
+    return MARLEY_MAP_RESIZE_FAILED;
   }
-  free(map->data);
-  map->data = NULL;
-  map->data = malloc(sizeof(key_value_pair) * new_reserved_size);
-
-  for (int idx = 0; idx < size; ++idx) {
-    map->data[idx] = replace[idx];
+  map->hashes = hashes;
+  if (slots != map->mask + 1) {
+    uint32_t *table = calloc(slots, sizeof(uint32_t));
+    if (!table) {
+      return MARLEY_MAP_RESIZE_FAILED;
+    }
+    free(map->slots);
+    map->slots = table;
+    map->mask = slots - 1;
+    for (int entry = 0; entry < map->size; ++entry) {
+      uint32_t slot = map->hashes[entry] & map->mask;
+      while (map->slots[slot] != 0) {
+        slot = (slot + 1) & map->mask;
+      }
+      map->slots[slot] = entry + 1;
+    }
   }
-  map->size = size;
   map->reserved_size = new_reserved_size;
-  free(replace);
   return 0;
 }
 
 /**
- * set the mapping from key to value.
+ * set the mapping from key to value. The key is copied, so it does not have
+ * to outlive the call.
  * If the map's reserved memory is full, it doubles the reserved size before
  * setting the mapping
  */
 int marley_map_set(marley_map *map, char *key, void *value) {
+  const uint32_t hash = hash_key(key);
+  uint32_t slot = find_slot(map, key, hash);
+
+  // if key already exists in the map, update its value
+  if (map->slots[slot] != 0) {
+    map->data[map->slots[slot] - 1].value = value;
+    return 0;
+  }
+
   if (map->size == map->reserved_size) {
     int err = marley_map_resize(map, map->reserved_size * 2);
     if (err) {
       return err;
     }
-  }
-
-  // if key already exists in the map, update its value
-  for (int idx = 0; idx < map->size; ++idx) {
-    key_value_pair *kv = &map->data[idx];
-    if (strcmp(kv->key, key) == 0) {
-      kv->value = value;
-      return 0;
-    }
+    slot = find_slot(map, key, hash);
   }
 
   // key doesn't exist, so set it.
+  char *copy = intern_key(map, key);
+  if (!copy) {
+    return MARLEY_MAP_ERROR;
+  }
   const int insert_idx = map->size;
-  key_value_pair insert_value = {.key = key, .value = value};
+  key_value_pair insert_value = {.key = copy, .value = value};
   map->data[insert_idx] = insert_value;
+  map->hashes[insert_idx] = hash;
+  map->slots[slot] = insert_idx + 1;
   ++map->size;
   return 0;
 }
 
 void *marley_map_lookup(marley_map *map, char *key) {
-  for (int idx = 0; idx < map->size; ++idx) {
-    const key_value_pair *kv = &map->data[idx];
-    if (strcmp(kv->key, key) == 0) {
-      return kv->value;
-    }
-  }
-  return NULL;
+  const uint32_t slot = find_slot(map, key, hash_key(key));
+  return map->slots[slot] ? map->data[map->slots[slot] - 1].value : NULL;
 }
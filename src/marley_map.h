@@ -6,6 +6,8 @@
 #define MARLEY_MAP_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**
  * Return messages for marley_map
@@ -16,6 +18,11 @@ enum {
   MARLEY_MAP_RESERVED_SIZE_NOT_POSITIVE
 };
 
+/* Smallest block of key copies the map allocates */
+#define MARLEY_ARENA_BLOCK 4096
+/* Fewest slots in the hash table */
+#define MARLEY_MAP_MIN_SLOTS 8
+
 typedef struct {
   char *key;
   void *value;
@@ -24,10 +31,32 @@ typedef struct {
 key_value_pair *key_value_pair_constr(char *key, void *data);
 void key_value_pair_free(key_value_pair *kv);
 
+/**
+ * Block of an arena. Blocks are chained so they can all be freed at once.
+ */
+typedef struct marley_arena_block {
+  struct marley_arena_block *next;
+  size_t used;
+  size_t size;
+  char data[];
+} marley_arena_block;
+
+/**
+ * Open addressing hash table. Entries are kept in data in the order they
+ * were first set, with the hash of each key cached next to them. Each slot
+ * holds the index of an entry plus 1, or 0 if it is empty, and collisions
+ * probe the next slot. There are at least twice as many slots as
+ * reserved_size, so probes stay short. Keys are copied into an arena owned
+ * by the map, and values are only pointed to.
+ */
 typedef struct {
   key_value_pair *data;
-  int reserved_size;
+  uint32_t *hashes;         /* Hash of the key of each entry */
+  uint32_t *slots;
+  uint32_t mask;            /* Number of slots - 1 */
+  int reserved_size;        /* Entries that fit before the map grows */
   int size;
+  marley_arena_block *keys; /* Newest block of key copies */
 } marley_map;
 
 marley_map *marley_map_alloc(int size);
@@ -1,5 +1,7 @@
 #include <limits.h>
 #include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -7,67 +9,76 @@
 
 static inline scalar_t clipped_vel(scalar_t, scalar_t, scalar_t)
     __attribute__((const));
-static inline scalar_t clip_delta(scalar_t, signed char) __attribute__((const));
+static inline scalar_t clip_delta(scalar_t, delta_t) __attribute__((const));
 static inline scalar_t limit_delta(scalar_t) __attribute((const));
+static inline void apply_sens(delta_t *, delta_t *, const scalar_t,
+                              const accel_settings_t *, accel_state_t *);
+static inline delta_t carry_delta(const scalar_t, scalar_t *);
 
-#if defined(PRECOMP) && PRECOMP + 0
-static scalar_t precomp_accel_sens[UCHAR_MAX][UCHAR_MAX];
-static scalar_t lookup(const int dx, const int dy) {
-  // shift dx and dy over by SCHAR_MIN.
-  const int dx_idx = dx + -SCHAR_MIN;
-  const int dy_idx = dy + -SCHAR_MIN;
-  return precomp_accel_sens[dx_idx][dy_idx];
+/**
+ * Apply mouse acceleration to dx and dy with user specified settings.
+ * Because values get trimmed when converted to delta_t, the carry in state
+ * holds the values cut off so they can be added to the next call. This allows
+ * for greater precision. Each mouse has its own state, so settings can be
+ * shared between mice.
+ * dx and dy are updated in-place.
+ */
+void accelerate(delta_t *dx, delta_t *dy, accel_settings_t *as,
+                accel_state_t *state) {
+  const scalar_t pre_dx = *dx * as->pre_scalar_x;
+  const scalar_t pre_dy = *dy * as->pre_scalar_y;
+  // apply acceleration
+  const scalar_t accelerated_sens = as->lut
+                                        ? accel_lut_sens(as->lut, pre_dx, pre_dy)
+                                        : as->accel(pre_dx, pre_dy, as);
+  apply_sens(dx, dy, accelerated_sens, as, state);
 }
 
 /**
- * Precompute accel sens for all possible combinations of dx and dy.
- * There are only 256^2 possible combinations, so this is feasible.
+ * Accelerate n (dx, dy) pairs at once. The sensitivities are computed with
+ * the widest SIMD kernel the CPU supports, then the carry chain is applied
+ * in order, so the output matches n calls to accelerate().
  */
-void precomp(accel_settings_t *as) {
-  printf("Performing precomp");
-  for (int dx = SCHAR_MIN; dx < SCHAR_MAX; ++dx) {
-    for (int dy = SCHAR_MIN; dy < SCHAR_MAX; ++dy) {
-      const int dx_idx = dx + -SCHAR_MIN;
-      const int dy_idx = dy + -SCHAR_MIN;
-      precomp_accel_sens[dx_idx][dy_idx] = as->accel(dx, dy, as);
+void accelerate_batch(delta_t *dx, delta_t *dy, size_t n,
+                      accel_settings_t *as, accel_state_t *state) {
+  scalar_t sens[ACCEL_BATCH_CHUNK];
+  for (size_t start = 0; start < n; start += ACCEL_BATCH_CHUNK) {
+    const size_t len =
+        n - start < ACCEL_BATCH_CHUNK ? n - start : ACCEL_BATCH_CHUNK;
+    accel_sens_batch(dx + start, dy + start, sens, len, as);
+    for (size_t idx = 0; idx < len; ++idx) {
+      apply_sens(&dx[start + idx], &dy[start + idx], sens[idx], as, state);
     }
   }
 }
-#endif
 
 /**
- * Apply mouse acceleration to dx and dy with user specified settings.
- * Because values get trimmed when converted to char, we use carry_d* so
- * values cut off can be added to the next call. This allows for greater
- * precision
- * dx and dy are updated in-place.
+ * Scale dx and dy by an already computed accel sens, then apply the post
+ * scalars and the carry from the previous call.
  */
-void accelerate(delta_t *dx, delta_t *dy, accel_settings_t *as) {
-  const scalar_t pre_dx = *dx * as->pre_scalar_x;
-  const scalar_t pre_dy = *dx * as->pre_scalar_y;
-  // apply acceleration
-#if defined(PRECOMP) && PRECOMP + 0
-  const scalar_t accelerated_sens = lookup(pre_dx, pre_dy);
-#else
-  const scalar_t accelerated_sens = as->accel(pre_dx, pre_dy, as);
-#endif
+static inline void apply_sens(delta_t *dx, delta_t *dy,
+                              const scalar_t accelerated_sens,
+                              const accel_settings_t *as,
+                              accel_state_t *state) {
   const scalar_t fdx = *dx * accelerated_sens;
   const scalar_t fdy = *dy * accelerated_sens;
   // Apply post scalars.
   const scalar_t post_dx = fdx * as->post_scalar_x;
   const scalar_t post_dy = fdy * as->post_scalar_y;
-  // Add carry from previous iteration
-  const scalar_t accum_dx = limit_delta(post_dx + as->carry_dx);
-  const scalar_t accum_dy = limit_delta(post_dy + as->carry_dy);
+  *dx = carry_delta(post_dx, &state->carry_dx);
+  *dy = carry_delta(post_dy, &state->carry_dy);
+}
+
+/**
+ * Add the carry from the previous iteration to delta and truncate it.
+ * The part that was cut off is stored back in carry for the next iteration.
+ */
+static inline delta_t carry_delta(const scalar_t delta, scalar_t *carry) {
+  const scalar_t accum = limit_delta(delta + *carry);
   // truncate before conversion to delta_t prevents small jiggles
-  const delta_t trim_dx = (delta_t)truncf(accum_dx);
-  const delta_t trim_dy = (delta_t)truncf(accum_dy);
-  // Update deltas with their trimmed values
-  *dx = trim_dx;
-  *dy = trim_dy;
-  // update carry values so that they can be used next iteration
-  as->carry_dx = accum_dx - trim_dx;
-  as->carry_dy = accum_dy - trim_dy;
+  const delta_t trim = (delta_t)trunc(accum);
+  *carry = accum - trim;
+  return trim;
 }
 
 /**
@@ -94,6 +105,637 @@ scalar_t pow_accel(const scalar_t dx, const scalar_t dy, accel_settings_t *as) {
   return pow((as->accel_rate * change), as->power - 1);
 }
 
+/**
+ * Velocity at which quake_accel reaches upper_bound, or the last point of a
+ * point curve. Past it the curve is flat, so the lookup table does not need
+ * to go any further.
+ * Returns 0 if the curve never saturates.
+ */
+static scalar_t saturation_vel(const accel_settings_t *as) {
+  if (as->accel == curve_accel && as->curve_points > 0) {
+    return as->curve_vel[as->curve_points - 1];
+  }
+  if (as->accel != quake_accel || as->power <= 1 || as->accel_rate <= 0) {
+    return 0;
+  }
+  const scalar_t headroom = fmax(as->upper_bound - as->base, 0.0);
+  const scalar_t change = pow(headroom, 1 / (as->power - 1)) / as->accel_rate;
+  return as->offset + change;
+}
+
+/**
+ * Velocity from which sens is clamped to upper_bound, or 0 if it never is.
+ * Only quake_accel has an upper bound.
+ */
+scalar_t accel_bound_vel(const accel_settings_t *as) {
+  return as->accel == quake_accel ? saturation_vel(as) : 0;
+}
+
+/**
+ * Last velocity covered by a table built from the settings. lut_max_vel is
+ * used if set, otherwise the table ends where the curve flattens out.
+ */
+scalar_t accel_table_max_vel(const accel_settings_t *as) {
+  scalar_t max_vel = as->lut_max_vel;
+  if (max_vel <= 0) {
+    max_vel = saturation_vel(as);
+  }
+  if (max_vel <= 0 || !isfinite(max_vel)) {
+    max_vel = LUT_DEFAULT_MAX_VEL;
+  }
+  return max_vel;
+}
+
+/**
+ * Limit applied to each delta before a table lookup. quake_accel clips the
+ * deltas before taking the velocity, so tables must do the same.
+ */
+delta_t accel_table_clip(const accel_settings_t *as) {
+  const delta_t lim = as->overflow_lim;
+  return as->accel == quake_accel && lim > 0 ? lim : 0;
+}
+
+/**
+ * Sens of the accel curve at a velocity, ignoring the clip on each delta.
+ * The curve must only depend on the deltas through their velocity, which
+ * holds for quake and pow.
+ */
+scalar_t accel_curve_sens(const accel_settings_t *as, scalar_t vel) {
+  accel_settings_t sample = *as;
+  sample.overflow_lim = 0;
+  return sample.accel(vel, 0, &sample);
+}
+
+/**
+ * Sample the accel curve at lut_size evenly spaced velocities. Any table
+ * built from earlier settings is freed first. Curves that still rise past
+ * the table, like pow_accel, keep a copy of the settings to evaluate faster
+ * movement with.
+ * Returns 0 on success, -1 if the table could not be allocated.
+ */
+int accel_lut_build(accel_settings_t *as) {
+  accel_lut_free(as);
+  if (as->lut_size <= 1) {
+    return 0;
+  }
+
+  accel_lut_t *lut = malloc(sizeof(accel_lut_t));
+  if (!lut) {
+    return -1;
+  }
+  const size_t entry_size = as->lut_single ? sizeof(float) : sizeof(double);
+  // one extra entry so that interpolation at the last index stays in bounds.
+  void *entries = malloc(entry_size * (as->lut_size + 1));
+  if (!entries) {
+    free(lut);
+    return -1;
+  }
+  lut->size = as->lut_size;
+  lut->single = as->lut_single;
+  lut->max_pos = as->lut_size - 1;
+  lut->inv_step = lut->max_pos / accel_table_max_vel(as);
+  lut->clip = accel_table_clip(as);
+  lut->tail = NULL;
+  const scalar_t saturation = saturation_vel(as);
+  if (saturation <= 0 || accel_table_max_vel(as) < saturation) {
+    lut->tail = malloc(sizeof(accel_settings_t));
+    if (!lut->tail) {
+      free(entries);
+      free(lut);
+      return -1;
+    }
+    *lut->tail = *as;
+    lut->tail->lut = NULL;
+  }
+  if (lut->single) {
+    lut->sens.f = entries;
+  } else {
+    lut->sens.d = entries;
+  }
+
+  for (int idx = 0; idx <= lut->size; ++idx) {
+    const int clamped = idx < lut->size ? idx : lut->size - 1;
+    const scalar_t sens = accel_curve_sens(as, clamped / lut->inv_step);
+    if (lut->single) {
+      lut->sens.f[idx] = sens;
+    } else {
+      lut->sens.d[idx] = sens;
+    }
+  }
+  as->lut = lut;
+  return 0;
+}
+
+void accel_lut_free(accel_settings_t *as) {
+  if (!as->lut) {
+    return;
+  }
+  if (as->lut->single) {
+    free(as->lut->sens.f);
+  } else {
+    free(as->lut->sens.d);
+  }
+  free(as->lut->tail);
+  free(as->lut);
+  as->lut = NULL;
+}
+
+/**
+ * Look up the accel sens for pre-scaled deltas, linearly interpolating
+ * between neighbouring entries. Velocities past the end of the table use the
+ * last entry if the curve is flat there, otherwise the curve itself.
+ */
+scalar_t accel_lut_sens(const accel_lut_t *lut, scalar_t dx, scalar_t dy) {
+  const scalar_t clip_dx = clip_delta(dx, lut->clip);
+  const scalar_t clip_dy = clip_delta(dy, lut->clip);
+  const scalar_t vel = sqrt(clip_dx * clip_dx + clip_dy * clip_dy);
+  if (lut->tail && vel * lut->inv_step >= lut->max_pos) {
+    return lut->tail->accel(dx, dy, lut->tail);
+  }
+  const scalar_t pos = fmin(vel * lut->inv_step, lut->max_pos);
+  const int idx = (int)pos;
+  const scalar_t frac = pos - idx;
+  if (lut->single) {
+    const scalar_t low = lut->sens.f[idx];
+    return low + (lut->sens.f[idx + 1] - low) * frac;
+  }
+  const scalar_t low = lut->sens.d[idx];
+  return low + (lut->sens.d[idx + 1] - low) * frac;
+}
+
+/* Largest power - 1 that the whole power kernels expand into multiplies */
+#define PLAN_MAX_INT_EXPONENT 4
+/* Longest velocity window a plan takes */
+#define PLAN_MAX_WINDOW_US 1000000
+
+static inline scalar_t ipow(scalar_t x, int n) {
+  scalar_t result = 1;
+  for (; n > 0; --n) {
+    result *= x;
+  }
+  return result;
+}
+
+static inline scalar_t plan_change(scalar_t dx, scalar_t dy,
+                                   const accel_plan_t *plan) {
+  const scalar_t clip_dx = clip_delta(dx, plan->clip);
+  const scalar_t clip_dy = clip_delta(dy, plan->clip);
+  return clipped_vel(clip_dx, clip_dy, plan->offset);
+}
+
+static scalar_t sens_quake_linear(scalar_t dx, scalar_t dy,
+                                  const accel_plan_t *plan) {
+  const scalar_t term = plan->accel_rate * plan_change(dx, dy, plan);
+  return fmin(plan->base + term * plan->inv_game_sens, plan->upper_bound);
+}
+
+static scalar_t sens_quake_int(scalar_t dx, scalar_t dy,
+                               const accel_plan_t *plan) {
+  const scalar_t term =
+      ipow(plan->accel_rate * plan_change(dx, dy, plan), plan->int_exponent);
+  return fmin(plan->base + term * plan->inv_game_sens, plan->upper_bound);
+}
+
+static scalar_t sens_quake(scalar_t dx, scalar_t dy,
+                           const accel_plan_t *plan) {
+  const scalar_t term =
+      pow(plan->accel_rate * plan_change(dx, dy, plan), plan->exponent);
+  return fmin(plan->base + term * plan->inv_game_sens, plan->upper_bound);
+}
+
+static scalar_t sens_pow_int(scalar_t dx, scalar_t dy,
+                             const accel_plan_t *plan) {
+  const scalar_t change = clipped_vel(dx, dy, plan->offset);
+  return ipow(plan->accel_rate * change, plan->int_exponent);
+}
+
+static scalar_t sens_pow(scalar_t dx, scalar_t dy, const accel_plan_t *plan) {
+  const scalar_t change = clipped_vel(dx, dy, plan->offset);
+  return pow(plan->accel_rate * change, plan->exponent);
+}
+
+static scalar_t sens_curve(scalar_t dx, scalar_t dy,
+                           const accel_plan_t *plan) {
+  return accel_lut_sens(plan->curve, dx, dy) * plan->inv_game_sens;
+}
+
+static scalar_t sens_lut(scalar_t dx, scalar_t dy, const accel_plan_t *plan) {
+  return accel_lut_sens(plan->lut, dx, dy);
+}
+
+static scalar_t sens_custom(scalar_t dx, scalar_t dy,
+                            const accel_plan_t *plan) {
+  return plan->custom->accel(dx, dy, plan->custom);
+}
+
+static scalar_t sens_flat(scalar_t dx, scalar_t dy, const accel_plan_t *plan) {
+  (void)dx;
+  (void)dy;
+  return plan->flat_sens;
+}
+
+static scalar_t sens_fixed(scalar_t dx, scalar_t dy,
+                           const accel_plan_t *plan) {
+  const fixed_t sens = accel_fixed_sens(plan->fixed, llround(dx * FIXED_ONE),
+                                        llround(dy * FIXED_ONE));
+  return (scalar_t)sens / FIXED_ONE;
+}
+
+static void run_passthrough(const accel_plan_t *plan, accel_state_t *state,
+                            delta_t *dx, delta_t *dy) {
+  // deltas already fit in an input_event, there is nothing to scale or carry.
+  (void)plan;
+  (void)state;
+  (void)dx;
+  (void)dy;
+}
+
+static void run_constant(const accel_plan_t *plan, accel_state_t *state,
+                         delta_t *dx, delta_t *dy) {
+  *dx = carry_delta(*dx * plan->gain_x, &state->carry_dx);
+  *dy = carry_delta(*dy * plan->gain_y, &state->carry_dy);
+}
+
+static void run_curve(const accel_plan_t *plan, accel_state_t *state,
+                      delta_t *dx, delta_t *dy) {
+  state->vel_dx = *dx * plan->pre_scalar_x;
+  state->vel_dy = *dy * plan->pre_scalar_y;
+  const scalar_t sens = plan->sens(state->vel_dx, state->vel_dy, plan);
+  state->sens = sens;
+  *dx = carry_delta(*dx * sens * plan->post_scalar_x, &state->carry_dx);
+  *dy = carry_delta(*dy * sens * plan->post_scalar_y, &state->carry_dy);
+}
+
+/**
+ * Add a report to the velocity window and drop the reports older than
+ * window_us, or the oldest one if the ring is full. Gaps between reports
+ * update the polling interval, unless they are long enough that the mouse
+ * was resting or the reports came in the same transfer.
+ * Returns the time the window covers in us, counting one polling interval
+ * for the oldest report.
+ */
+uint32_t accel_window_push(accel_window_t *window, uint32_t window_us,
+                           uint64_t now_us, delta_t dx, delta_t dy) {
+  const uint64_t gap = now_us - window->last_us;
+  if (window->last_us && gap > 0 && gap <= ACCEL_IDLE_GAP_US) {
+    if (window->interval_avg) {
+      window->interval_avg -= window->interval_avg >> ACCEL_INTERVAL_SHIFT;
+      window->interval_avg += (uint32_t)gap;
+    } else {
+      window->interval_avg = (uint32_t)gap << ACCEL_INTERVAL_SHIFT;
+    }
+  }
+  window->last_us = now_us;
+
+  while (window->len > 0 &&
+         (window->len == ACCEL_WINDOW_SIZE ||
+          now_us - window->time_us[window->head] >= window_us)) {
+    window->sum_dx -= window->dx[window->head];
+    window->sum_dy -= window->dy[window->head];
+    window->head = (window->head + 1) & (ACCEL_WINDOW_SIZE - 1);
+    window->len--;
+  }
+  const uint32_t tail = (window->head + window->len) & (ACCEL_WINDOW_SIZE - 1);
+  window->time_us[tail] = now_us;
+  window->dx[tail] = dx;
+  window->dy[tail] = dy;
+  window->sum_dx += dx;
+  window->sum_dy += dy;
+  window->len++;
+  return now_us - window->time_us[window->head] +
+         accel_window_interval(window);
+}
+
+/**
+ * Polling interval detected from the gaps between reports, or
+ * ACCEL_REF_INTERVAL_US until there has been a gap.
+ */
+uint32_t accel_window_interval(const accel_window_t *window) {
+  if (!window->interval_avg) {
+    return ACCEL_REF_INTERVAL_US;
+  }
+  const uint32_t half = 1u << (ACCEL_INTERVAL_SHIFT - 1);
+  return (window->interval_avg + half) >> ACCEL_INTERVAL_SHIFT;
+}
+
+/**
+ * Like run_curve, but the sens is looked up from the velocity over the
+ * window instead of the deltas of this report. The velocity is in counts per
+ * ACCEL_REF_INTERVAL_US, so a curve gives the same sens at any polling rate.
+ */
+static void run_timed(const accel_plan_t *plan, accel_state_t *state,
+                      delta_t *dx, delta_t *dy) {
+  accel_window_t *window = &state->window;
+  const uint32_t span_us =
+      accel_window_push(window, plan->window_us, state->time_us, *dx, *dy);
+  const scalar_t scale = (scalar_t)ACCEL_REF_INTERVAL_US / span_us;
+  state->vel_dx = window->sum_dx * scale * plan->pre_scalar_x;
+  state->vel_dy = window->sum_dy * scale * plan->pre_scalar_y;
+  const scalar_t sens = plan->sens(state->vel_dx, state->vel_dy, plan);
+  state->sens = sens;
+  *dx = carry_delta(*dx * sens * plan->post_scalar_x, &state->carry_dx);
+  *dy = carry_delta(*dy * sens * plan->post_scalar_y, &state->carry_dy);
+}
+
+/**
+ * Find the sens of curves that do not depend on velocity.
+ * Returns true and sets sens if the curve is flat.
+ */
+static bool constant_sens(accel_settings_t *as, scalar_t *sens) {
+  bool flat = false;
+  if (as->accel == quake_accel) {
+    // the accel term is never negative, so base >= upper_bound is flat too.
+    flat = as->accel_rate == 0 || as->power == 1 ||
+           (as->accel_rate > 0 && as->upper_bound <= as->base);
+  } else if (as->accel == pow_accel) {
+    flat = as->accel_rate == 0 || as->power == 1;
+  }
+  if (flat) {
+    *sens = as->accel(0, 0, as);
+  }
+  return flat;
+}
+
+/**
+ * Compile the settings into the cheapest plan that gives the same sens.
+ * Must be called again whenever the settings or lookup table change.
+ */
+void accel_plan_compile(accel_settings_t *as) {
+  const scalar_t exponent = as->power - 1;
+  const bool whole = exponent >= 0 && exponent <= PLAN_MAX_INT_EXPONENT &&
+                     exponent == floor(exponent);
+  accel_plan_t plan = {.run = run_curve,
+                       .sens = NULL,
+                       .clip = accel_table_clip(as),
+                       .int_exponent = whole ? (int)exponent : -1,
+                       .exponent = exponent,
+                       .offset = as->offset,
+                       .accel_rate = as->accel_rate,
+                       .base = as->base / as->game_sens,
+                       .upper_bound = as->upper_bound / as->game_sens,
+                       .inv_game_sens = 1 / as->game_sens,
+                       .pre_scalar_x = as->pre_scalar_x,
+                       .pre_scalar_y = as->pre_scalar_y,
+                       .post_scalar_x = as->post_scalar_x,
+                       .post_scalar_y = as->post_scalar_y,
+                       .gain_x = 0,
+                       .gain_y = 0,
+                       .bound_vel = accel_bound_vel(as),
+                       .window_us = 0,
+                       .flat_sens = 0,
+                       .lut = as->lut,
+                       .curve = as->curve,
+                       .fixed = as->fixed,
+                       .custom = as};
+
+  scalar_t sens;
+  if (as->fixed) {
+    // fixed point was asked for explicitly, so it wins over cheaper kernels.
+    plan.kernel = ACCEL_KERNEL_FIXED;
+    plan.run = accel_fixed_run;
+    plan.sens = sens_fixed;
+  } else if (constant_sens(as, &sens)) {
+    plan.sens = sens_flat;
+    plan.flat_sens = sens;
+    plan.gain_x = sens * as->post_scalar_x;
+    plan.gain_y = sens * as->post_scalar_y;
+    if (plan.gain_x == 1 && plan.gain_y == 1) {
+      plan.kernel = ACCEL_KERNEL_PASSTHROUGH;
+      plan.run = run_passthrough;
+    } else {
+      plan.kernel = ACCEL_KERNEL_CONSTANT;
+      plan.run = run_constant;
+    }
+  } else if (as->lut) {
+    plan.kernel = ACCEL_KERNEL_LUT;
+    plan.sens = sens_lut;
+  } else if (as->accel == quake_accel && plan.int_exponent == 1) {
+    plan.kernel = ACCEL_KERNEL_QUAKE_LINEAR;
+    plan.sens = sens_quake_linear;
+  } else if (as->accel == quake_accel && whole) {
+    plan.kernel = ACCEL_KERNEL_QUAKE_INT;
+    plan.sens = sens_quake_int;
+  } else if (as->accel == quake_accel) {
+    plan.kernel = ACCEL_KERNEL_QUAKE;
+    plan.sens = sens_quake;
+  } else if (as->accel == pow_accel && whole) {
+    plan.kernel = ACCEL_KERNEL_POW_INT;
+    plan.sens = sens_pow_int;
+  } else if (as->accel == pow_accel) {
+    plan.kernel = ACCEL_KERNEL_POW;
+    plan.sens = sens_pow;
+  } else if (as->accel == curve_accel) {
+    plan.kernel = ACCEL_KERNEL_CURVE;
+    plan.sens = sens_curve;
+  } else {
+    plan.kernel = ACCEL_KERNEL_CUSTOM;
+    plan.sens = sens_custom;
+  }
+
+  // constant kernels don't read the velocity, so they ignore the window.
+  if (as->vel_window > 0 && plan.kernel != ACCEL_KERNEL_PASSTHROUGH &&
+      plan.kernel != ACCEL_KERNEL_CONSTANT) {
+    plan.window_us = (uint32_t)fmin(ceil(as->vel_window * 1000),
+                                    PLAN_MAX_WINDOW_US);
+    plan.run = plan.kernel == ACCEL_KERNEL_FIXED ? accel_fixed_run_timed
+                                                 : run_timed;
+  }
+  as->plan = plan;
+}
+
+/**
+ * Limits of the accel curve that a pre-scaled velocity ran into.
+ */
+static unsigned vel_limits(const accel_plan_t *plan, scalar_t pre_dx,
+                           scalar_t pre_dy) {
+  const scalar_t clip_dx = clip_delta(pre_dx, plan->clip);
+  const scalar_t clip_dy = clip_delta(pre_dy, plan->clip);
+  unsigned limits = 0;
+  if (clip_dx != pre_dx || clip_dy != pre_dy) {
+    limits |= ACCEL_LIMIT_CLIP;
+  }
+  const scalar_t bound = plan->bound_vel;
+  if (bound > 0 && clip_dx * clip_dx + clip_dy * clip_dy >= bound * bound) {
+    limits |= ACCEL_LIMIT_BOUND;
+  }
+  return limits;
+}
+
+/**
+ * Limits of the accel curve that one report ran into, as a mask of
+ * ACCEL_LIMIT_CLIP and ACCEL_LIMIT_BOUND. state must be the one the plan
+ * just ran the report with, since timed plans look up the velocity of their
+ * window, which is left in state. Only used for telemetry, so the kernels
+ * don't have to count anything. Fixed point plans are checked with integer
+ * math, like the rest of their pipeline.
+ */
+unsigned accel_plan_limits(const accel_plan_t *plan,
+                           const accel_state_t *state, delta_t dx,
+                           delta_t dy) {
+  const bool timed = plan->window_us > 0;
+  if (plan->kernel == ACCEL_KERNEL_FIXED) {
+    const accel_fixed_t *fixed = plan->fixed;
+    return timed ? accel_fixed_limits(fixed, state->fixed_vel_dx,
+                                      state->fixed_vel_dy)
+                 : accel_fixed_limits(fixed, (int64_t)dx * fixed->pre_scalar_x,
+                                      (int64_t)dy * fixed->pre_scalar_y);
+  }
+  return timed ? vel_limits(plan, state->vel_dx, state->vel_dy)
+               : vel_limits(plan, dx * plan->pre_scalar_x,
+                            dy * plan->pre_scalar_y);
+}
+
+const char *accel_plan_name(const accel_plan_t *plan) {
+  static const char *const names[] = {
+      [ACCEL_KERNEL_PASSTHROUGH] = "passthrough",
+      [ACCEL_KERNEL_CONSTANT] = "constant",
+      [ACCEL_KERNEL_QUAKE_LINEAR] = "quake_linear",
+      [ACCEL_KERNEL_QUAKE_INT] = "quake_int",
+      [ACCEL_KERNEL_QUAKE] = "quake",
+      [ACCEL_KERNEL_POW_INT] = "pow_int",
+      [ACCEL_KERNEL_POW] = "pow",
+      [ACCEL_KERNEL_CURVE] = "curve",
+      [ACCEL_KERNEL_LUT] = "lut",
+      [ACCEL_KERNEL_FIXED] = "fixed",
+      [ACCEL_KERNEL_CUSTOM] = "custom"};
+  return names[plan->kernel];
+}
+
+/**
+ * Accel curve given as (velocity, sens) points in the config. The points are
+ * resampled onto evenly spaced knots when the config is loaded, so this is a
+ * single interpolated lookup.
+ */
+scalar_t curve_accel(const scalar_t dx, const scalar_t dy,
+                     accel_settings_t *as) {
+  return accel_lut_sens(as->curve, dx, dy) / as->game_sens;
+}
+
+/**
+ * Monotone cubic (Fritsch-Carlson) tangents for the curve points, so the
+ * spline never overshoots between points.
+ */
+static void spline_tangents(const scalar_t *vel, const scalar_t *sens, int n,
+                            scalar_t *tangents) {
+  scalar_t secants[CURVE_MAX_POINTS];
+  for (int idx = 0; idx < n - 1; ++idx) {
+    secants[idx] = (sens[idx + 1] - sens[idx]) / (vel[idx + 1] - vel[idx]);
+  }
+  tangents[0] = secants[0];
+  tangents[n - 1] = secants[n - 2];
+  for (int idx = 1; idx < n - 1; ++idx) {
+    const bool turns = secants[idx - 1] * secants[idx] <= 0;
+    tangents[idx] = turns ? 0 : (secants[idx - 1] + secants[idx]) / 2;
+  }
+  for (int idx = 0; idx < n - 1; ++idx) {
+    if (secants[idx] == 0) {
+      tangents[idx] = 0;
+      tangents[idx + 1] = 0;
+      continue;
+    }
+    const scalar_t a = tangents[idx] / secants[idx];
+    const scalar_t b = tangents[idx + 1] / secants[idx];
+    const scalar_t norm = a * a + b * b;
+    if (norm > 9) {
+      const scalar_t scale = 3 / sqrt(norm);
+      tangents[idx] = scale * a * secants[idx];
+      tangents[idx + 1] = scale * b * secants[idx];
+    }
+  }
+}
+
+/**
+ * Sens between the curve points at a velocity. Velocities outside the
+ * points use the nearest point.
+ */
+static scalar_t curve_point_sens(const accel_settings_t *as,
+                                 const scalar_t *tangents, scalar_t vel) {
+  const scalar_t *xs = as->curve_vel;
+  const scalar_t *ys = as->curve_sens;
+  const int n = as->curve_points;
+  if (n == 1 || vel <= xs[0]) {
+    return ys[0];
+  } else if (vel >= xs[n - 1]) {
+    return ys[n - 1];
+  }
+  int idx = 0;
+  while (vel > xs[idx + 1]) {
+    ++idx;
+  }
+  const scalar_t width = xs[idx + 1] - xs[idx];
+  const scalar_t t = (vel - xs[idx]) / width;
+  if (!tangents) {
+    return ys[idx] + (ys[idx + 1] - ys[idx]) * t;
+  }
+  const scalar_t t2 = t * t;
+  const scalar_t t3 = t2 * t;
+  return (2 * t3 - 3 * t2 + 1) * ys[idx] +
+         (t3 - 2 * t2 + t) * width * tangents[idx] +
+         (-2 * t3 + 3 * t2) * ys[idx + 1] +
+         (t3 - t2) * width * tangents[idx + 1];
+}
+
+/**
+ * Resample the curve points onto curve_knots evenly spaced knots between
+ * velocity 0 and the last point. Any curve built from earlier settings is
+ * freed first.
+ * Returns 0 on success, -1 if the points are not in increasing velocity order
+ * or the knots could not be allocated.
+ */
+int accel_curve_build(accel_settings_t *as) {
+  accel_curve_free(as);
+  const int n = as->curve_points;
+  if (n <= 0) {
+    return as->accel == curve_accel ? -1 : 0;
+  }
+  for (int idx = 1; idx < n; ++idx) {
+    if (as->curve_vel[idx] <= as->curve_vel[idx - 1]) {
+      return -1;
+    }
+  }
+
+  scalar_t tangents[CURVE_MAX_POINTS];
+  const bool spline = as->curve_spline && n > 2;
+  if (spline) {
+    spline_tangents(as->curve_vel, as->curve_sens, n, tangents);
+  }
+
+  const int knots = as->curve_knots > 1 ? as->curve_knots : CURVE_DEFAULT_KNOTS;
+  accel_lut_t *curve = malloc(sizeof(accel_lut_t));
+  if (!curve) {
+    return -1;
+  }
+  curve->sens.d = malloc(sizeof(double) * (knots + 1));
+  if (!curve->sens.d) {
+    free(curve);
+    return -1;
+  }
+  const scalar_t max_vel = as->curve_vel[n - 1] > 0 ? as->curve_vel[n - 1] : 1;
+  curve->size = knots;
+  curve->single = false;
+  curve->clip = 0;
+  // the curve is flat past its last point.
+  curve->tail = NULL;
+  curve->max_pos = knots - 1;
+  curve->inv_step = curve->max_pos / max_vel;
+  for (int idx = 0; idx <= knots; ++idx) {
+    const int clamped = idx < knots ? idx : knots - 1;
+    curve->sens.d[idx] = curve_point_sens(as, spline ? tangents : NULL,
+                                          clamped / curve->inv_step);
+  }
+  as->curve = curve;
+  return 0;
+}
+
+void accel_curve_free(accel_settings_t *as) {
+  if (!as->curve) {
+    return;
+  }
+  free(as->curve->sens.d);
+  free(as->curve);
+  as->curve = NULL;
+}
+
 /**
  * compute offset, clipped velocity given deltas.
  */
@@ -106,7 +748,7 @@ static inline scalar_t clipped_vel(scalar_t dx, scalar_t dy, scalar_t offset) {
  * apply a limit to delta by clipping it.
  * If lim is 0, delta is unchanged
  */
-static inline scalar_t clip_delta(scalar_t delta, signed char lim) {
+static inline scalar_t clip_delta(scalar_t delta, delta_t lim) {
   if (lim > 0) {
     return fmin(delta, lim);
   }
@@ -114,13 +756,13 @@ static inline scalar_t clip_delta(scalar_t delta, signed char lim) {
 }
 
 /**
- * used to prevent overflow when converting to signed char.
+ * used to prevent overflow when converting to delta_t.
  * If delta is negative, this clips delta to the min value.
  * Otherwise, it is clipped to the max value.
  */
 static inline scalar_t limit_delta(scalar_t delta) {
   if (delta < 0) {
-    return fmax(SCHAR_MIN, delta);
+    return fmax(DELTA_MIN, delta);
   }
-  return fmin(SCHAR_MAX, delta);
+  return fmin(DELTA_MAX, delta);
 }
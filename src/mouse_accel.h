@@ -6,6 +6,170 @@
 typedef int32_t delta_t;
 typedef SCALAR scalar_t;
 
+/*
+ * Range of accelerated deltas. uinput relative axes take any int value, so
+ * this is the full range of delta_t.
+ */
+#define DELTA_MIN INT32_MIN
+#define DELTA_MAX INT32_MAX
+
+/* Velocity range of the lookup table when it can't be taken from the curve */
+#define LUT_DEFAULT_MAX_VEL 256
+
+/* Limits for curves defined by (velocity, sens) points in the config */
+#define CURVE_MAX_POINTS 32
+#define CURVE_DEFAULT_KNOTS 64
+
+/**
+ * Accel sens sampled at evenly spaced velocities. The table has size + 1
+ * entries so the entry after the last index can always be read when
+ * interpolating.
+ */
+typedef struct accel_lut {
+  delta_t clip;      /* Limit applied to each delta before velocity, if > 0 */
+  scalar_t inv_step; /* Entries per unit of velocity */
+  scalar_t max_pos;  /* Largest fractional index, size - 1 */
+  int size;          /* Number of sampled velocities */
+  bool single;       /* Entries are stored as float instead of double */
+  union {
+    float *f;
+    double *d;
+  } sens;
+  struct accel_settings *tail; /* Curve past the table, NULL if flat there */
+} accel_lut_t;
+
+/*
+ * Fixed point format used by the fixed point pipeline. Defaults to Q16.16
+ * and can be changed at build time with -DFIXED_FRAC_BITS=n.
+ */
+#ifndef FIXED_FRAC_BITS
+#define FIXED_FRAC_BITS 16
+#endif
+#define FIXED_ONE ((fixed_t)1 << FIXED_FRAC_BITS)
+
+typedef int32_t fixed_t;
+
+/* Table size used by the fixed point pipeline when lut_size is not set */
+#define FIXED_DEFAULT_SIZE 256
+
+/**
+ * Fixed point version of the settings and accel curve. The curve is sampled
+ * the same way as accel_lut_t, with every value converted to fixed_t.
+ */
+typedef struct accel_fixed {
+  fixed_t pre_scalar_x;
+  fixed_t pre_scalar_y;
+  fixed_t post_scalar_x;
+  fixed_t post_scalar_y;
+  fixed_t clip;      /* Limit applied to each pre-scaled delta, if > 0 */
+  fixed_t bound_vel; /* Velocity sens is clamped from, if > 0 */
+  fixed_t inv_step;  /* Entries per unit of velocity */
+  fixed_t max_pos;   /* Largest fractional index, size - 1 */
+  int size;          /* Number of sampled velocities */
+  fixed_t *sens;     /* size + 1 entries */
+} accel_fixed_t;
+
+/* Most reports a velocity window holds, a power of two */
+#define ACCEL_WINDOW_SIZE 64
+/* Report interval that timed velocities are scaled to, so they are in counts
+ * per ms and curves mean the same as with a 1000 Hz mouse */
+#define ACCEL_REF_INTERVAL_US 1000
+/* Longest gap between reports that still counts as one polling interval.
+ * Longer gaps are the mouse resting. */
+#define ACCEL_IDLE_GAP_US 16000
+/* The polling interval is averaged over about 2^ACCEL_INTERVAL_SHIFT gaps */
+#define ACCEL_INTERVAL_SHIFT 3
+
+/**
+ * Deltas of the reports in the last window_us, in a fixed ring so adding a
+ * report never allocates and costs the same at any polling rate. The sums
+ * are kept as reports enter and leave the window.
+ */
+typedef struct accel_window {
+  uint64_t time_us[ACCEL_WINDOW_SIZE];
+  delta_t dx[ACCEL_WINDOW_SIZE];
+  delta_t dy[ACCEL_WINDOW_SIZE];
+  int64_t sum_dx;
+  int64_t sum_dy;
+  uint64_t last_us;      /* Time of the newest report */
+  uint32_t interval_avg; /* Polling interval << ACCEL_INTERVAL_SHIFT */
+  uint32_t head;         /* Index of the oldest report */
+  uint32_t len;
+} accel_window_t;
+
+/**
+ * Carry left over from truncating accelerated deltas, and the velocity
+ * window of timed plans. This is the only state that changes from report to
+ * report. The kernels that look up a sens also leave its velocity and value
+ * here, for the live ring.
+ */
+typedef struct accel_state {
+  scalar_t carry_dx; /* dx that was truncated when converting to delta_t */
+  scalar_t carry_dy; /* dy that was truncated */
+  fixed_t fixed_carry_dx; /* Carry for the fixed point pipeline */
+  fixed_t fixed_carry_dy;
+  scalar_t vel_dx;   /* Velocity of the last sens lookup, after pre scalars */
+  scalar_t vel_dy;
+  scalar_t sens;     /* Last sens looked up */
+  fixed_t fixed_vel_dx; /* Same for the fixed point pipeline */
+  fixed_t fixed_vel_dy;
+  fixed_t fixed_sens;
+  uint64_t time_us;  /* When the report being run was read, for timed plans */
+  accel_window_t window;
+} accel_state_t;
+
+/**
+ * Kernels an accel plan can be compiled to, from cheapest to most general.
+ */
+typedef enum accel_kernel {
+  ACCEL_KERNEL_PASSTHROUGH,  /* Sens and post scalars are all 1 */
+  ACCEL_KERNEL_CONSTANT,     /* Sens does not depend on velocity */
+  ACCEL_KERNEL_QUAKE_LINEAR, /* quake with power 2, accel term is a multiply */
+  ACCEL_KERNEL_QUAKE_INT,    /* quake with a small whole power */
+  ACCEL_KERNEL_QUAKE,        /* quake with any other power */
+  ACCEL_KERNEL_POW_INT,      /* pow with a small whole power */
+  ACCEL_KERNEL_POW,          /* pow with any other power */
+  ACCEL_KERNEL_CURVE,        /* Curve resampled from config points */
+  ACCEL_KERNEL_LUT,          /* Lookup table built by accel_lut_build */
+  ACCEL_KERNEL_FIXED,        /* Fixed point pipeline, no floating point */
+  ACCEL_KERNEL_CUSTOM        /* Any other accel function */
+} accel_kernel_t;
+
+typedef struct accel_plan accel_plan_t;
+
+/**
+ * An accel plan is the settings compiled down to the cheapest kernel that
+ * produces the same sens. Constants are folded in at compile time, so game_sens
+ * is stored as its inverse and base and upper_bound are already divided by it.
+ * Plans are never modified after accel_plan_compile.
+ */
+struct accel_plan {
+  void (*run)(const accel_plan_t *, accel_state_t *, delta_t *, delta_t *);
+  scalar_t (*sens)(scalar_t, scalar_t, const accel_plan_t *);
+  accel_kernel_t kernel;
+  delta_t clip;              /* quake clip on each delta, if > 0 */
+  int int_exponent;          /* power - 1 for the whole power kernels */
+  scalar_t exponent;         /* power - 1 */
+  scalar_t offset;
+  scalar_t accel_rate;
+  scalar_t base;             /* base / game_sens */
+  scalar_t upper_bound;      /* upper_bound / game_sens */
+  scalar_t inv_game_sens;    /* 1 / game_sens */
+  scalar_t pre_scalar_x;
+  scalar_t pre_scalar_y;
+  scalar_t post_scalar_x;
+  scalar_t post_scalar_y;
+  scalar_t gain_x;           /* Constant sens times post_scalar_x */
+  scalar_t gain_y;           /* Constant sens times post_scalar_y */
+  scalar_t bound_vel;        /* Velocity where quake reaches upper_bound */
+  scalar_t flat_sens;        /* Sens of the constant kernels */
+  uint32_t window_us;        /* Velocity window, 0 for per-report deltas */
+  const accel_lut_t *lut;
+  const accel_lut_t *curve;
+  const accel_fixed_t *fixed;
+  struct accel_settings *custom; /* Settings for ACCEL_KERNEL_CUSTOM */
+};
+
 typedef struct accel_settings {
   scalar_t (*accel)(const scalar_t, const scalar_t, struct accel_settings *);
   delta_t overflow_lim;   /* Limit of mouse speed. */
@@ -19,19 +183,101 @@ typedef struct accel_settings {
   scalar_t pre_scalar_y;  /* Scale y */
   scalar_t post_scalar_x; /* Scale x after applying accel */
   scalar_t post_scalar_y; /* Scale y */
-  scalar_t carry_dx;      /* dx that was truncated when conerting to char */
-  scalar_t carry_dy;      /* dy that was truncated */
+  int lut_size;           /* Entries in the velocity table, 0 disables it */
+  scalar_t lut_max_vel;   /* Last velocity in the table, 0 to derive it */
+  bool lut_single;        /* Store the table as float instead of double */
+  accel_lut_t *lut;       /* Built from the settings by load_config */
+  scalar_t curve_vel[CURVE_MAX_POINTS];  /* Velocity of each curve point */
+  scalar_t curve_sens[CURVE_MAX_POINTS]; /* Sens at each curve point */
+  int curve_points;       /* Number of curve points */
+  int curve_knots;        /* Evenly spaced knots the points are resampled to */
+  bool curve_spline;      /* Resample with a monotone cubic spline */
+  accel_lut_t *curve;     /* Built from the points by load_config */
+  bool fixed_point;       /* Run the fixed point pipeline */
+  accel_fixed_t *fixed;   /* Built from the settings by load_config */
+  scalar_t vel_window;    /* Velocity window in ms, 0 uses each report */
+  accel_plan_t plan;      /* Compiled from the settings by load_config */
 } accel_settings_t;
 
 typedef scalar_t (*accel_func)(const scalar_t, const scalar_t,
                                accel_settings_t *);
 
-#if PRECOMP
-void precomp(accel_settings_t *);
-#endif
-
-void accelerate(delta_t *, delta_t *, accel_settings_t *);
+void accelerate(delta_t *, delta_t *, accel_settings_t *, accel_state_t *);
 scalar_t quake_accel(const scalar_t, const scalar_t, accel_settings_t *);
 scalar_t pow_accel(const scalar_t, const scalar_t, accel_settings_t *);
+scalar_t curve_accel(const scalar_t, const scalar_t, accel_settings_t *);
+
+int accel_curve_build(accel_settings_t *);
+void accel_curve_free(accel_settings_t *);
+
+int accel_lut_build(accel_settings_t *);
+void accel_lut_free(accel_settings_t *);
+scalar_t accel_lut_sens(const accel_lut_t *, scalar_t, scalar_t);
+scalar_t accel_table_max_vel(const accel_settings_t *);
+delta_t accel_table_clip(const accel_settings_t *);
+scalar_t accel_bound_vel(const accel_settings_t *);
+scalar_t accel_curve_sens(const accel_settings_t *, scalar_t);
+
+/**
+ * Fixed point pipeline, defined in mouse_accel_fixed.c
+ */
+int accel_fixed_build(accel_settings_t *);
+void accel_fixed_free(accel_settings_t *);
+fixed_t accel_fixed_sens(const accel_fixed_t *, int64_t, int64_t);
+unsigned accel_fixed_limits(const accel_fixed_t *, int64_t, int64_t);
+void accel_fixed_run(const accel_plan_t *, accel_state_t *, delta_t *,
+                     delta_t *);
+void accel_fixed_run_timed(const accel_plan_t *, accel_state_t *, delta_t *,
+                           delta_t *);
+scalar_t accel_fixed_max_error(const accel_settings_t *);
+
+/* Flags returned by accel_plan_limits */
+#define ACCEL_LIMIT_CLIP 1u  /* A delta was clipped to overflow_lim */
+#define ACCEL_LIMIT_BOUND 2u /* Sens was clamped to upper_bound */
+
+uint32_t accel_window_push(accel_window_t *, uint32_t, uint64_t, delta_t,
+                           delta_t);
+uint32_t accel_window_interval(const accel_window_t *);
+
+void accel_plan_compile(accel_settings_t *);
+const char *accel_plan_name(const accel_plan_t *);
+unsigned accel_plan_limits(const accel_plan_t *, const accel_state_t *,
+                           delta_t, delta_t);
+
+/**
+ * Accelerate dx and dy in-place with a compiled plan.
+ */
+static inline void accel_plan_run(const accel_plan_t *plan,
+                                  accel_state_t *state, delta_t *dx,
+                                  delta_t *dy) {
+  plan->run(plan, state, dx, dy);
+}
+
+/**
+ * Sens the plan applies to dx and dy, before the post scalars. Every kernel
+ * has a sens function, so any plan can be evaluated without running it.
+ */
+static inline scalar_t accel_plan_sens(const accel_plan_t *plan, scalar_t dx,
+                                       scalar_t dy) {
+  return plan->sens(dx * plan->pre_scalar_x, dy * plan->pre_scalar_y, plan);
+}
+
+/**
+ * Batched acceleration. Deltas are processed in chunks of ACCEL_BATCH_CHUNK
+ * so the sens buffer stays on the stack.
+ */
+#define ACCEL_BATCH_CHUNK 256
+
+void accelerate_batch(delta_t *, delta_t *, size_t, accel_settings_t *,
+                      accel_state_t *);
+
+/**
+ * SIMD sens kernels, defined in mouse_accel_simd.c. The kernel is picked
+ * from the CPU's features when the program or library is loaded.
+ */
+void accel_sens_batch(const delta_t *, const delta_t *, scalar_t *, size_t,
+                      accel_settings_t *);
+const char *accel_simd_name(void);
 
 #endif
+
@@ -0,0 +1,250 @@
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "mouse_accel.h"
+
+/*
+ * Fixed point acceleration. Floating point is only used when the tables are
+ * built. Each report is handled with integer math:
+ *   - pre-scaled deltas are fixed_t values held in int64_t
+ *   - velocity is an integer square root of the squared deltas
+ *   - sens is interpolated from a table of fixed_t values
+ *   - the carry is kept as the fractional part of a fixed_t
+ * Results are the same on every machine for the same table.
+ */
+
+static fixed_t to_fixed(scalar_t value) {
+  const scalar_t scaled = round(value * FIXED_ONE);
+  if (scaled >= INT32_MAX) {
+    return INT32_MAX;
+  } else if (scaled <= INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (fixed_t)scaled;
+}
+
+static inline int64_t clamp64(int64_t value, int64_t low, int64_t high) {
+  return value < low ? low : value > high ? high : value;
+}
+
+/**
+ * Integer square root, rounded down. Computed one result bit at a time.
+ */
+static inline uint64_t isqrt64(uint64_t value) {
+  uint64_t root = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+  while (bit > value) {
+    bit >>= 2;
+  }
+  while (bit) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return root;
+}
+
+/**
+ * Build the fixed point table and scalars from the settings. Any table built
+ * from earlier settings is freed first. The table uses lut_size entries, or
+ * FIXED_DEFAULT_SIZE if that is not set.
+ * Returns 0 on success, -1 if the table could not be allocated.
+ */
+int accel_fixed_build(accel_settings_t *as) {
+  accel_fixed_free(as);
+  if (!as->fixed_point) {
+    return 0;
+  }
+
+  const int size = as->lut_size > 1 ? as->lut_size : FIXED_DEFAULT_SIZE;
+  accel_fixed_t *fixed = malloc(sizeof(accel_fixed_t));
+  if (!fixed) {
+    return -1;
+  }
+  // one extra entry so that interpolation at the last index stays in bounds.
+  fixed->sens = malloc(sizeof(fixed_t) * (size + 1));
+  if (!fixed->sens) {
+    free(fixed);
+    return -1;
+  }
+  fixed->size = size;
+  fixed->pre_scalar_x = to_fixed(as->pre_scalar_x);
+  fixed->pre_scalar_y = to_fixed(as->pre_scalar_y);
+  fixed->post_scalar_x = to_fixed(as->post_scalar_x);
+  fixed->post_scalar_y = to_fixed(as->post_scalar_y);
+  fixed->clip = to_fixed(accel_table_clip(as));
+  fixed->bound_vel = to_fixed(accel_bound_vel(as));
+  fixed->max_pos = to_fixed(size - 1);
+  fixed->inv_step = to_fixed((size - 1) / accel_table_max_vel(as));
+
+  // sample at the velocities the rounded inv_step actually maps to.
+  const scalar_t inv_step = (scalar_t)fixed->inv_step / FIXED_ONE;
+  for (int idx = 0; idx <= size; ++idx) {
+    const int clamped = idx < size ? idx : size - 1;
+    fixed->sens[idx] = to_fixed(accel_curve_sens(as, clamped / inv_step));
+  }
+  as->fixed = fixed;
+  return 0;
+}
+
+void accel_fixed_free(accel_settings_t *as) {
+  if (!as->fixed) {
+    return;
+  }
+  free(as->fixed->sens);
+  free(as->fixed);
+  as->fixed = NULL;
+}
+
+/**
+ * Look up the sens for pre-scaled fixed point deltas.
+ */
+fixed_t accel_fixed_sens(const accel_fixed_t *fixed, int64_t pre_dx,
+                         int64_t pre_dy) {
+  if (fixed->clip > 0) {
+    pre_dx = pre_dx < fixed->clip ? pre_dx : fixed->clip;
+    pre_dy = pre_dy < fixed->clip ? pre_dy : fixed->clip;
+  }
+  // keep each square below 2^62 so their sum fits in 64 bits.
+  pre_dx = clamp64(pre_dx, -INT32_MAX, INT32_MAX);
+  pre_dy = clamp64(pre_dy, -INT32_MAX, INT32_MAX);
+  const uint64_t square =
+      (uint64_t)(pre_dx * pre_dx) + (uint64_t)(pre_dy * pre_dy);
+  // the root of a value with 2 * FIXED_FRAC_BITS is back in fixed_t.
+  const int64_t vel = isqrt64(square);
+  const int64_t pos =
+      clamp64((vel * fixed->inv_step) >> FIXED_FRAC_BITS, 0, fixed->max_pos);
+  const int64_t idx = pos >> FIXED_FRAC_BITS;
+  const int64_t frac = pos & (FIXED_ONE - 1);
+  const int64_t low = fixed->sens[idx];
+  return low + (((fixed->sens[idx + 1] - low) * frac) >> FIXED_FRAC_BITS);
+}
+
+/**
+ * Limits a pre-scaled fixed point velocity ran into, as accel_plan_limits
+ * finds them, without floating point.
+ */
+unsigned accel_fixed_limits(const accel_fixed_t *fixed, int64_t pre_dx,
+                            int64_t pre_dy) {
+  unsigned limits = 0;
+  if (fixed->clip > 0 && (pre_dx > fixed->clip || pre_dy > fixed->clip)) {
+    limits |= ACCEL_LIMIT_CLIP;
+    pre_dx = pre_dx < fixed->clip ? pre_dx : fixed->clip;
+    pre_dy = pre_dy < fixed->clip ? pre_dy : fixed->clip;
+  }
+  pre_dx = clamp64(pre_dx, -INT32_MAX, INT32_MAX);
+  pre_dy = clamp64(pre_dy, -INT32_MAX, INT32_MAX);
+  const uint64_t square =
+      (uint64_t)(pre_dx * pre_dx) + (uint64_t)(pre_dy * pre_dy);
+  const uint64_t bound = fixed->bound_vel;
+  if (bound > 0 && square >= bound * bound) {
+    limits |= ACCEL_LIMIT_BOUND;
+  }
+  return limits;
+}
+
+/**
+ * Add the carry to a fixed point delta and truncate it toward zero, like
+ * carry_delta does for doubles.
+ */
+static inline delta_t fixed_carry(int64_t delta, fixed_t *carry) {
+  const int64_t accum =
+      clamp64(delta + *carry, (int64_t)DELTA_MIN * FIXED_ONE,
+              (int64_t)DELTA_MAX * FIXED_ONE);
+  const int64_t trim = accum / FIXED_ONE;
+  *carry = accum - trim * FIXED_ONE;
+  return trim;
+}
+
+/**
+ * Leave the velocity and sens of a lookup in state, for the live ring.
+ */
+static inline void fixed_keep(accel_state_t *state, int64_t vel_dx,
+                              int64_t vel_dy, int64_t sens) {
+  state->fixed_vel_dx = clamp64(vel_dx, -INT32_MAX, INT32_MAX);
+  state->fixed_vel_dy = clamp64(vel_dy, -INT32_MAX, INT32_MAX);
+  state->fixed_sens = sens;
+}
+
+/**
+ * Plan kernel for the fixed point pipeline.
+ */
+void accel_fixed_run(const accel_plan_t *plan, accel_state_t *state,
+                     delta_t *dx, delta_t *dy) {
+  const accel_fixed_t *fixed = plan->fixed;
+  const int64_t pre_dx = (int64_t)*dx * fixed->pre_scalar_x;
+  const int64_t pre_dy = (int64_t)*dy * fixed->pre_scalar_y;
+  const int64_t sens = accel_fixed_sens(fixed, pre_dx, pre_dy);
+  fixed_keep(state, pre_dx, pre_dy, sens);
+  const int64_t gain_x = (sens * fixed->post_scalar_x) >> FIXED_FRAC_BITS;
+  const int64_t gain_y = (sens * fixed->post_scalar_y) >> FIXED_FRAC_BITS;
+  *dx = fixed_carry(*dx * gain_x, &state->fixed_carry_dx);
+  *dy = fixed_carry(*dy * gain_y, &state->fixed_carry_dy);
+}
+
+/**
+ * Pre-scaled fixed point velocity from a window sum that covers span_us, in
+ * counts per ACCEL_REF_INTERVAL_US.
+ */
+static inline int64_t fixed_window_vel(int64_t sum, fixed_t pre_scalar,
+                                       uint32_t span_us) {
+  const int64_t counts = clamp64(sum, -INT32_MAX, INT32_MAX);
+  const int64_t vel = clamp64(
+      counts * FIXED_ONE * ACCEL_REF_INTERVAL_US / span_us,
+      (int64_t)-INT32_MAX * FIXED_ONE, (int64_t)INT32_MAX * FIXED_ONE);
+  return (vel * pre_scalar) >> FIXED_FRAC_BITS;
+}
+
+/**
+ * Plan kernel for the fixed point pipeline with a velocity window. The
+ * velocity is found without floating point, like the rest of the pipeline.
+ */
+void accel_fixed_run_timed(const accel_plan_t *plan, accel_state_t *state,
+                           delta_t *dx, delta_t *dy) {
+  const accel_fixed_t *fixed = plan->fixed;
+  accel_window_t *window = &state->window;
+  const uint32_t span_us =
+      accel_window_push(window, plan->window_us, state->time_us, *dx, *dy);
+  const int64_t vel_dx =
+      fixed_window_vel(window->sum_dx, fixed->pre_scalar_x, span_us);
+  const int64_t vel_dy =
+      fixed_window_vel(window->sum_dy, fixed->pre_scalar_y, span_us);
+  const int64_t sens = accel_fixed_sens(fixed, vel_dx, vel_dy);
+  fixed_keep(state, vel_dx, vel_dy, sens);
+  const int64_t gain_x = (sens * fixed->post_scalar_x) >> FIXED_FRAC_BITS;
+  const int64_t gain_y = (sens * fixed->post_scalar_y) >> FIXED_FRAC_BITS;
+  *dx = fixed_carry(*dx * gain_x, &state->fixed_carry_dx);
+  *dy = fixed_carry(*dy * gain_y, &state->fixed_carry_dy);
+}
+
+/**
+ * Largest difference between the fixed point sens and the double reference
+ * over every pair of 8 bit deltas. This includes the error from sampling the
+ * curve into a table as well as from rounding to fixed point.
+ * Multiply by a delta to get the error in counts for that report.
+ */
+scalar_t accel_fixed_max_error(const accel_settings_t *as) {
+  if (!as->fixed) {
+    return 0;
+  }
+  accel_settings_t reference = *as;
+  scalar_t max_error = 0;
+  for (int dx = SCHAR_MIN; dx <= SCHAR_MAX; ++dx) {
+    for (int dy = SCHAR_MIN; dy <= SCHAR_MAX; ++dy) {
+      const scalar_t expected = reference.accel(
+          dx * as->pre_scalar_x, dy * as->pre_scalar_y, &reference);
+      const fixed_t actual =
+          accel_fixed_sens(as->fixed, (int64_t)dx * as->fixed->pre_scalar_x,
+                           (int64_t)dy * as->fixed->pre_scalar_y);
+      max_error = fmax(max_error, fabs(expected - (scalar_t)actual / FIXED_ONE));
+    }
+  }
+  return max_error;
+}
@@ -0,0 +1,295 @@
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS 1
+#endif
+
+#include "mouse_accel.h"
+
+/*
+ * quake_accel and pow_accel share one shape, so a single set of parameters
+ * covers both. pow_accel is quake_accel with no clip, no base, no upper bound
+ * and a game_sens of 1.
+ */
+typedef struct sens_params {
+  scalar_t pre_scalar_x;
+  scalar_t pre_scalar_y;
+  scalar_t clip;        /* Component limit, only used when do_clip is set */
+  scalar_t offset;
+  scalar_t accel_rate;
+  scalar_t exponent;    /* power - 1 */
+  scalar_t base;
+  scalar_t upper_bound;
+  scalar_t game_sens;
+  int int_exponent;     /* exponent as an int, or -1 if it is not small/whole */
+  bool do_clip;
+} sens_params_t;
+
+typedef void (*sens_kernel)(const delta_t *, const delta_t *, scalar_t *,
+                            size_t, const sens_params_t *);
+
+/* Largest exponent that is expanded into multiplies instead of pow */
+#define MAX_INT_EXPONENT 4
+
+static void sens_scalar(const delta_t *, const delta_t *, scalar_t *, size_t,
+                        const sens_params_t *);
+#if defined(HAVE_X86_KERNELS)
+static void sens_sse2(const delta_t *, const delta_t *, scalar_t *, size_t,
+                      const sens_params_t *);
+static void sens_avx2(const delta_t *, const delta_t *, scalar_t *, size_t,
+                      const sens_params_t *);
+static void sens_avx512(const delta_t *, const delta_t *, scalar_t *, size_t,
+                        const sens_params_t *);
+#endif
+
+/* Set once at startup, before any thread can run a batch */
+static sens_kernel kernel = sens_scalar;
+static const char *kernel_name = "scalar";
+
+/**
+ * Pick the widest kernel supported by the running CPU. Runs when the program
+ * or library is loaded, so the kernel never changes while it is used.
+ */
+__attribute__((constructor)) static void select_kernel(void) {
+#if defined(HAVE_X86_KERNELS)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    kernel = sens_avx512;
+    kernel_name = "avx512";
+  } else if (__builtin_cpu_supports("avx2")) {
+    kernel = sens_avx2;
+    kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    kernel = sens_sse2;
+    kernel_name = "sse2";
+  }
+#endif
+}
+
+const char *accel_simd_name() {
+  return kernel_name;
+}
+
+/**
+ * Compute the accel sens for n deltas. Settings with a lookup table or an
+ * accel function other than quake_accel or pow_accel are evaluated one at a
+ * time.
+ */
+void accel_sens_batch(const delta_t *dx, const delta_t *dy, scalar_t *sens,
+                      size_t n, accel_settings_t *as) {
+  if (as->lut) {
+    for (size_t idx = 0; idx < n; ++idx) {
+      sens[idx] = accel_lut_sens(as->lut, dx[idx] * as->pre_scalar_x,
+                                 dy[idx] * as->pre_scalar_y);
+    }
+    return;
+  }
+  if (as->accel != quake_accel && as->accel != pow_accel) {
+    for (size_t idx = 0; idx < n; ++idx) {
+      sens[idx] = as->accel(dx[idx] * as->pre_scalar_x,
+                            dy[idx] * as->pre_scalar_y, as);
+    }
+    return;
+  }
+  const bool quake = as->accel == quake_accel;
+  const scalar_t exponent = as->power - 1;
+  const bool whole = exponent >= 0 && exponent <= MAX_INT_EXPONENT &&
+                     exponent == floor(exponent);
+  const delta_t lim = as->overflow_lim;
+  const sens_params_t params = {
+      .pre_scalar_x = as->pre_scalar_x,
+      .pre_scalar_y = as->pre_scalar_y,
+      .clip = lim,
+      .do_clip = quake && lim > 0,
+      .offset = as->offset,
+      .accel_rate = as->accel_rate,
+      .exponent = exponent,
+      .int_exponent = whole ? (int)exponent : -1,
+      .base = quake ? as->base : 0,
+      .upper_bound = quake ? as->upper_bound : DBL_MAX,
+      .game_sens = quake ? as->game_sens : 1};
+  kernel(dx, dy, sens, n, &params);
+}
+
+static inline scalar_t scalar_sens(const delta_t dx, const delta_t dy,
+                                   const sens_params_t *p) {
+  scalar_t pre_dx = dx * p->pre_scalar_x;
+  scalar_t pre_dy = dy * p->pre_scalar_y;
+  if (p->do_clip) {
+    pre_dx = fmin(pre_dx, p->clip);
+    pre_dy = fmin(pre_dy, p->clip);
+  }
+  const scalar_t vel = sqrt(pre_dx * pre_dx + pre_dy * pre_dy);
+  const scalar_t change = fmax(vel - p->offset, 0.0);
+  const scalar_t unbounded = p->base + pow(p->accel_rate * change, p->exponent);
+  return fmin(unbounded, p->upper_bound) / p->game_sens;
+}
+
+/**
+ * Portable kernel. Also used for the tail that does not fill a SIMD register.
+ */
+static void sens_scalar(const delta_t *dx, const delta_t *dy, scalar_t *sens,
+                        size_t n, const sens_params_t *p) {
+  for (size_t idx = 0; idx < n; ++idx) {
+    sens[idx] = scalar_sens(dx[idx], dy[idx], p);
+  }
+}
+
+#if defined(HAVE_X86_KERNELS)
+
+/*
+ * The kernels below have the same structure and only differ in register
+ * width. Whole exponents up to MAX_INT_EXPONENT are expanded into multiplies.
+ * Other exponents fall back to pow for each lane, since there is no vector
+ * pow instruction.
+ */
+
+__attribute__((target("sse2"))) static void
+sens_sse2(const delta_t *dx, const delta_t *dy, scalar_t *sens, size_t n,
+          const sens_params_t *p) {
+  const __m128d pre_x = _mm_set1_pd(p->pre_scalar_x);
+  const __m128d pre_y = _mm_set1_pd(p->pre_scalar_y);
+  const __m128d clip = _mm_set1_pd(p->clip);
+  const __m128d offset = _mm_set1_pd(p->offset);
+  const __m128d rate = _mm_set1_pd(p->accel_rate);
+  const __m128d base = _mm_set1_pd(p->base);
+  const __m128d upper = _mm_set1_pd(p->upper_bound);
+  const __m128d game_sens = _mm_set1_pd(p->game_sens);
+  const __m128d zero = _mm_setzero_pd();
+  const __m128d one = _mm_set1_pd(1.0);
+  size_t idx = 0;
+  for (; idx + 2 <= n; idx += 2) {
+    __m128d x = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(dx + idx)));
+    __m128d y = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(dy + idx)));
+    x = _mm_mul_pd(x, pre_x);
+    y = _mm_mul_pd(y, pre_y);
+    if (p->do_clip) {
+      x = _mm_min_pd(x, clip);
+      y = _mm_min_pd(y, clip);
+    }
+    const __m128d vel =
+        _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)));
+    const __m128d change = _mm_max_pd(_mm_sub_pd(vel, offset), zero);
+    const __m128d scaled = _mm_mul_pd(rate, change);
+    __m128d accel = one;
+    if (p->int_exponent >= 0) {
+      for (int e = 0; e < p->int_exponent; ++e) {
+        accel = _mm_mul_pd(accel, scaled);
+      }
+    } else {
+      double lanes[2];
+      _mm_storeu_pd(lanes, scaled);
+      for (int lane = 0; lane < 2; ++lane) {
+        lanes[lane] = pow(lanes[lane], p->exponent);
+      }
+      accel = _mm_loadu_pd(lanes);
+    }
+    const __m128d bounded = _mm_min_pd(_mm_add_pd(base, accel), upper);
+    _mm_storeu_pd(sens + idx, _mm_div_pd(bounded, game_sens));
+  }
+  sens_scalar(dx + idx, dy + idx, sens + idx, n - idx, p);
+}
+
+__attribute__((target("avx2"))) static void
+sens_avx2(const delta_t *dx, const delta_t *dy, scalar_t *sens, size_t n,
+          const sens_params_t *p) {
+  const __m256d pre_x = _mm256_set1_pd(p->pre_scalar_x);
+  const __m256d pre_y = _mm256_set1_pd(p->pre_scalar_y);
+  const __m256d clip = _mm256_set1_pd(p->clip);
+  const __m256d offset = _mm256_set1_pd(p->offset);
+  const __m256d rate = _mm256_set1_pd(p->accel_rate);
+  const __m256d base = _mm256_set1_pd(p->base);
+  const __m256d upper = _mm256_set1_pd(p->upper_bound);
+  const __m256d game_sens = _mm256_set1_pd(p->game_sens);
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  size_t idx = 0;
+  for (; idx + 4 <= n; idx += 4) {
+    __m256d x =
+        _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(dx + idx)));
+    __m256d y =
+        _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(dy + idx)));
+    x = _mm256_mul_pd(x, pre_x);
+    y = _mm256_mul_pd(y, pre_y);
+    if (p->do_clip) {
+      x = _mm256_min_pd(x, clip);
+      y = _mm256_min_pd(y, clip);
+    }
+    const __m256d vel =
+        _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)));
+    const __m256d change = _mm256_max_pd(_mm256_sub_pd(vel, offset), zero);
+    const __m256d scaled = _mm256_mul_pd(rate, change);
+    __m256d accel = one;
+    if (p->int_exponent >= 0) {
+      for (int e = 0; e < p->int_exponent; ++e) {
+        accel = _mm256_mul_pd(accel, scaled);
+      }
+    } else {
+      double lanes[4];
+      _mm256_storeu_pd(lanes, scaled);
+      for (int lane = 0; lane < 4; ++lane) {
+        lanes[lane] = pow(lanes[lane], p->exponent);
+      }
+      accel = _mm256_loadu_pd(lanes);
+    }
+    const __m256d bounded = _mm256_min_pd(_mm256_add_pd(base, accel), upper);
+    _mm256_storeu_pd(sens + idx, _mm256_div_pd(bounded, game_sens));
+  }
+  sens_scalar(dx + idx, dy + idx, sens + idx, n - idx, p);
+}
+
+__attribute__((target("avx512f"))) static void
+sens_avx512(const delta_t *dx, const delta_t *dy, scalar_t *sens, size_t n,
+            const sens_params_t *p) {
+  const __m512d pre_x = _mm512_set1_pd(p->pre_scalar_x);
+  const __m512d pre_y = _mm512_set1_pd(p->pre_scalar_y);
+  const __m512d clip = _mm512_set1_pd(p->clip);
+  const __m512d offset = _mm512_set1_pd(p->offset);
+  const __m512d rate = _mm512_set1_pd(p->accel_rate);
+  const __m512d base = _mm512_set1_pd(p->base);
+  const __m512d upper = _mm512_set1_pd(p->upper_bound);
+  const __m512d game_sens = _mm512_set1_pd(p->game_sens);
+  const __m512d zero = _mm512_setzero_pd();
+  const __m512d one = _mm512_set1_pd(1.0);
+  size_t idx = 0;
+  for (; idx + 8 <= n; idx += 8) {
+    __m512d x =
+        _mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i *)(dx + idx)));
+    __m512d y =
+        _mm512_cvtepi32_pd(_mm256_loadu_si256((const __m256i *)(dy + idx)));
+    x = _mm512_mul_pd(x, pre_x);
+    y = _mm512_mul_pd(y, pre_y);
+    if (p->do_clip) {
+      x = _mm512_min_pd(x, clip);
+      y = _mm512_min_pd(y, clip);
+    }
+    const __m512d vel =
+        _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(x, x), _mm512_mul_pd(y, y)));
+    const __m512d change = _mm512_max_pd(_mm512_sub_pd(vel, offset), zero);
+    const __m512d scaled = _mm512_mul_pd(rate, change);
+    __m512d accel = one;
+    if (p->int_exponent >= 0) {
+      for (int e = 0; e < p->int_exponent; ++e) {
+        accel = _mm512_mul_pd(accel, scaled);
+      }
+    } else {
+      double lanes[8];
+      _mm512_storeu_pd(lanes, scaled);
+      for (int lane = 0; lane < 8; ++lane) {
+        lanes[lane] = pow(lanes[lane], p->exponent);
+      }
+      accel = _mm512_loadu_pd(lanes);
+    }
+    const __m512d bounded = _mm512_min_pd(_mm512_add_pd(base, accel), upper);
+    _mm512_storeu_pd(sens + idx, _mm512_div_pd(bounded, game_sens));
+  }
+  sens_scalar(dx + idx, dy + idx, sens + idx, n - idx, p);
+}
+
+#endif
@@ -1,20 +1,38 @@
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <libusb-1.0/libusb.h>
 #include <linux/input-event-codes.h>
+#include <linux/input.h>
 #include <linux/uinput.h>
 
+#include "errmsg.h"
+#include "hot_reload.h"
 #include "key_codes.h"
+#include "live_ring.h"
 #include "loading_util.h"
 #include "mouse_accel.h"
 #include "mouse_driver.h"
+#include "output_sink.h"
+#include "realtime.h"
+#include "report_layout.h"
+#include "report_log.h"
+#include "report_ring.h"
+#include "telemetry.h"
 
 /**
  * Boolean flag to run the mouse driver. When it is switched to false, the
@@ -22,7 +40,12 @@
  */
 static bool run_mouse_driver = true;
 
-static void press_keys(int, int *);
+/**
+ * Incremented on each SIGUSR1. Each mouse takes a snapshot of its telemetry
+ * after its next report once it sees a new value, and the reading loop
+ * prints it.
+ */
+static volatile sig_atomic_t telemetry_requests = 0;
 
 #if defined(DEBUG) && DEBUG + 0
 static void intrmsg(const unsigned char *buf, int len) {
@@ -45,121 +68,890 @@ void interrupt_handler(int sig) {
   run_mouse_driver = false;
 }
 
+static void telemetry_handler(int sig) {
+  (void)sig;
+  telemetry_requests++;
+}
+
 /**
- * The actual acceleration driver.
- * gets mouse interrupt packets, applies acceleration functions to the relative
- * change in mouse position, and writes it to uinput.
+ * Everything the driver keeps for one mouse. The mouse state is aligned to
+ * a cache line, so mice handled next to each other don't share one.
  */
-int accel_driver(int fd, mouse_dev_t *dev, accel_settings_t *as) {
-  int err;
+typedef struct driver_ctx {
+  mouse_state_t state;
+  output_sink_t *sink;
+  const mouse_dev_t *dev;
+  profile_set_t profiles; /* Only holds the profile's plan unless switched */
+  hot_profile_t *hot;     /* Read for the plan of each report if not NULL */
+  hot_reader_t *reader;   /* This mouse's reader of hot */
+  const driver_opts_t *opts;
+  driver_stats_t *stats;
+  report_ring_t *ring;     /* Reports for the writer thread, NULL if unused */
+  uint64_t last_report_ns; /* Time of the previous report, 0 before any */
+  bool log_time; /* Velocity is timed by the report log, not by arrival */
+  uint32_t index; /* Of the mouse, for the live ring */
+  sig_atomic_t telemetry_seen; /* telemetry_requests already snapshot */
+  _Atomic bool snapshot_ready; /* snapshot is taken and not printed yet */
+  telemetry_t snapshot;        /* Telemetry when it was last requested */
+  struct libusb_transfer **transfers;
+  unsigned char *bufs; /* Buffer of each transfer, one after another */
+  int allocated;       /* Transfers allocated */
+  int in_flight;       /* Transfers currently submitted */
+  mouse_report_t evdev_report; /* Frame being collected from an event device */
+  bool evdev_dropping;         /* Skipping events after SYN_DROPPED */
+} driver_ctx_t;
 
-#if defined(PRECOMP) && PRECOMP + 0
-  // precompute accel values
-  precomp(as);
-#endif
+static void driver_ctx_init(driver_ctx_t *ctx, output_sink_t *sink,
+                            const mouse_dev_t *dev,
+                            const accel_settings_t *as,
+                            const driver_opts_t *opts, driver_stats_t *stats) {
+  const driver_ctx_t init = {
+      .state = {.accel = {.carry_dx = 0, .carry_dy = 0}, .buttons = 0},
+      .sink = sink,
+      .dev = dev,
+      .profiles = {.plans = {&as->plan}, .count = 1, .chord = 0},
+      .hot = NULL,
+      .reader = NULL,
+      .opts = opts,
+      .stats = stats,
+      .ring = NULL,
+      .last_report_ns = 0,
+      .log_time = false,
+      .index = 0,
+      .telemetry_seen = 0,
+      .transfers = NULL,
+      .bufs = NULL,
+      .allocated = 0,
+      .in_flight = 0,
+      .evdev_report = {.buttons = 0, .x = 0, .y = 0, .wheel = 0, .hwheel = 0},
+      .evdev_dropping = false};
+  *ctx = init;
+  atomic_init(&ctx->snapshot_ready, false);
+}
 
-  struct sigaction act = {.sa_handler = interrupt_handler};
-  sigaction(SIGINT, &act, NULL);
+_Static_assert(HOT_MAX_READERS >= DRIVER_MAX_DEVICES,
+               "every mouse needs a reader of its profile");
+
+/**
+ * Set up the context of a mouse run by the driver. A mouse with a hot
+ * profile reads its plan from it for each report.
+ */
+static void driver_ctx_init_device(driver_ctx_t *ctx, driver_device_t *device,
+                                   const driver_opts_t *opts) {
+  driver_ctx_init(ctx, device->sink, device->dev, device->as, opts,
+                  &device->stats);
+  if (device->profiles) {
+    ctx->profiles = *device->profiles;
+  }
+  if (device->hot) {
+    ctx->reader = hot_profile_reader(device->hot);
+    ctx->hot = ctx->reader ? device->hot : NULL;
+  }
+}
+
+/**
+ * A report is late if it arrives more than 2 polling intervals after the
+ * previous one. Gaps longer than REPORT_IDLE_INTERVALS are taken to mean the
+ * mouse was not moving, since the mouse only sends reports when it has
+ * something to say.
+ */
+bool report_is_late(uint32_t interval_us, uint64_t gap_us) {
+  return interval_us > 0 && gap_us > 2 * (uint64_t)interval_us &&
+         gap_us <= REPORT_IDLE_INTERVALS * (uint64_t)interval_us;
+}
+
+/**
+ * True if any accelerated delta in the frame was limited to the range of
+ * delta_t.
+ */
+static bool frame_saturated(const event_frame_t *frame) {
+  for (int idx = 0; idx < frame->len; ++idx) {
+    const struct input_event *ev = &frame->events[idx];
+    if (ev->type == EV_REL && (ev->code == REL_X || ev->code == REL_Y) &&
+        (ev->value == DELTA_MIN || ev->value == DELTA_MAX)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Publish a report and what the plan made of it to the live ring. Kernels
+ * that don't look up a sens leave nothing in the accel state, so their
+ * velocity is the pre-scaled report.
+ */
+static void publish_live(const driver_ctx_t *ctx, const mouse_report_t *report,
+                         const accel_plan_t *plan, const event_frame_t *frame,
+                         uint64_t arrived_ns) {
+  const accel_state_t *accel = &ctx->state.accel;
+  live_sample_t sample = {.time_ns = arrived_ns,
+                          .in_dx = report->x,
+                          .in_dy = report->y,
+                          .out_dx = 0,
+                          .out_dy = 0,
+                          .vel_dx = accel->vel_dx,
+                          .vel_dy = accel->vel_dy,
+                          .sens = accel->sens,
+                          .device = ctx->index};
+  if (plan->kernel == ACCEL_KERNEL_FIXED) {
+    sample.vel_dx = (float)accel->fixed_vel_dx / FIXED_ONE;
+    sample.vel_dy = (float)accel->fixed_vel_dy / FIXED_ONE;
+    sample.sens = (float)accel->fixed_sens / FIXED_ONE;
+  } else if (plan->kernel == ACCEL_KERNEL_PASSTHROUGH ||
+             plan->kernel == ACCEL_KERNEL_CONSTANT) {
+    sample.vel_dx = report->x * plan->pre_scalar_x;
+    sample.vel_dy = report->y * plan->pre_scalar_y;
+    sample.sens = plan->flat_sens;
+  }
+  for (int idx = 0; idx < frame->len; ++idx) {
+    const struct input_event *event = &frame->events[idx];
+    if (event->type == EV_REL && event->code == REL_X) {
+      sample.out_dx = event->value;
+    } else if (event->type == EV_REL && event->code == REL_Y) {
+      sample.out_dy = event->value;
+    }
+  }
+  live_ring_publish(ctx->opts->live, &sample);
+}
+
+/**
+ * Accelerate a decoded report and write its events to the sink. Timed plans
+ * find the velocity from arrived_ns. If the mouse keeps telemetry, the time
+ * since arrived_ns is recorded after each stage.
+ */
+static void emit_report(driver_ctx_t *ctx, const mouse_report_t *report,
+                        uint64_t arrived_ns) {
+  mouse_report_t unchorded;
+  if (ctx->profiles.chord) {
+    unchorded = *report;
+    report = &unchorded;
+    // only counted here, printing could block a real-time thread.
+    if (map_chord(&ctx->profiles, &unchorded, &ctx->state)) {
+      ctx->stats->switches++;
+      ctx->stats->profile = ctx->state.profile;
+    }
+  }
+  const accel_plan_t *plan =
+      ctx->hot ? hot_profile_enter(ctx->hot, ctx->reader)
+               : ctx->profiles.plans[ctx->state.profile];
+  if (!ctx->log_time) {
+    ctx->state.accel.time_us = arrived_ns / 1000;
+  }
+  event_frame_t frame;
+  const int len = map_report_to_frame(&frame, report, plan, &ctx->state);
+  if (ctx->opts->live) {
+    publish_live(ctx, report, plan, &frame, arrived_ns);
+  }
+  telemetry_t *telemetry = ctx->stats->telemetry;
+  if (!telemetry) {
+    if (ctx->hot) {
+      hot_profile_exit(ctx->reader);
+    }
+    if (len > 0) {
+      output_sink_write(ctx->sink, frame.events, len);
+    }
+    return;
+  }
+
+  const uint64_t mapped_ns = telemetry_now_ns();
+  const unsigned limits =
+      accel_plan_limits(plan, &ctx->state.accel, report->x, report->y);
+  if (ctx->hot) {
+    hot_profile_exit(ctx->reader);
+  }
+  if (len > 0) {
+    output_sink_write(ctx->sink, frame.events, len);
+  }
+  telemetry_record(telemetry, arrived_ns, mapped_ns, telemetry_now_ns());
+  telemetry->clipped += (limits & ACCEL_LIMIT_CLIP) != 0;
+  telemetry->bounded += (limits & ACCEL_LIMIT_BOUND) != 0;
+  telemetry->saturated += frame_saturated(&frame);
+
+  // printing could block a real-time thread, so only a copy is taken here.
+  const sig_atomic_t requests = telemetry_requests;
+  if (requests != ctx->telemetry_seen &&
+      !atomic_load_explicit(&ctx->snapshot_ready, memory_order_acquire)) {
+    ctx->telemetry_seen = requests;
+    ctx->snapshot = *telemetry;
+    atomic_store_explicit(&ctx->snapshot_ready, true, memory_order_release);
+  }
+}
 
+/**
+ * Print the snapshot of the mouse's telemetry if one was taken. Called by
+ * the loop that reads reports, outside the report path. With a writer
+ * thread, that is the reader thread.
+ */
+static void print_snapshot(driver_ctx_t *ctx) {
+  if (!atomic_load_explicit(&ctx->snapshot_ready, memory_order_acquire)) {
+    return;
+  }
+  printf("Telemetry for %04x:%04x\n", ctx->dev->vendor_id,
+         ctx->dev->product_id);
+  telemetry_print(&ctx->snapshot, stdout);
+  atomic_store_explicit(&ctx->snapshot_ready, false, memory_order_release);
+}
+
+/**
+ * Decode a raw report and emit it. Reports with a different report ID than
+ * the mouse reports are skipped.
+ */
+static void emit_raw(driver_ctx_t *ctx, const unsigned char *buf, int len,
+                     uint64_t arrived_ns) {
+  mouse_report_t report;
+  if (report_decode(&ctx->dev->decode, buf, len, &report) == 0) {
+    emit_report(ctx, &report, arrived_ns);
+  }
+}
+
+static void handle_report(driver_ctx_t *ctx, unsigned char *buf, int len) {
+  const uint64_t now = telemetry_now_ns();
+  if (ctx->last_report_ns &&
+      report_is_late(ctx->dev->interval_us,
+                     (now - ctx->last_report_ns) / 1000)) {
+    ctx->stats->late++;
+  }
+  ctx->last_report_ns = now;
+  ctx->stats->reports++;
+  // a failed append only loses the log, so it doesn't stop the mouse.
+  if (ctx->opts->record) {
+    report_log_append(ctx->opts->record, now, buf, len);
+  }
+#if defined(DEBUG) && DEBUG + 0
+  intrmsg(buf, len);
+#endif
+  if (ctx->ring) {
+    if (!report_ring_push(ctx->ring, buf, len, now)) {
+      ctx->stats->dropped++;
+    }
+    return;
+  }
+  emit_raw(ctx, buf, len, now);
+}
+
+/**
+ * Blocking driver loop. Only one transfer is in flight at a time.
+ */
+static int run_sync(driver_ctx_t *ctx) {
+  const mouse_dev_t *dev = ctx->dev;
   const int buf_size = dev->buf_size;
   unsigned char mouse_interrupt_buf[buf_size];
   int actual_interrupt_length;
   while (run_mouse_driver) {
-    err = libusb_interrupt_transfer(
+    const int err = libusb_interrupt_transfer(
         dev->usb_handle, dev->endpoint_in, mouse_interrupt_buf,
         sizeof(mouse_interrupt_buf), &actual_interrupt_length, 0);
+    if (err == LIBUSB_ERROR_INTERRUPTED) {
+      continue;
+    }
     if (err < 0 || actual_interrupt_length > buf_size) {
       printf("interrupt length %d\n", actual_interrupt_length);
       return err;
     }
-#if defined(DEBUG) && DEBUG + 0
-    intrmsg(mouse_interrupt_buf, actual_interrupt_length);
-#endif
-    map_to_uinput(fd, mouse_interrupt_buf, actual_interrupt_length, as);
+    handle_report(ctx, mouse_interrupt_buf, actual_interrupt_length);
+    print_snapshot(ctx);
+  }
+  return 0;
+}
+
+/**
+ * Called by libusb when a transfer finishes. Handles the report and submits
+ * the transfer again so the ring stays full. Once the device is gone, its
+ * transfers are not submitted again.
+ */
+static void LIBUSB_CALL transfer_done(struct libusb_transfer *transfer) {
+  driver_ctx_t *ctx = transfer->user_data;
+  switch (transfer->status) {
+  case LIBUSB_TRANSFER_COMPLETED:
+    handle_report(ctx, transfer->buffer, transfer->actual_length);
+    break;
+  case LIBUSB_TRANSFER_CANCELLED:
+    ctx->in_flight--;
+    return;
+  case LIBUSB_TRANSFER_NO_DEVICE:
+    ctx->stats->dropped++;
+    ctx->in_flight--;
+    return;
+  default:
+    ctx->stats->dropped++;
+    break;
+  }
+  if (!run_mouse_driver || libusb_submit_transfer(transfer) != 0) {
+    ctx->in_flight--;
+  }
+}
+
+/**
+ * Allocate and submit dev->transfers transfers for the mouse, so the host
+ * controller always has one to fill while reports are being handled.
+ * Returns 0 on success, otherwise the libusb error. Transfers that were
+ * submitted before an error still have to be stopped.
+ */
+static int transfers_start(driver_ctx_t *ctx) {
+  const mouse_dev_t *dev = ctx->dev;
+  const int count = dev->transfers;
+  ctx->transfers = calloc(count, sizeof(struct libusb_transfer *));
+  ctx->bufs = malloc((size_t)count * dev->buf_size);
+  if (!ctx->transfers || !ctx->bufs) {
+    return LIBUSB_ERROR_NO_MEM;
+  }
+  while (ctx->allocated < count) {
+    struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+    if (!transfer) {
+      return LIBUSB_ERROR_NO_MEM;
+    }
+    libusb_fill_interrupt_transfer(
+        transfer, dev->usb_handle, dev->endpoint_in,
+        ctx->bufs + (size_t)ctx->allocated * dev->buf_size, dev->buf_size,
+        transfer_done, ctx, 0);
+    ctx->transfers[ctx->allocated++] = transfer;
+    const int err = libusb_submit_transfer(transfer);
+    if (err) {
+      return err;
+    }
+    ctx->in_flight++;
+  }
+  return 0;
+}
+
+/**
+ * Cancel the mouse's transfers and free them once they have completed.
+ * Must be called after run_mouse_driver is false, so they are not submitted
+ * again.
+ */
+static void transfers_stop(driver_ctx_t *ctx) {
+  for (int idx = 0; idx < ctx->allocated; ++idx) {
+    libusb_cancel_transfer(ctx->transfers[idx]);
+  }
+  while (ctx->in_flight > 0) {
+    const int event_err = libusb_handle_events(ctx->dev->usb_ctx);
+    if (event_err < 0 && event_err != LIBUSB_ERROR_INTERRUPTED) {
+      break;
+    }
+  }
+  for (int idx = 0; idx < ctx->allocated; ++idx) {
+    libusb_free_transfer(ctx->transfers[idx]);
+  }
+  free(ctx->transfers);
+  free(ctx->bufs);
+  ctx->transfers = NULL;
+  ctx->bufs = NULL;
+  ctx->allocated = 0;
+}
+
+/**
+ * Asynchronous driver loop for one mouse.
+ */
+static int run_async(driver_ctx_t *ctx) {
+  const mouse_dev_t *dev = ctx->dev;
+  int err = transfers_start(ctx);
+
+  // a zero timeout makes libusb poll without sleeping.
+  struct timeval busy = {.tv_sec = 0, .tv_usec = 0};
+  while (!err && run_mouse_driver && ctx->in_flight > 0) {
+    err = ctx->opts->busy_poll
+              ? libusb_handle_events_timeout_completed(dev->usb_ctx, &busy,
+                                                       NULL)
+              : libusb_handle_events(dev->usb_ctx);
+    if (err == LIBUSB_ERROR_INTERRUPTED) {
+      err = 0;
+    }
+    print_snapshot(ctx);
+  }
+
+  // cancelled transfers still have to complete before they can be freed.
+  run_mouse_driver = false;
+  transfers_stop(ctx);
+  return err;
+}
+
+/**
+ * Buttons held according to the event device. Used to catch up after the
+ * kernel dropped events.
+ */
+static uint32_t evdev_buttons(int fd) {
+  unsigned long keys[KEY_MAX / (8 * sizeof(unsigned long)) + 1] = {0};
+  ioctl(fd, EVIOCGKEY(sizeof(keys)), keys);
+  uint32_t buttons = 0;
+  for (int bit = 0; bit < BUTTON_COUNT; ++bit) {
+    const int code = BTN_MOUSE + bit;
+    const unsigned long word = keys[code / (8 * sizeof(unsigned long))];
+    buttons |= ((word >> code % (8 * sizeof(unsigned long))) & 1) << bit;
+  }
+  return buttons;
+}
+
+/**
+ * Read every event that is ready from the mouse's event device, which is at
+ * least one whole frame while the mouse is moving. Each frame is accelerated
+ * and written like a USB report.
+ * After SYN_DROPPED the kernel lost events, so the rest of that frame is
+ * discarded and the held buttons are read from the device again.
+ * Returns 0 on success, otherwise errno.
+ */
+static int evdev_read(driver_ctx_t *ctx) {
+  const int in_fd = ctx->dev->evdev_fd;
+  struct input_event events[EVDEV_READ_EVENTS];
+  const ssize_t bytes = read(in_fd, events, sizeof(events));
+  if (bytes < 0) {
+    return errno == EINTR || errno == EAGAIN ? 0 : errno;
+  }
+  mouse_report_t *report = &ctx->evdev_report;
+  const int count = bytes / sizeof(struct input_event);
+  for (int idx = 0; idx < count; ++idx) {
+    const struct input_event *ev = &events[idx];
+    if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+      ctx->stats->dropped++;
+      ctx->evdev_dropping = true;
+    } else if (ctx->evdev_dropping) {
+      if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        const mouse_report_t synced = {.buttons = evdev_buttons(in_fd),
+                                       .x = 0,
+                                       .y = 0,
+                                       .wheel = 0,
+                                       .hwheel = 0};
+        *report = synced;
+        ctx->evdev_dropping = false;
+      }
+    } else if (evdev_collect(report, ev)) {
+      // the event device was set to stamp events with CLOCK_MONOTONIC.
+      const uint64_t arrived_ns = (uint64_t)ev->time.tv_sec * 1000000000 +
+                                  (uint64_t)ev->time.tv_usec * 1000;
+      ctx->stats->reports++;
+      emit_report(ctx, report, arrived_ns);
+      report->x = report->y = report->wheel = report->hwheel = 0;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Driver loop for the evdev backend.
+ */
+static int run_evdev(driver_ctx_t *ctx) {
+  while (run_mouse_driver) {
+    const int err = evdev_read(ctx);
+    if (err) {
+      return err;
+    }
+    print_snapshot(ctx);
   }
   return 0;
 }
 
-/*
- * emit (write) interrupt to uinput at fd
+/**
+ * Writer thread for the threaded pipeline. Takes reports from the ring and
+ * writes them to uinput until the reader closes the ring.
  */
-void emit_intr(int fd, unsigned short type, unsigned short code, int val) {
-  struct input_event ie = {.type = type,
-                           .code = code,
-                           .value = val,
-                           .time.tv_sec = 0,
-                           .time.tv_usec = 0};
-  write(fd, &ie, sizeof(ie));
+static void *emit_thread(void *arg) {
+  driver_ctx_t *ctx = arg;
+  const driver_opts_t *opts = ctx->opts;
+  int err = realtime_setup_thread(opts->rt_priority, opts->writer_cpu);
+  if (err) {
+    errmsg("Could not set up the writer thread", err);
+  }
+  if (opts->lock_memory) {
+    realtime_prefault_stack();
+  }
+  report_ring_t *ring = ctx->ring;
+  while (true) {
+    const report_slot_t *slot = report_ring_peek(ring);
+    if (slot) {
+      emit_raw(ctx, slot->data, slot->len, slot->arrived_ns);
+      report_ring_release(ring);
+    } else if (report_ring_closed(ring)) {
+      // reports pushed before the ring was closed are still handled.
+      if (!report_ring_peek(ring)) {
+        break;
+      }
+    } else if (opts->busy_poll) {
+      realtime_cpu_relax();
+    } else {
+      report_ring_wait(ring);
+    }
+  }
+  return NULL;
 }
 
-void map_to_uinput(int fd, unsigned char *buf, int buf_size,
-                   accel_settings_t *as) {
-  map_key_to_uinput(fd, buf);
-  map_scroll_to_uinput(fd, buf, buf_size);
-  map_move_to_uinput(fd, buf, as);
-  emit_intr(fd, EV_SYN, SYN_REPORT, 0);
+/**
+ * Read reports on the calling thread and hand them to a writer thread through
+ * a report ring. SIGINT and SIGUSR1 are blocked in the writer so they
+ * interrupt the reader.
+ */
+static int run_threaded(driver_ctx_t *ctx) {
+  if (ctx->dev->buf_size > REPORT_SLOT_SIZE) {
+    printf("Marley-Accel: Reports of %d bytes do not fit the report ring.\n",
+           ctx->dev->buf_size);
+    return -1;
+  }
+  report_ring_t ring;
+  if (report_ring_init(&ring, REPORT_RING_DEFAULT_SIZE) != 0) {
+    return LIBUSB_ERROR_NO_MEM;
+  }
+
+  sigset_t block, old;
+  sigemptyset(&block);
+  sigaddset(&block, SIGINT);
+  sigaddset(&block, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &block, &old);
+  ctx->ring = &ring;
+  pthread_t writer;
+  int err = pthread_create(&writer, NULL, emit_thread, ctx);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (err) {
+    errmsg("Could not start the writer thread", err);
+    ctx->ring = NULL;
+    report_ring_free(&ring);
+    return -1;
+  }
+
+  err = ctx->dev->transfers > 0 ? run_async(ctx) : run_sync(ctx);
+
+  report_ring_close(&ring);
+  pthread_join(writer, NULL);
+  ctx->ring = NULL;
+  report_ring_free(&ring);
+  return err;
 }
 
-void map_scroll_to_uinput(int fd, unsigned char *buf, int buf_size) {
-  const int scroll_idx = buf_size - 1; // always at the last index.
-  if (buf[scroll_idx] != 0) {
-    emit_intr(fd, EV_REL, REL_WHEEL, (signed char)buf[scroll_idx]);
+/**
+ * Catch SIGINT and SIGUSR1, and apply the real-time options to the calling
+ * thread.
+ */
+static void driver_setup(const driver_opts_t *opts) {
+  struct sigaction act = {.sa_handler = interrupt_handler};
+  sigaction(SIGINT, &act, NULL);
+  struct sigaction dump = {.sa_handler = telemetry_handler};
+  sigaction(SIGUSR1, &dump, NULL);
+
+  int err;
+  if (opts->lock_memory && (err = realtime_lock_memory()) != 0) {
+    errmsg("Could not lock memory", err);
+  }
+  if ((err = realtime_setup_thread(opts->rt_priority, opts->reader_cpu))) {
+    errmsg("Could not set up the reader thread", err);
   }
 }
 
-static void assign_pressed(const int *const key_codes, int *pressed) {
-  const int len = key_codes[0];
-  for (int i = 1; i < len + 1; ++i) {
-    if (key_codes[i] == BTN_LEFT)
-      pressed[0] = 1;
-    else if (key_codes[i] == BTN_RIGHT)
-      pressed[1] = 1;
-    else if (key_codes[i] == BTN_MIDDLE)
-      pressed[2] = 1;
-    else if (key_codes[i] == BTN_SIDE)
-      pressed[3] = 1;
-    else if (key_codes[i] == BTN_EXTRA)
-      pressed[4] = 1;
+/**
+ * The actual acceleration driver.
+ * gets mouse interrupt packets, applies acceleration functions to the relative
+ * change in mouse position, and writes it to the device's sink.
+ * Reports are read from dev->evdev_fd if it is open. Otherwise they are read
+ * with dev->transfers asynchronous USB transfers, or with blocking transfers
+ * if that is 0. With opts->threaded, the calling thread
+ * only reads reports and a second thread writes them. Counts are added to
+ * the device's stats. If the device has a hot profile, its plan is read for
+ * each report, so it can be reloaded while the driver runs.
+ */
+int accel_driver(driver_device_t *device, const driver_opts_t *opts) {
+  const mouse_dev_t *dev = device->dev;
+  driver_ctx_t ctx;
+  driver_ctx_init_device(&ctx, device, opts);
+  driver_setup(opts);
+
+  if (dev->evdev_fd >= 0) {
+    return run_evdev(&ctx);
   }
+  if (opts->threaded) {
+    return run_threaded(&ctx);
+  }
+  if (dev->transfers > 0) {
+    return run_async(&ctx);
+  }
+  return run_sync(&ctx);
 }
 
 /**
- * Given mask of currently pressed keys, write the info to uinput
- *
- * pressed[i] = 1 means that key i is pressed. If zero, it is released.
- * This can easily handle keycodes when multiple keys are pressed.
+ * Feed the reports of a log through the driver as if they came from dev,
+ * which only needs its decode plan. With timed, each report is emitted at
+ * its original time after the first one, otherwise as fast as they are read.
+ * Telemetry times each report from when it was due, and timed plans use the
+ * recorded times.
+ * Returns 0 at the end of the log, -1 if the log is damaged.
  */
-void map_key_to_uinput(int fd, unsigned char *buf) {
-  const int idx = buf[0];
-  int pressed[5] = {0, 0, 0, 0, 0};
-  assign_pressed(key_code_map[idx], pressed);
-  press_keys(fd, pressed);
+int accel_replay(output_sink_t *sink, mouse_dev_t *dev, accel_settings_t *as,
+                 const driver_opts_t *opts, driver_stats_t *stats,
+                 report_log_t *log, bool timed) {
+  driver_ctx_t ctx;
+  driver_ctx_init(&ctx, sink, dev, as, opts, stats);
+  ctx.log_time = true;
+  driver_setup(opts);
+
+  unsigned char buf[REPORT_MAX_SIZE];
+  const uint64_t start_ns = telemetry_now_ns();
+  uint64_t first_ns = 0;
+  uint64_t time_ns;
+  int len;
+  int got = 0;
+  while (run_mouse_driver &&
+         (got = report_log_next(log, &time_ns, buf, &len)) == 1) {
+    if (stats->reports == 0) {
+      first_ns = time_ns;
+    }
+    uint64_t due_ns = telemetry_now_ns();
+    if (timed) {
+      due_ns = start_ns + (time_ns > first_ns ? time_ns - first_ns : 0);
+      const struct timespec due = {.tv_sec = due_ns / 1000000000,
+                                   .tv_nsec = due_ns % 1000000000};
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) ==
+                 EINTR &&
+             run_mouse_driver) {
+      }
+    }
+    stats->reports++;
+    // velocity uses the recorded time even if the log is replayed faster.
+    ctx.state.accel.time_us = time_ns / 1000;
+    emit_raw(&ctx, buf, len, due_ns);
+    print_snapshot(&ctx);
+  }
+  return got < 0 ? -1 : 0;
 }
 
 /**
- * Given mask of pressed keys, Emits interrupt for all mouse keys. Releases any
- * keys that are not held down.
+ * Add fd to the epoll set, with ctx as the data returned when it is ready.
+ * Returns 0 on success, otherwise errno.
  */
-static void press_keys(int fd, int *pressed) {
-  emit_intr(fd, EV_KEY, BTN_LEFT, pressed[0]);
-  emit_intr(fd, EV_KEY, BTN_RIGHT, pressed[1]);
-  emit_intr(fd, EV_KEY, BTN_MIDDLE, pressed[2]);
-  emit_intr(fd, EV_KEY, BTN_SIDE, pressed[3]);
-  emit_intr(fd, EV_KEY, BTN_EXTRA, pressed[4]);
+static int epoll_watch(int epfd, int fd, uint32_t events, driver_ctx_t *ctx) {
+  struct epoll_event event = {.events = events, .data.ptr = ctx};
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) == 0 ? 0 : errno;
 }
 
-static int buf_to_delta(unsigned char low, unsigned char sign) {
-  return (delta_t)(sign == 0 ? low : (signed char)low);
+/**
+ * Start the transfers of a USB mouse and add the fds of its libusb context
+ * to the epoll set.
+ * Returns 0 on success, otherwise the error.
+ */
+static int watch_usb(int epfd, driver_ctx_t *ctx) {
+  int err = transfers_start(ctx);
+  if (err) {
+    return err;
+  }
+  const struct libusb_pollfd **fds = libusb_get_pollfds(ctx->dev->usb_ctx);
+  if (!fds) {
+    return LIBUSB_ERROR_OTHER;
+  }
+  for (int idx = 0; fds[idx] && !err; ++idx) {
+    const uint32_t events = (fds[idx]->events & POLLIN ? EPOLLIN : 0) |
+                            (fds[idx]->events & POLLOUT ? EPOLLOUT : 0);
+    err = epoll_watch(epfd, fds[idx]->fd, events, ctx);
+  }
+  libusb_free_pollfds(fds);
+  return err;
 }
 
-void map_move_to_uinput(int fd, unsigned char *buf, accel_settings_t *as) {
-  // retrieve the changes in mouse position.
-  // convert to signed char (overflowed values become proper d* in negative
-  // direction.)
-  delta_t dx = buf_to_delta(buf[1], buf[2]);
-  delta_t dy = buf_to_delta(buf[3], buf[4]);
+/**
+ * Drive several mice from one epoll loop. Event devices are read when their
+ * fd is ready. USB mice keep their transfers submitted, and their libusb
+ * context handles events when one of its fds is ready.
+ * Each mouse has its own state. Mice with the same profile share its plan
+ * and tables, which are only read.
+ * Returns 0 on success, otherwise the first error.
+ */
+int accel_driver_multi(driver_device_t *devices, int count,
+                       const driver_opts_t *opts) {
+  driver_ctx_t *ctxs =
+      aligned_alloc(_Alignof(driver_ctx_t), sizeof(driver_ctx_t) * count);
+  if (!ctxs) {
+    return -1;
+  }
+  const int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) {
+    free(ctxs);
+    return errno;
+  }
+  driver_setup(opts);
+
+  int err = 0;
+  int started = 0;
+  for (; started < count && !err; ++started) {
+    driver_device_t *device = &devices[started];
+    driver_ctx_t *ctx = &ctxs[started];
+    driver_ctx_init_device(ctx, device, opts);
+    ctx->index = started;
+    err = device->dev->evdev_fd >= 0
+              ? epoll_watch(epfd, device->dev->evdev_fd, EPOLLIN, ctx)
+              : watch_usb(epfd, ctx);
+  }
+
+  struct epoll_event ready[DRIVER_MAX_DEVICES];
+  struct timeval zero = {.tv_sec = 0, .tv_usec = 0};
+  while (!err && run_mouse_driver) {
+    const int nready = epoll_wait(epfd, ready, DRIVER_MAX_DEVICES,
+                                  opts->busy_poll ? 0 : -1);
+    if (nready < 0) {
+      err = errno == EINTR ? 0 : errno;
+      continue;
+    }
+    for (int idx = 0; idx < nready && !err; ++idx) {
+      driver_ctx_t *ctx = ready[idx].data.ptr;
+      if (ctx->dev->evdev_fd >= 0) {
+        err = evdev_read(ctx);
+      } else {
+        err = libusb_handle_events_timeout_completed(ctx->dev->usb_ctx,
+                                                     &zero, NULL);
+        err = err == LIBUSB_ERROR_INTERRUPTED ? 0 : err;
+      }
+    }
+    for (int idx = 0; idx < started; ++idx) {
+      print_snapshot(&ctxs[idx]);
+    }
+  }
+
+  // cancelled transfers still have to complete before they can be freed.
+  run_mouse_driver = false;
+  for (int idx = 0; idx < started; ++idx) {
+    if (ctxs[idx].dev->evdev_fd < 0) {
+      transfers_stop(&ctxs[idx]);
+    }
+  }
+  close(epfd);
+  free(ctxs);
+  return err;
+}
+
+/**
+ * Append one event to the frame.
+ */
+static inline void frame_push(event_frame_t *frame, unsigned short type,
+                              unsigned short code, int val) {
+  frame->events[frame->len++] = (struct input_event){
+      .type = type, .code = code, .value = val};
+}
+
+/**
+ * Build the uinput events for a decoded report into frame. Only buttons that
+ * changed since the last frame and non-zero axes are added. A SYN is added
+ * at the end unless the frame is empty.
+ * Returns the number of events in the frame.
+ */
+int map_report_to_frame(event_frame_t *frame, const mouse_report_t *report,
+                        const accel_plan_t *plan, mouse_state_t *state) {
+  frame->len = 0;
+  map_key_to_uinput(frame, report, state);
+  map_scroll_to_uinput(frame, report);
+  map_move_to_uinput(frame, report, plan, &state->accel);
+  if (frame->len > 0) {
+    frame_push(frame, EV_SYN, SYN_REPORT, 0);
+  }
+  return frame->len;
+}
+
+/**
+ * Decode a raw report and build its uinput events into frame. Reports with a
+ * different report ID than the mouse reports are skipped.
+ * Returns the number of events in the frame.
+ */
+int map_to_frame(event_frame_t *frame, const unsigned char *buf, int buf_size,
+                 const report_plan_t *decode, const accel_plan_t *plan,
+                 mouse_state_t *state) {
+  mouse_report_t report;
+  if (report_decode(decode, buf, buf_size, &report) != 0) {
+    frame->len = 0;
+    return 0;
+  }
+  return map_report_to_frame(frame, &report, plan, state);
+}
+
+/**
+ * Add one event from an event device to the report being collected.
+ * Relative motion is summed until the end of the frame, and button events
+ * update the mask of held buttons. Other events are ignored.
+ * Returns true if the event ends the frame.
+ */
+bool evdev_collect(mouse_report_t *report, const struct input_event *ev) {
+  if (ev->type == EV_REL) {
+    switch (ev->code) {
+    case REL_X:
+      report->x += ev->value;
+      break;
+    case REL_Y:
+      report->y += ev->value;
+      break;
+    case REL_WHEEL:
+      report->wheel += ev->value;
+      break;
+    case REL_HWHEEL:
+      report->hwheel += ev->value;
+      break;
+    }
+  } else if (ev->type == EV_KEY && ev->code >= BTN_MOUSE &&
+             ev->code < BTN_MOUSE + BUTTON_COUNT) {
+    const uint32_t bit = 1u << (ev->code - BTN_MOUSE);
+    report->buttons = ev->value ? report->buttons | bit : report->buttons & ~bit;
+  }
+  return ev->type == EV_SYN && ev->code == SYN_REPORT;
+}
+
+/**
+ * Write the events for one report to the sink with a single write.
+ * Nothing is written if the report changed nothing.
+ */
+void map_to_uinput(output_sink_t *sink, const unsigned char *buf,
+                   int buf_size, const report_plan_t *decode,
+                   const accel_plan_t *plan, mouse_state_t *state) {
+  event_frame_t frame;
+  const int len = map_to_frame(&frame, buf, buf_size, decode, plan, state);
+  if (len > 0) {
+    output_sink_write(sink, frame.events, len);
+  }
+}
+
+void map_scroll_to_uinput(event_frame_t *frame, const mouse_report_t *report) {
+  if (report->wheel != 0) {
+    frame_push(frame, EV_REL, REL_WHEEL, report->wheel);
+  }
+  if (report->hwheel != 0) {
+    frame_push(frame, EV_REL, REL_HWHEEL, report->hwheel);
+  }
+}
+
+/**
+ * Switch to the next profile of the set when the last button of its chord
+ * is pressed. The chord buttons are taken out of the report, so they are
+ * never forwarded.
+ * Returns true if the profile was switched.
+ */
+bool map_chord(const profile_set_t *profiles, mouse_report_t *report,
+               mouse_state_t *state) {
+  const bool held = (report->buttons & profiles->chord) == profiles->chord;
+  const bool pressed = held && !state->chord_held;
+  if (pressed) {
+    state->profile =
+        state->profile + 1 < profiles->count ? state->profile + 1 : 0;
+  }
+  state->chord_held = held;
+  report->buttons &= ~profiles->chord;
+  return pressed;
+}
+
+/**
+ * Add an event for each button that was pressed or released since the last
+ * frame. state->buttons holds the mask of held buttons, so the changed
+ * buttons are the set bits of the XOR with the new mask.
+ */
+void map_key_to_uinput(event_frame_t *frame, const mouse_report_t *report,
+                       mouse_state_t *state) {
+  const uint32_t pressed = report->buttons & ((1u << BUTTON_COUNT) - 1);
+  uint32_t changed = pressed ^ state->buttons;
+  while (changed) {
+    const int bit = __builtin_ctz(changed);
+    frame_push(frame, EV_KEY, button_codes[bit], (pressed >> bit) & 1);
+    changed &= changed - 1;
+  }
+  state->buttons = pressed;
+}
+
+void map_move_to_uinput(event_frame_t *frame, const mouse_report_t *report,
+                        const accel_plan_t *plan, accel_state_t *state) {
+  delta_t dx = report->x;
+  delta_t dy = report->y;
   // dx and dy are updated in-place.
-  accelerate(&dx, &dy, as);
-  emit_intr(fd, EV_REL, REL_X, dx);
-  emit_intr(fd, EV_REL, REL_Y, dy);
+  accel_plan_run(plan, state, &dx, &dy);
+  if (dx != 0) {
+    frame_push(frame, EV_REL, REL_X, dx);
+  }
+  if (dy != 0) {
+    frame_push(frame, EV_REL, REL_Y, dy);
+  }
 }
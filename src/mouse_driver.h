@@ -1,16 +1,132 @@
 #ifndef MOUSE_DRIVER_H
 #define MOUSE_DRIVER_H
 
+#include "key_codes.h"
+
+// Defined in hot_reload.h
+typedef struct hot_profile hot_profile_t;
+// Defined in live_ring.h
+typedef struct live_ring live_ring_t;
 // Defined in loading_util.h
 typedef struct mouse_dev mouse_dev_t;
 // Defined in m_accel.h
 typedef struct accel_settings accel_settings_t;
+typedef struct accel_plan accel_plan_t;
+typedef struct accel_state accel_state_t;
+// Defined in output_sink.h
+typedef struct output_sink output_sink_t;
+// Defined in report_layout.h
+typedef struct mouse_report mouse_report_t;
+typedef struct report_plan report_plan_t;
+// Defined in report_log.h
+typedef struct report_log report_log_t;
+// Defined in telemetry.h
+typedef struct telemetry telemetry_t;
+
+/* Transfers kept in flight by default. 0 uses blocking transfers */
+#define DRIVER_DEFAULT_TRANSFERS 4
+/* Events read from an event device at a time */
+#define EVDEV_READ_EVENTS 64
+/* Gaps longer than this many polling intervals mean the mouse was idle */
+#define REPORT_IDLE_INTERVALS 16
+
+/* Most events from one report: each button, both wheels, X, Y and SYN */
+#define FRAME_MAX_EVENTS (BUTTON_COUNT + 5)
+
+/**
+ * Events for one report, written to uinput with a single write.
+ */
+typedef struct event_frame {
+  struct input_event events[FRAME_MAX_EVENTS];
+  int len;
+} event_frame_t;
+
+/* Alignment of mouse_state_t, so each mouse's state has its own cache line */
+#define MOUSE_STATE_ALIGN 64
+/* Most mice one driver can run */
+#define DRIVER_MAX_DEVICES 16
+/* Most profiles one mouse can switch between */
+#define DRIVER_MAX_PROFILES 16
+
+/**
+ * Per-device state kept between reports.
+ */
+typedef struct mouse_state {
+  _Alignas(MOUSE_STATE_ALIGN) accel_state_t accel; /* Carry for the plan */
+  uint32_t buttons; /* Mask of buttons held in the last frame */
+  uint8_t profile;  /* Index of the plan in use in the profile set */
+  bool chord_held;  /* Every chord button was held in the last report */
+} mouse_state_t;
+
+/**
+ * Profiles a mouse switches between. Each plan is compiled, with its tables
+ * built, before the driver starts, so a switch only changes the index in the
+ * mouse state.
+ */
+typedef struct profile_set {
+  const accel_plan_t *plans[DRIVER_MAX_PROFILES];
+  const char *names[DRIVER_MAX_PROFILES];
+  int count;
+  uint32_t chord; /* Buttons that pick the next profile, 0 for none */
+} profile_set_t;
+
+/**
+ * Counts kept by the driver while it runs.
+ */
+typedef struct driver_stats {
+  uint64_t reports;  /* Reports handled */
+  uint64_t dropped;  /* Transfers that failed or could not be resubmitted */
+  uint64_t late;     /* Reports more than 2 polling intervals after the last */
+  uint64_t switches; /* Profile switches from the chord */
+  int profile;       /* Profile in use after the last switch */
+  telemetry_t *telemetry; /* Latency histograms, NULL to not keep them */
+} driver_stats_t;
+
+/**
+ * How the driver threads are run.
+ */
+typedef struct driver_opts {
+  bool threaded;    /* Read and write reports on separate threads */
+  int rt_priority;  /* SCHED_FIFO priority of the threads, 0 to leave it */
+  int reader_cpu;   /* CPU the reader thread is pinned to, -1 for any */
+  int writer_cpu;   /* CPU the writer thread is pinned to, -1 for any */
+  bool lock_memory; /* mlockall and prefault the thread stacks */
+  bool busy_poll;   /* Spin instead of sleeping while waiting for reports */
+  report_log_t *record; /* Log raw USB reports are appended to, or NULL */
+  live_ring_t *live;    /* Ring every report is published to, or NULL */
+} driver_opts_t;
+
+/**
+ * A mouse run by accel_driver_multi and where its events go.
+ */
+typedef struct driver_device {
+  mouse_dev_t *dev;
+  accel_settings_t *as; /* Profile, may be shared with other mice */
+  hot_profile_t *hot;   /* Reloadable profile read instead of as, or NULL */
+  const profile_set_t *profiles; /* Switched with a chord instead of as */
+  output_sink_t *sink;  /* Shared when mice are merged */
+  driver_stats_t stats;
+} driver_device_t;
 
-int accel_driver(int fd, mouse_dev_t *, accel_settings_t *);
-void emit_intr(int, unsigned short, unsigned short, int);
-void map_to_uinput(int, unsigned char *, int, accel_settings_t *);
-void map_key_to_uinput(int, unsigned char *);
-void map_move_to_uinput(int, unsigned char *, accel_settings_t *);
-void map_scroll_to_uinput(int, unsigned char *, int);
+int accel_driver(driver_device_t *, const driver_opts_t *);
+int accel_driver_multi(driver_device_t *, int, const driver_opts_t *);
+int accel_replay(output_sink_t *, mouse_dev_t *, accel_settings_t *,
+                 const driver_opts_t *, driver_stats_t *, report_log_t *,
+                 bool);
+bool report_is_late(uint32_t, uint64_t);
+int map_report_to_frame(event_frame_t *, const mouse_report_t *,
+                        const accel_plan_t *, mouse_state_t *);
+int map_to_frame(event_frame_t *, const unsigned char *, int,
+                 const report_plan_t *, const accel_plan_t *, mouse_state_t *);
+void map_to_uinput(output_sink_t *, const unsigned char *, int,
+                   const report_plan_t *, const accel_plan_t *,
+                   mouse_state_t *);
+bool map_chord(const profile_set_t *, mouse_report_t *, mouse_state_t *);
+void map_key_to_uinput(event_frame_t *, const mouse_report_t *,
+                       mouse_state_t *);
+void map_move_to_uinput(event_frame_t *, const mouse_report_t *,
+                        const accel_plan_t *, accel_state_t *);
+void map_scroll_to_uinput(event_frame_t *, const mouse_report_t *);
+bool evdev_collect(mouse_report_t *, const struct input_event *);
 
 #endif
@@ -0,0 +1,149 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libusb-1.0/libusb.h>
+#include <linux/input.h>
+
+#include "loading_util.h"
+#include "output_sink.h"
+
+static void sink_init(output_sink_t *sink, const char *name) {
+  sink->write = NULL;
+  sink->close = NULL;
+  sink->name = name;
+  sink->fd = -1;
+  sink->events = NULL;
+  sink->mask = 0;
+  sink->written = 0;
+}
+
+/**
+ * Write a frame to the sink's fd in one call, so a reader never sees half a
+ * frame.
+ */
+static int write_fd(output_sink_t *sink, const struct input_event *events,
+                    int count) {
+  const ssize_t bytes = sizeof(struct input_event) * count;
+  const ssize_t written = write(sink->fd, events, bytes);
+  if (written != bytes) {
+    return written < 0 ? errno : EIO;
+  }
+  sink->written += count;
+  return 0;
+}
+
+static void close_uinput(output_sink_t *sink) {
+  close_input_device(sink->fd);
+}
+
+/**
+ * Sink that creates a uinput mouse with the given ids.
+ * Returns 0 on success, otherwise the error from creating the device.
+ */
+int output_sink_uinput(output_sink_t *sink, uint16_t vendor_id,
+                       uint16_t product_id) {
+  sink_init(sink, "uinput");
+  const int fd = create_input_device(vendor_id, product_id);
+  if (fd < 0) {
+    return fd;
+  }
+  sink->fd = fd;
+  sink->write = write_fd;
+  sink->close = close_uinput;
+  return 0;
+}
+
+static int write_null(output_sink_t *sink, const struct input_event *events,
+                      int count) {
+  (void)events;
+  sink->written += count;
+  return 0;
+}
+
+/**
+ * Sink that drops every event without a syscall. Only the count is kept.
+ */
+void output_sink_null(output_sink_t *sink) {
+  sink_init(sink, "null");
+  sink->write = write_null;
+}
+
+static int write_memory(output_sink_t *sink, const struct input_event *events,
+                        int count) {
+  for (int idx = 0; idx < count; ++idx) {
+    sink->events[(sink->written + idx) & sink->mask] = events[idx];
+  }
+  sink->written += count;
+  return 0;
+}
+
+static void close_memory(output_sink_t *sink) {
+  free(sink->events);
+  sink->events = NULL;
+}
+
+/**
+ * Sink that keeps the last capacity events in memory, for tests. capacity is
+ * rounded up to a power of two, and 0 uses OUTPUT_SINK_MEMORY_DEFAULT.
+ * Returns 0 on success, -1 if the ring could not be allocated.
+ */
+int output_sink_memory(output_sink_t *sink, uint32_t capacity) {
+  sink_init(sink, "memory");
+  uint32_t size = 1;
+  while (size < (capacity ? capacity : OUTPUT_SINK_MEMORY_DEFAULT)) {
+    size <<= 1;
+  }
+  sink->events = malloc(sizeof(struct input_event) * size);
+  if (!sink->events) {
+    return -1;
+  }
+  sink->mask = size - 1;
+  sink->write = write_memory;
+  sink->close = close_memory;
+  return 0;
+}
+
+/**
+ * Event written to a memory sink, counting from 0 when the sink was set up.
+ * Returns NULL if the event was not written yet or was overwritten.
+ */
+const struct input_event *output_sink_event(const output_sink_t *sink,
+                                            uint64_t idx) {
+  if (!sink->events || idx >= sink->written ||
+      sink->written - idx > (uint64_t)sink->mask + 1) {
+    return NULL;
+  }
+  return &sink->events[idx & sink->mask];
+}
+
+static void close_file(output_sink_t *sink) { close(sink->fd); }
+
+/**
+ * Sink that writes the raw input_event stream to a file, which is replaced if
+ * it exists. The path can also be a FIFO read by another program.
+ * Returns 0 on success, otherwise errno.
+ */
+int output_sink_file(output_sink_t *sink, const char *path) {
+  sink_init(sink, "file");
+  const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return errno;
+  }
+  sink->fd = fd;
+  sink->write = write_fd;
+  sink->close = close_file;
+  return 0;
+}
+
+void output_sink_close(output_sink_t *sink) {
+  if (sink->close) {
+    sink->close(sink);
+  }
+  sink->write = NULL;
+  sink->close = NULL;
+  sink->fd = -1;
+}
@@ -0,0 +1,50 @@
+/**
+ * Where the driver writes its input events. The uinput sink moves the
+ * pointer. The other sinks let the whole path run without /dev/uinput or
+ * root, for tests, benchmarks and replays.
+ */
+
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <stdint.h>
+
+#include <linux/input.h>
+
+/* Events kept by a memory sink when no capacity is given, a power of two */
+#define OUTPUT_SINK_MEMORY_DEFAULT 4096
+
+typedef struct output_sink output_sink_t;
+
+/**
+ * A sink is a write function and the state it needs. Sinks are set up by one
+ * of the output_sink_* functions and released with output_sink_close.
+ */
+struct output_sink {
+  int (*write)(output_sink_t *, const struct input_event *, int);
+  void (*close)(output_sink_t *);
+  const char *name;
+  int fd;                     /* uinput device or file, -1 if unused */
+  struct input_event *events; /* Memory sink ring */
+  uint32_t mask;              /* Events in the ring - 1 */
+  uint64_t written;           /* Events written since the sink was set up */
+};
+
+int output_sink_uinput(output_sink_t *, uint16_t, uint16_t);
+void output_sink_null(output_sink_t *);
+int output_sink_memory(output_sink_t *, uint32_t);
+int output_sink_file(output_sink_t *, const char *);
+void output_sink_close(output_sink_t *);
+const struct input_event *output_sink_event(const output_sink_t *, uint64_t);
+
+/**
+ * Write one frame of events to the sink.
+ * Returns 0 on success, otherwise errno.
+ */
+static inline int output_sink_write(output_sink_t *sink,
+                                    const struct input_event *events,
+                                    int count) {
+  return sink->write(sink, events, count);
+}
+
+#endif
@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "realtime.h"
+
+// ASan replaces mlockall with a stub that succeeds without locking anything.
+#if defined(__SANITIZE_ADDRESS__)
+#define REALTIME_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define REALTIME_ASAN 1
+#endif
+#endif
+
+/**
+ * Give the calling thread SCHED_FIFO priority and pin it to a CPU. A priority
+ * of 0 leaves the scheduling policy alone and a cpu below 0 leaves the
+ * affinity alone.
+ * Returns 0 on success, otherwise the error from pthread.
+ */
+int realtime_setup_thread(int priority, int cpu) {
+  const pthread_t self = pthread_self();
+  int err;
+  if (priority > 0) {
+    const struct sched_param param = {.sched_priority = priority};
+    if ((err = pthread_setschedparam(self, SCHED_FIFO, &param)) != 0) {
+      return err;
+    }
+  }
+  if (cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((err = pthread_setaffinity_np(self, sizeof(set), &set)) != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Lock every current and future page of the process in memory, then touch
+ * the stack of the calling thread so it is mapped before it is needed.
+ * Returns 0 on success, EOPNOTSUPP in a build with address sanitizer,
+ * otherwise errno from mlockall.
+ */
+int realtime_lock_memory(void) {
+#if defined(REALTIME_ASAN)
+  return EOPNOTSUPP;
+#else
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    return errno;
+  }
+  realtime_prefault_stack();
+  return 0;
+#endif
+}
+
+/**
+ * Touch REALTIME_STACK_PREFAULT bytes of the calling thread's stack. Each
+ * thread has its own stack, so every thread that should not fault calls this.
+ */
+__attribute__((noinline)) void realtime_prefault_stack(void) {
+  volatile unsigned char stack[REALTIME_STACK_PREFAULT];
+  const long page = sysconf(_SC_PAGESIZE);
+  for (size_t idx = 0; idx < sizeof(stack); idx += page) {
+    stack[idx] = 0;
+  }
+}
+
+/**
+ * Hint to the CPU that this is a busy-wait loop.
+ */
+void realtime_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ volatile("yield");
+#endif
+}
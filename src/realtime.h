@@ -0,0 +1,17 @@
+/**
+ * Scheduling and memory settings that keep the driver threads from being
+ * delayed by other work or by page faults.
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+/* Bytes of stack touched by realtime_prefault_stack */
+#define REALTIME_STACK_PREFAULT (256 * 1024)
+
+int realtime_setup_thread(int, int);
+int realtime_lock_memory(void);
+void realtime_prefault_stack(void);
+void realtime_cpu_relax(void);
+
+#endif
@@ -0,0 +1,379 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "report_layout.h"
+
+/* HID item types and tags, from the Device Class Definition for HID 1.11 */
+#define HID_TYPE_MAIN 0
+#define HID_TYPE_GLOBAL 1
+#define HID_TYPE_LOCAL 2
+#define HID_LONG_ITEM 0xFE
+
+#define HID_MAIN_INPUT 0x8
+#define HID_GLOBAL_USAGE_PAGE 0x0
+#define HID_GLOBAL_LOGICAL_MIN 0x1
+#define HID_GLOBAL_REPORT_SIZE 0x7
+#define HID_GLOBAL_REPORT_ID 0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH 0xA
+#define HID_GLOBAL_POP 0xB
+#define HID_LOCAL_USAGE 0x0
+#define HID_LOCAL_USAGE_MIN 0x1
+#define HID_LOCAL_USAGE_MAX 0x2
+
+#define HID_INPUT_CONSTANT 0x1
+#define HID_INPUT_VARIABLE 0x2
+
+/* Usages with their page in the top 16 bits */
+#define HID_PAGE_BUTTON 0x0009
+#define HID_USAGE_X 0x00010030
+#define HID_USAGE_Y 0x00010031
+#define HID_USAGE_WHEEL 0x00010038
+#define HID_USAGE_AC_PAN 0x000C0238
+
+/* Limits of the parser */
+#define HID_MAX_USAGES 32
+#define HID_STACK_DEPTH 4
+#define HID_REPORT_IDS 256
+
+/**
+ * Fill in the layout for reports with the buttons in the first byte followed
+ * by X and Y deltas of the given width and an 8 bit wheel:
+ *   - 8 bits: boot protocol, X in byte 1, Y in byte 2 and the wheel in byte 3
+ *   - 12 bits: X and Y packed into bytes 1 to 3, the wheel in byte 4
+ *   - 16 bits: little endian X in bytes 1-2 and Y in bytes 3-4, the wheel in
+ *     byte 5
+ * Returns 0 on success, -1 if there is no preset for the width.
+ */
+int report_layout_preset(report_layout_t *layout, int delta_bits) {
+  if (delta_bits != 8 && delta_bits != 12 && delta_bits != 16) {
+    return -1;
+  }
+  const report_field_t buttons = {.offset = 0, .bits = 8, .is_signed = false};
+  const report_field_t x = {.offset = 8, .bits = delta_bits, .is_signed = true};
+  const report_field_t y = {
+      .offset = 8 + delta_bits, .bits = delta_bits, .is_signed = true};
+  const report_field_t wheel = {
+      .offset = 8 + 2 * delta_bits, .bits = 8, .is_signed = true};
+  const report_field_t none = {.offset = 0, .bits = 0, .is_signed = false};
+  layout->buttons = buttons;
+  layout->x = x;
+  layout->y = y;
+  layout->wheel = wheel;
+  layout->hwheel = none;
+  layout->report_id = 0;
+  return 0;
+}
+
+typedef struct hid_globals {
+  uint32_t usage_page;
+  int32_t logical_min;
+  uint32_t report_size;
+  uint32_t report_count;
+  uint8_t report_id;
+} hid_globals_t;
+
+/**
+ * Fields of the layout in the order they are stored while parsing.
+ */
+enum { FIELD_BUTTONS, FIELD_X, FIELD_Y, FIELD_WHEEL, FIELD_HWHEEL, FIELDS };
+
+typedef struct hid_parser {
+  hid_globals_t globals;
+  hid_globals_t stack[HID_STACK_DEPTH];
+  int depth;
+  uint32_t usages[HID_MAX_USAGES];
+  int usage_count;
+  uint32_t usage_min;
+  uint32_t usage_max;
+  bool has_usage_range;
+  uint32_t offsets[HID_REPORT_IDS]; /* Bits read so far in each report */
+  bool uses_report_ids;
+  report_field_t fields[FIELDS];
+  uint8_t field_ids[FIELDS]; /* Report each field was found in */
+  bool found[FIELDS];
+} hid_parser_t;
+
+static uint32_t item_unsigned(const unsigned char *data, int size) {
+  uint32_t value = 0;
+  for (int idx = size - 1; idx >= 0; --idx) {
+    value = value << 8 | data[idx];
+  }
+  return value;
+}
+
+static int32_t item_signed(const unsigned char *data, int size) {
+  const uint32_t value = item_unsigned(data, size);
+  if (size == 0 || size == 4) {
+    return (int32_t)value;
+  }
+  const int top = 32 - 8 * size;
+  return (int32_t)(value << top) >> top;
+}
+
+/**
+ * Usages shorter than 4 bytes are on the current usage page.
+ */
+static uint32_t full_usage(const hid_parser_t *parser, uint32_t usage,
+                           int size) {
+  return size == 4 ? usage : parser->globals.usage_page << 16 | usage;
+}
+
+static uint32_t nth_usage(const hid_parser_t *parser, uint32_t idx) {
+  if (parser->usage_count > 0) {
+    const int last = parser->usage_count - 1;
+    return parser->usages[idx < (uint32_t)last ? idx : (uint32_t)last];
+  }
+  if (parser->has_usage_range && parser->usage_min + idx <= parser->usage_max) {
+    return parser->usage_min + idx;
+  }
+  return 0;
+}
+
+static void found_field(hid_parser_t *parser, int which, uint32_t offset,
+                        uint32_t bits) {
+  if (parser->found[which] || bits == 0 || bits > 32 || offset > UINT16_MAX) {
+    return;
+  }
+  const report_field_t field = {
+      .offset = offset,
+      .bits = bits,
+      .is_signed = which != FIELD_BUTTONS && parser->globals.logical_min < 0};
+  parser->fields[which] = field;
+  parser->field_ids[which] = parser->globals.report_id;
+  parser->found[which] = true;
+}
+
+/**
+ * Record the mouse fields of an Input item and move past its bits.
+ */
+static void parse_input(hid_parser_t *parser, uint32_t flags) {
+  const hid_globals_t *globals = &parser->globals;
+  uint32_t *offset = &parser->offsets[globals->report_id];
+  const uint32_t size = globals->report_size;
+  const uint32_t count = globals->report_count;
+  if (!(flags & HID_INPUT_CONSTANT) && (flags & HID_INPUT_VARIABLE)) {
+    for (uint32_t idx = 0; idx < count; ++idx) {
+      const uint32_t usage = nth_usage(parser, idx);
+      const uint32_t at = *offset + idx * size;
+      if (usage >> 16 == HID_PAGE_BUTTON) {
+        // buttons 1 and up are one bit each, so they read as a bitmask.
+        if ((usage & 0xFFFF) == 1 && size == 1) {
+          const uint32_t buttons = count - idx;
+          found_field(parser, FIELD_BUTTONS, at, buttons < 32 ? buttons : 32);
+        }
+      } else if (usage == HID_USAGE_X) {
+        found_field(parser, FIELD_X, at, size);
+      } else if (usage == HID_USAGE_Y) {
+        found_field(parser, FIELD_Y, at, size);
+      } else if (usage == HID_USAGE_WHEEL) {
+        found_field(parser, FIELD_WHEEL, at, size);
+      } else if (usage == HID_USAGE_AC_PAN) {
+        found_field(parser, FIELD_HWHEEL, at, size);
+      }
+    }
+  }
+  *offset += size * count;
+}
+
+static void parse_global(hid_parser_t *parser, int tag,
+                         const unsigned char *data, int size) {
+  hid_globals_t *globals = &parser->globals;
+  switch (tag) {
+  case HID_GLOBAL_USAGE_PAGE:
+    globals->usage_page = item_unsigned(data, size);
+    break;
+  case HID_GLOBAL_LOGICAL_MIN:
+    globals->logical_min = item_signed(data, size);
+    break;
+  case HID_GLOBAL_REPORT_SIZE:
+    globals->report_size = item_unsigned(data, size);
+    break;
+  case HID_GLOBAL_REPORT_ID:
+    globals->report_id = item_unsigned(data, size);
+    parser->uses_report_ids = true;
+    break;
+  case HID_GLOBAL_REPORT_COUNT:
+    globals->report_count = item_unsigned(data, size);
+    break;
+  case HID_GLOBAL_PUSH:
+    if (parser->depth < HID_STACK_DEPTH) {
+      parser->stack[parser->depth++] = *globals;
+    }
+    break;
+  case HID_GLOBAL_POP:
+    if (parser->depth > 0) {
+      *globals = parser->stack[--parser->depth];
+    }
+    break;
+  }
+}
+
+static void parse_local(hid_parser_t *parser, int tag,
+                        const unsigned char *data, int size) {
+  const uint32_t usage = full_usage(parser, item_unsigned(data, size), size);
+  switch (tag) {
+  case HID_LOCAL_USAGE:
+    if (parser->usage_count < HID_MAX_USAGES) {
+      parser->usages[parser->usage_count++] = usage;
+    }
+    break;
+  case HID_LOCAL_USAGE_MIN:
+    parser->usage_min = usage;
+    parser->has_usage_range = true;
+    break;
+  case HID_LOCAL_USAGE_MAX:
+    parser->usage_max = usage;
+    parser->has_usage_range = true;
+    break;
+  }
+}
+
+/**
+ * Find the buttons, X, Y, wheel and horizontal wheel (AC Pan) of the mouse in
+ * a HID report descriptor. Every field is taken from the report that holds
+ * X. If the device uses report IDs, offsets include the ID byte.
+ * Returns 0 on success, -1 if the descriptor does not describe X and Y.
+ */
+int report_layout_parse(report_layout_t *layout, const unsigned char *desc,
+                        int len) {
+  hid_parser_t parser;
+  memset(&parser, 0, sizeof(parser));
+  int pos = 0;
+  while (pos < len) {
+    const unsigned char prefix = desc[pos];
+    if (prefix == HID_LONG_ITEM) {
+      // long items are not used by mice. The size is in the next byte.
+      pos += pos + 1 < len ? 3 + desc[pos + 1] : 1;
+      continue;
+    }
+    const int size = (prefix & 0x3) == 3 ? 4 : prefix & 0x3;
+    const int type = (prefix >> 2) & 0x3;
+    const int tag = prefix >> 4;
+    const unsigned char *data = desc + pos + 1;
+    if (pos + 1 + size > len) {
+      break;
+    }
+    pos += 1 + size;
+    if (type == HID_TYPE_MAIN) {
+      if (tag == HID_MAIN_INPUT) {
+        parse_input(&parser, item_unsigned(data, size));
+      }
+      // local items only apply to the next main item.
+      parser.usage_count = 0;
+      parser.has_usage_range = false;
+    } else if (type == HID_TYPE_GLOBAL) {
+      parse_global(&parser, tag, data, size);
+    } else if (type == HID_TYPE_LOCAL) {
+      parse_local(&parser, tag, data, size);
+    }
+  }
+
+  if (!parser.found[FIELD_X] || !parser.found[FIELD_Y] ||
+      parser.field_ids[FIELD_X] != parser.field_ids[FIELD_Y]) {
+    return -1;
+  }
+  const uint8_t report_id = parser.field_ids[FIELD_X];
+  report_field_t *fields[FIELDS] = {&layout->buttons, &layout->x, &layout->y,
+                                    &layout->wheel, &layout->hwheel};
+  for (int which = 0; which < FIELDS; ++which) {
+    report_field_t field = {.offset = 0, .bits = 0, .is_signed = false};
+    if (parser.found[which] && parser.field_ids[which] == report_id) {
+      field = parser.fields[which];
+      field.offset += parser.uses_report_ids ? 8 : 0;
+    }
+    *fields[which] = field;
+  }
+  layout->report_id = parser.uses_report_ids ? report_id : 0;
+  return 0;
+}
+
+/**
+ * Compile a field for reading. Returns 0 on success, -1 if the field does not
+ * fit in REPORT_MAX_SIZE bytes or is wider than 32 bits.
+ */
+static int compile_field(report_read_t *read, const report_field_t *field) {
+  const report_read_t absent = {
+      .first = 0, .count = 0, .left = 0, .right = 0, .is_signed = false};
+  *read = absent;
+  if (field->bits == 0) {
+    return 0;
+  }
+  const int first = field->offset / 8;
+  const int last = (field->offset + field->bits - 1) / 8;
+  if (field->bits > 32 || last >= REPORT_MAX_SIZE) {
+    return -1;
+  }
+  read->first = first;
+  read->count = last - first + 1;
+  read->left = 64 - field->offset % 8 - field->bits;
+  read->right = 64 - field->bits;
+  read->is_signed = field->is_signed;
+  return 0;
+}
+
+/**
+ * Read a little endian field that may start and end anywhere in a byte.
+ * Only the bytes the field covers are read.
+ */
+static inline int32_t read_field(const unsigned char *buf,
+                                 const report_read_t *read) {
+  uint64_t raw = 0;
+  for (int idx = read->count - 1; idx >= 0; --idx) {
+    raw = raw << 8 | buf[read->first + idx];
+  }
+  raw <<= read->left;
+  // the arithmetic shift extends the sign bit for signed fields.
+  if (read->is_signed) {
+    return (int32_t)((int64_t)raw >> read->right);
+  }
+  return (int32_t)(raw >> read->right);
+}
+
+int32_t report_field_read(const unsigned char *buf,
+                          const report_field_t *field) {
+  report_read_t read;
+  if (compile_field(&read, field) != 0) {
+    return 0;
+  }
+  return read_field(buf, &read);
+}
+
+/**
+ * Compile a layout into a plan. Returns 0 on success, -1 if a field can not
+ * be read.
+ */
+int report_plan_compile(report_plan_t *plan, const report_layout_t *layout) {
+  if (compile_field(&plan->buttons, &layout->buttons) != 0 ||
+      compile_field(&plan->x, &layout->x) != 0 ||
+      compile_field(&plan->y, &layout->y) != 0 ||
+      compile_field(&plan->wheel, &layout->wheel) != 0 ||
+      compile_field(&plan->hwheel, &layout->hwheel) != 0) {
+    return -1;
+  }
+  plan->report_id = layout->report_id;
+  return 0;
+}
+
+/**
+ * Decode a report with a compiled plan. The report is copied into a zeroed
+ * buffer first, so fields past the end of a short report read as 0 and every
+ * report is read the same way.
+ * Returns 0 on success, -1 if the report has a different report ID.
+ */
+int report_decode(const report_plan_t *plan, const unsigned char *buf,
+                  int len, mouse_report_t *report) {
+  unsigned char padded[REPORT_MAX_SIZE] = {0};
+  len = len < 0 ? 0 : len > REPORT_MAX_SIZE ? REPORT_MAX_SIZE : len;
+  memcpy(padded, buf, len);
+  if (plan->report_id && padded[0] != plan->report_id) {
+    return -1;
+  }
+  report->buttons = read_field(padded, &plan->buttons);
+  report->x = read_field(padded, &plan->x);
+  report->y = read_field(padded, &plan->y);
+  report->wheel = read_field(padded, &plan->wheel);
+  report->hwheel = read_field(padded, &plan->hwheel);
+  return 0;
+}
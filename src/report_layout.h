@@ -0,0 +1,78 @@
+/**
+ * Where each value sits in a mouse interrupt report.
+ */
+
+#ifndef REPORT_LAYOUT_H
+#define REPORT_LAYOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Largest report that can be decoded */
+#define REPORT_MAX_SIZE 64
+
+/**
+ * A field is absent from the report if bits is 0.
+ */
+typedef struct report_field {
+  uint16_t offset; /* Bit offset from the start of the report */
+  uint8_t bits;    /* Width in bits, at most 32 */
+  bool is_signed;  /* Sign extend the value */
+} report_field_t;
+
+typedef struct report_layout {
+  report_field_t buttons; /* Bitmask of held buttons, bit 0 is button 1 */
+  report_field_t x;
+  report_field_t y;
+  report_field_t wheel;
+  report_field_t hwheel;
+  uint8_t report_id; /* First byte of every mouse report, 0 if unused */
+} report_layout_t;
+
+/**
+ * A field compiled for reading. The bytes it covers are read into a word,
+ * shifted left so the top bit of the field is the top bit of the word, then
+ * shifted back down. An absent field covers no bytes and reads as 0.
+ */
+typedef struct report_read {
+  uint16_t first; /* First byte the field covers */
+  uint8_t count;  /* Bytes the field covers */
+  uint8_t left;
+  uint8_t right;
+  bool is_signed;
+} report_read_t;
+
+/**
+ * A layout compiled so that every report is decoded the same way.
+ */
+typedef struct report_plan {
+  report_read_t buttons;
+  report_read_t x;
+  report_read_t y;
+  report_read_t wheel;
+  report_read_t hwheel;
+  uint8_t report_id;
+} report_plan_t;
+
+/**
+ * The values of one report.
+ */
+typedef struct mouse_report {
+  uint32_t buttons;
+  int32_t x;
+  int32_t y;
+  int32_t wheel;
+  int32_t hwheel;
+} mouse_report_t;
+
+/* Delta width used when none is given */
+#define REPORT_DELTA_BITS_DEFAULT 16
+
+int report_layout_preset(report_layout_t *, int);
+int report_layout_parse(report_layout_t *, const unsigned char *, int);
+int32_t report_field_read(const unsigned char *, const report_field_t *);
+int report_plan_compile(report_plan_t *, const report_layout_t *);
+int report_decode(const report_plan_t *, const unsigned char *, int,
+                  mouse_report_t *);
+
+#endif
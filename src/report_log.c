@@ -0,0 +1,158 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "report_log.h"
+
+/* Bytes of a field in the header: offset, bits and is_signed */
+#define LOG_FIELD_SIZE 4
+/* Bytes of the header: magic, version, ids, report_id and 5 fields */
+#define LOG_HEADER_SIZE (8 + 2 + 2 + 2 + 1 + 5 * LOG_FIELD_SIZE)
+/* Bytes before each report: time and length */
+#define LOG_RECORD_SIZE (8 + 2)
+
+static void put16(unsigned char *out, uint16_t value) {
+  out[0] = value;
+  out[1] = value >> 8;
+}
+
+static uint16_t get16(const unsigned char *in) { return in[0] | in[1] << 8; }
+
+static void put64(unsigned char *out, uint64_t value) {
+  for (int idx = 0; idx < 8; ++idx) {
+    out[idx] = value >> (8 * idx);
+  }
+}
+
+static uint64_t get64(const unsigned char *in) {
+  uint64_t value = 0;
+  for (int idx = 7; idx >= 0; --idx) {
+    value = value << 8 | in[idx];
+  }
+  return value;
+}
+
+static unsigned char *put_field(unsigned char *out,
+                                const report_field_t *field) {
+  put16(out, field->offset);
+  out[2] = field->bits;
+  out[3] = field->is_signed;
+  return out + LOG_FIELD_SIZE;
+}
+
+static const unsigned char *get_field(const unsigned char *in,
+                                      report_field_t *field) {
+  field->offset = get16(in);
+  field->bits = in[2];
+  field->is_signed = in[3];
+  return in + LOG_FIELD_SIZE;
+}
+
+/**
+ * Create the log at path, replacing any file that is there, and write the
+ * header from log's ids and layout.
+ * Returns 0 on success, otherwise errno.
+ */
+int report_log_create(report_log_t *log, const char *path) {
+  log->file = fopen(path, "wb");
+  if (!log->file) {
+    return errno;
+  }
+  unsigned char header[LOG_HEADER_SIZE];
+  memcpy(header, REPORT_LOG_MAGIC, 8);
+  put16(header + 8, REPORT_LOG_VERSION);
+  put16(header + 10, log->vendor_id);
+  put16(header + 12, log->product_id);
+  header[14] = log->layout.report_id;
+  unsigned char *out = header + 15;
+  out = put_field(out, &log->layout.buttons);
+  out = put_field(out, &log->layout.x);
+  out = put_field(out, &log->layout.y);
+  out = put_field(out, &log->layout.wheel);
+  put_field(out, &log->layout.hwheel);
+  if (fwrite(header, sizeof(header), 1, log->file) != 1) {
+    const int err = errno;
+    report_log_close(log);
+    return err;
+  }
+  return 0;
+}
+
+/**
+ * Append one report. Records are buffered, so a report costs a copy and
+ * only every few reports cost a write.
+ * Returns 0 on success, otherwise errno.
+ */
+int report_log_append(report_log_t *log, uint64_t time_ns,
+                      const unsigned char *buf, int len) {
+  unsigned char record[LOG_RECORD_SIZE];
+  put64(record, time_ns);
+  put16(record + 8, len);
+  if (fwrite(record, sizeof(record), 1, log->file) != 1 ||
+      fwrite(buf, 1, len, log->file) != (size_t)len) {
+    return errno;
+  }
+  return 0;
+}
+
+/**
+ * Open the log at path and read its header into log.
+ * Returns 0 on success, EINVAL if the file is not a report log of this
+ * version, otherwise errno.
+ */
+int report_log_open(report_log_t *log, const char *path) {
+  log->file = fopen(path, "rb");
+  if (!log->file) {
+    return errno;
+  }
+  unsigned char header[LOG_HEADER_SIZE];
+  if (fread(header, sizeof(header), 1, log->file) != 1 ||
+      memcmp(header, REPORT_LOG_MAGIC, 8) != 0 ||
+      get16(header + 8) != REPORT_LOG_VERSION) {
+    report_log_close(log);
+    return EINVAL;
+  }
+  log->vendor_id = get16(header + 10);
+  log->product_id = get16(header + 12);
+  log->layout.report_id = header[14];
+  const unsigned char *in = header + 15;
+  in = get_field(in, &log->layout.buttons);
+  in = get_field(in, &log->layout.x);
+  in = get_field(in, &log->layout.y);
+  in = get_field(in, &log->layout.wheel);
+  get_field(in, &log->layout.hwheel);
+  return 0;
+}
+
+/**
+ * Read the next report into buf, which holds REPORT_MAX_SIZE bytes.
+ * Returns 1 if a report was read, 0 at the end of the log and -1 if the log
+ * is cut short or holds a report that is too long.
+ */
+int report_log_next(report_log_t *log, uint64_t *time_ns, unsigned char *buf,
+                    int *len) {
+  unsigned char record[LOG_RECORD_SIZE];
+  const size_t got = fread(record, 1, sizeof(record), log->file);
+  if (got == 0 && feof(log->file)) {
+    return 0;
+  }
+  if (got != sizeof(record)) {
+    return -1;
+  }
+  *time_ns = get64(record);
+  *len = get16(record + 8);
+  if (*len > REPORT_MAX_SIZE ||
+      fread(buf, 1, *len, log->file) != (size_t)*len) {
+    return -1;
+  }
+  return 1;
+}
+
+void report_log_close(report_log_t *log) {
+  if (log->file) {
+    fclose(log->file);
+    log->file = NULL;
+  }
+}
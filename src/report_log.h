@@ -0,0 +1,35 @@
+/**
+ * Binary log of raw interrupt reports, so a session can be replayed without
+ * the mouse. The header holds the device ids and report layout, followed by
+ * one record per report:
+ *   - time the report arrived, CLOCK_MONOTONIC ns, 8 bytes
+ *   - report length, 2 bytes
+ *   - the report
+ * Every value is little endian.
+ */
+
+#ifndef REPORT_LOG_H
+#define REPORT_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "report_layout.h"
+
+#define REPORT_LOG_MAGIC "MARLEYRL"
+#define REPORT_LOG_VERSION 1
+
+typedef struct report_log {
+  FILE *file;
+  uint16_t vendor_id;  /* Mouse the reports came from */
+  uint16_t product_id;
+  report_layout_t layout;
+} report_log_t;
+
+int report_log_create(report_log_t *, const char *);
+int report_log_append(report_log_t *, uint64_t, const unsigned char *, int);
+int report_log_open(report_log_t *, const char *);
+int report_log_next(report_log_t *, uint64_t *, unsigned char *, int *);
+void report_log_close(report_log_t *);
+
+#endif
@@ -0,0 +1,131 @@
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "report_ring.h"
+
+static void futex_wait(_Atomic uint32_t *word, uint32_t expected) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Wake the consumer if it is sleeping. The fence orders the caller's store
+ * to head or closed before the load of sleeping, so either the consumer sees
+ * the store before it sleeps or the producer sees that it is sleeping.
+ */
+static void wake_consumer(report_ring_t *ring) {
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&ring->sleeping, memory_order_relaxed)) {
+    atomic_fetch_add_explicit(&ring->wake, 1, memory_order_relaxed);
+    futex_wake(&ring->wake);
+  }
+}
+
+/**
+ * Set up an empty ring with size slots. size is rounded up to a power of two.
+ * Returns 0 on success, -1 if the slots could not be allocated.
+ */
+int report_ring_init(report_ring_t *ring, uint32_t size) {
+  uint32_t slots = 1;
+  while (slots < size) {
+    slots <<= 1;
+  }
+  // aligned_alloc needs a size that is a multiple of the alignment.
+  const size_t bytes = sizeof(report_slot_t) * slots;
+  const size_t line = REPORT_RING_CACHE_LINE;
+  ring->slots = aligned_alloc(line, (bytes + line - 1) / line * line);
+  if (!ring->slots) {
+    return -1;
+  }
+  ring->mask = slots - 1;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->wake, 0);
+  atomic_init(&ring->sleeping, 0);
+  atomic_init(&ring->closed, false);
+  return 0;
+}
+
+void report_ring_free(report_ring_t *ring) {
+  free(ring->slots);
+  ring->slots = NULL;
+}
+
+/**
+ * Copy a report into the ring. Only called by the producer.
+ * Returns false if the ring is full or the report does not fit in a slot.
+ */
+bool report_ring_push(report_ring_t *ring, const unsigned char *buf, int len,
+                      uint64_t arrived_ns) {
+  const uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail > ring->mask || len < 0 || len > REPORT_SLOT_SIZE) {
+    return false;
+  }
+  report_slot_t *slot = &ring->slots[head & ring->mask];
+  slot->arrived_ns = arrived_ns;
+  slot->len = len;
+  memcpy(slot->data, buf, len);
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  wake_consumer(ring);
+  return true;
+}
+
+/**
+ * The oldest report in the ring, or NULL if it is empty. The slot stays
+ * valid until report_ring_release. Only called by the consumer.
+ */
+const report_slot_t *report_ring_peek(report_ring_t *ring) {
+  const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail) {
+    return NULL;
+  }
+  return &ring->slots[tail & ring->mask];
+}
+
+/**
+ * Give the slot returned by report_ring_peek back to the producer.
+ */
+void report_ring_release(report_ring_t *ring) {
+  const uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * Sleep until the ring is not empty or it is closed. May return early, so
+ * the caller should check the ring again. Only called by the consumer.
+ */
+void report_ring_wait(report_ring_t *ring) {
+  const uint32_t wake = atomic_load(&ring->wake);
+  atomic_store(&ring->sleeping, 1);
+  const bool empty = atomic_load(&ring->head) ==
+                     atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (empty && !atomic_load(&ring->closed)) {
+    futex_wait(&ring->wake, wake);
+  }
+  atomic_store_explicit(&ring->sleeping, 0, memory_order_relaxed);
+}
+
+/**
+ * Tell the consumer that nothing more will be pushed.
+ */
+void report_ring_close(report_ring_t *ring) {
+  atomic_store(&ring->closed, true);
+  wake_consumer(ring);
+}
+
+bool report_ring_closed(report_ring_t *ring) {
+  return atomic_load_explicit(&ring->closed, memory_order_acquire);
+}
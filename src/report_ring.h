@@ -0,0 +1,50 @@
+/**
+ * Lock-free single-producer/single-consumer ring of raw reports, used to hand
+ * reports from the USB reader thread to the thread that writes to uinput.
+ */
+
+#ifndef REPORT_RING_H
+#define REPORT_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Largest report a slot holds. Full speed interrupt packets are at most 64 */
+#define REPORT_SLOT_SIZE 64
+/* Slots in the ring, a power of two */
+#define REPORT_RING_DEFAULT_SIZE 256
+/* Keep the producer and consumer indices on separate cache lines */
+#define REPORT_RING_CACHE_LINE 64
+
+typedef struct report_slot {
+  uint64_t arrived_ns; /* When the report arrived, for telemetry */
+  uint16_t len;
+  unsigned char data[REPORT_SLOT_SIZE];
+} report_slot_t;
+
+/**
+ * head is only written by the producer and tail only by the consumer. The
+ * consumer sleeps on the wake futex when the ring is empty, and the producer
+ * only makes the wake syscall if the consumer said it is sleeping.
+ */
+typedef struct report_ring {
+  report_slot_t *slots;
+  uint32_t mask; /* Number of slots - 1 */
+  _Alignas(REPORT_RING_CACHE_LINE) _Atomic uint32_t head;
+  _Alignas(REPORT_RING_CACHE_LINE) _Atomic uint32_t tail;
+  _Alignas(REPORT_RING_CACHE_LINE) _Atomic uint32_t wake;
+  _Atomic uint32_t sleeping;
+  _Atomic bool closed;
+} report_ring_t;
+
+int report_ring_init(report_ring_t *, uint32_t);
+void report_ring_free(report_ring_t *);
+bool report_ring_push(report_ring_t *, const unsigned char *, int, uint64_t);
+const report_slot_t *report_ring_peek(report_ring_t *);
+void report_ring_release(report_ring_t *);
+void report_ring_wait(report_ring_t *);
+void report_ring_close(report_ring_t *);
+bool report_ring_closed(report_ring_t *);
+
+#endif
@@ -0,0 +1,94 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sweep_grid.h"
+
+/**
+ * Parse a number that must be followed by sep.
+ * Returns 0 on success and moves pos past sep, otherwise -1.
+ */
+static int parse_value(const char **pos, char sep, double *value) {
+  char *end;
+  *value = strtod(*pos, &end);
+  if (end == *pos || *end != sep) {
+    return -1;
+  }
+  *pos = sep ? end + 1 : end;
+  return 0;
+}
+
+/**
+ * Parse key=a,b,c or key=start:stop:step into axis. Every separator is
+ * checked, since the sweep is built with -ffast-math and can't rely on NaN
+ * to mark a missing number.
+ * Returns 0 on success, otherwise -1.
+ */
+int sweep_axis_parse(const char *arg, sweep_axis_t *axis) {
+  const char *eq = strchr(arg, '=');
+  if (!eq || eq == arg || eq - arg >= SWEEP_KEY_LENGTH) {
+    return -1;
+  }
+  memcpy(axis->key, arg, eq - arg);
+  axis->key[eq - arg] = '\0';
+  axis->count = 0;
+
+  const char *pos = eq + 1;
+  if (strchr(pos, ':')) {
+    double start, stop, step;
+    if (parse_value(&pos, ':', &start) != 0 ||
+        parse_value(&pos, ':', &stop) != 0 ||
+        parse_value(&pos, '\0', &step) != 0 || step <= 0 || stop < start) {
+      return -1;
+    }
+    // the half step keeps stop in the sweep despite rounding.
+    const double steps = floor((stop - start) / step + 0.5);
+    if (steps >= SWEEP_MAX_VALUES) {
+      return -1;
+    }
+    for (int idx = 0; idx <= steps; ++idx) {
+      axis->values[axis->count++] = start + idx * step;
+    }
+    return 0;
+  }
+  for (;;) {
+    if (axis->count == SWEEP_MAX_VALUES) {
+      return -1;
+    }
+    double *value = &axis->values[axis->count++];
+    if (parse_value(&pos, ',', value) == 0) {
+      continue;
+    }
+    return parse_value(&pos, '\0', value);
+  }
+}
+
+/**
+ * Value of each axis in combination candidate.
+ */
+void sweep_candidate_values(const sweep_axis_t *axes, int axis_count,
+                            uint64_t candidate, double *values) {
+  for (int axis = axis_count - 1; axis >= 0; --axis) {
+    values[axis] = axes[axis].values[candidate % axes[axis].count];
+    candidate /= axes[axis].count;
+  }
+}
+
+/**
+ * Config text setting the values of combination candidate, one key=value
+ * line per axis.
+ */
+void sweep_candidate_text(const sweep_axis_t *axes, int axis_count,
+                          uint64_t candidate, char *text, size_t size) {
+  double values[SWEEP_MAX_KEYS];
+  sweep_candidate_values(axes, axis_count, candidate, values);
+  size_t len = 0;
+  text[0] = '\0';
+  for (int axis = 0; axis < axis_count && len < size; ++axis) {
+    len += snprintf(text + len, size - len, "%.*s=%.17g\n",
+                    SWEEP_KEY_LENGTH - 1, axes[axis].key, values[axis]);
+  }
+}
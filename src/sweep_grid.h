@@ -0,0 +1,38 @@
+/**
+ * Grids of settings for the offline sweep. Each axis is one config setting
+ * and the values it takes. Combinations are numbered like the digits of a
+ * mixed radix number, with the last axis changing fastest.
+ */
+
+#ifndef SWEEP_GRID_H
+#define SWEEP_GRID_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Settings that can be swept at once */
+#define SWEEP_MAX_KEYS 8
+/* Values of one setting */
+#define SWEEP_MAX_VALUES 1024
+/* Longest setting name, including the terminating NUL */
+#define SWEEP_KEY_LENGTH 32
+/* Room for the =, value and newline after a key in config text */
+#define SWEEP_VALUE_LENGTH 32
+/* Room for the config text of one combination */
+#define SWEEP_TEXT_SIZE                                                        \
+  (SWEEP_MAX_KEYS * (SWEEP_KEY_LENGTH + SWEEP_VALUE_LENGTH))
+
+/**
+ * One setting and the values it is swept over.
+ */
+typedef struct sweep_axis {
+  char key[SWEEP_KEY_LENGTH];
+  double values[SWEEP_MAX_VALUES];
+  int count;
+} sweep_axis_t;
+
+int sweep_axis_parse(const char *, sweep_axis_t *);
+void sweep_candidate_values(const sweep_axis_t *, int, uint64_t, double *);
+void sweep_candidate_text(const sweep_axis_t *, int, uint64_t, char *, size_t);
+
+#endif
@@ -0,0 +1,98 @@
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "telemetry.h"
+
+void hist_clear(hist_t *hist) { memset(hist, 0, sizeof(hist_t)); }
+
+/**
+ * Largest value that falls in a bucket.
+ */
+uint64_t hist_bucket_max(int bucket) {
+  if (bucket < HIST_SUB_COUNT) {
+    return bucket;
+  }
+  const int shift = (bucket >> HIST_SUB_BITS) - 1;
+  const uint64_t sub = bucket & (HIST_SUB_COUNT - 1);
+  const uint64_t low = (HIST_SUB_COUNT + sub) << shift;
+  return low + (((uint64_t)1 << shift) - 1);
+}
+
+/**
+ * Smallest value that at least pct percent of the recorded values are at or
+ * below. Values are only known to the bucket they fell in, so this is the
+ * top of that bucket, never less than the real percentile.
+ * Returns 0 if nothing was recorded.
+ */
+uint64_t hist_percentile(const hist_t *hist, double pct) {
+  if (hist->total == 0) {
+    return 0;
+  }
+  uint64_t rank = ceil(pct / 100 * hist->total);
+  rank = rank < 1 ? 1 : rank > hist->total ? hist->total : rank;
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < HIST_BUCKETS; ++bucket) {
+    seen += hist->counts[bucket];
+    if (seen >= rank) {
+      const uint64_t top = hist_bucket_max(bucket);
+      return top < hist->max ? top : hist->max;
+    }
+  }
+  return hist->max;
+}
+
+uint64_t telemetry_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void telemetry_init(telemetry_t *telemetry) {
+  for (int stage = 0; stage < TELEMETRY_STAGES; ++stage) {
+    hist_clear(&telemetry->latency[stage]);
+  }
+  telemetry->reports = 0;
+  telemetry->saturated = 0;
+  telemetry->clipped = 0;
+  telemetry->bounded = 0;
+  telemetry->start_ns = telemetry_now_ns();
+}
+
+/**
+ * Record the times a report arrived, was turned into events and was written.
+ * Times that go backwards are counted as 0, which can happen when an event
+ * device stamps a report after the driver read its clock.
+ */
+void telemetry_record(telemetry_t *telemetry, uint64_t arrived_ns,
+                      uint64_t mapped_ns, uint64_t written_ns) {
+  hist_record(&telemetry->latency[TELEMETRY_ACCEL],
+              mapped_ns > arrived_ns ? mapped_ns - arrived_ns : 0);
+  hist_record(&telemetry->latency[TELEMETRY_WRITE],
+              written_ns > arrived_ns ? written_ns - arrived_ns : 0);
+  telemetry->reports++;
+}
+
+void telemetry_print(const telemetry_t *telemetry, FILE *out) {
+  static const char *const names[] = {[TELEMETRY_ACCEL] = "accel",
+                                      [TELEMETRY_WRITE] = "write"};
+  const double seconds =
+      (telemetry_now_ns() - telemetry->start_ns) / 1000000000.0;
+  fprintf(out, "  > reports=%" PRIu64 " (%.1f/s)\n", telemetry->reports,
+          seconds > 0 ? telemetry->reports / seconds : 0);
+  fprintf(out,
+          "  > saturated=%" PRIu64 " clipped=%" PRIu64 " bounded=%" PRIu64
+          "\n",
+          telemetry->saturated, telemetry->clipped, telemetry->bounded);
+  fprintf(out, "  > latency (us)       p50       p99     p99.9       max\n");
+  for (int stage = 0; stage < TELEMETRY_STAGES; ++stage) {
+    const hist_t *hist = &telemetry->latency[stage];
+    fprintf(out, "  > %-12s %9.1f %9.1f %9.1f %9.1f\n", names[stage],
+            hist_percentile(hist, 50) / 1000.0,
+            hist_percentile(hist, 99) / 1000.0,
+            hist_percentile(hist, 99.9) / 1000.0, hist->max / 1000.0);
+  }
+}
@@ -0,0 +1,75 @@
+/**
+ * Latency histograms and counters kept by the driver for each mouse. Memory
+ * is fixed when the telemetry is set up, so recording never allocates.
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Histograms are log-linear, like HdrHistogram. Each power of two is split
+ * into HIST_SUB_COUNT linear buckets, so a value is off by at most
+ * 1 / HIST_SUB_COUNT of itself, over the whole range of uint64_t.
+ */
+#define HIST_SUB_BITS 5
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+typedef struct hist {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total; /* Values recorded */
+  uint64_t max;   /* Largest value recorded, exact */
+} hist_t;
+
+/**
+ * Stages of a report. Each is timed from the moment the report arrived, which
+ * is USB completion or the kernel's timestamp for an event device.
+ */
+typedef enum telemetry_stage {
+  TELEMETRY_ACCEL, /* Report decoded, accelerated and turned into events */
+  TELEMETRY_WRITE, /* Events written to the output sink */
+  TELEMETRY_STAGES
+} telemetry_stage_t;
+
+typedef struct telemetry {
+  hist_t latency[TELEMETRY_STAGES]; /* Nanoseconds since the report arrived */
+  uint64_t reports;   /* Reports recorded */
+  uint64_t saturated; /* Reports with a delta limited to the range of delta_t */
+  uint64_t clipped;   /* Reports with a delta clipped by overflow_lim */
+  uint64_t bounded;   /* Reports with sens clamped to upper_bound */
+  uint64_t start_ns;  /* When telemetry_init was called */
+} telemetry_t;
+
+/**
+ * Bucket that holds value. Values below HIST_SUB_COUNT have a bucket each.
+ * Above that, the bucket is picked by the highest set bit and the
+ * HIST_SUB_BITS bits after it.
+ */
+static inline int hist_bucket(uint64_t value) {
+  if (value < HIST_SUB_COUNT) {
+    return value;
+  }
+  const int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+  return ((shift + 1) << HIST_SUB_BITS) +
+         ((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+static inline void hist_record(hist_t *hist, uint64_t value) {
+  hist->counts[hist_bucket(value)]++;
+  hist->total++;
+  hist->max = value > hist->max ? value : hist->max;
+}
+
+void hist_clear(hist_t *);
+uint64_t hist_bucket_max(int);
+uint64_t hist_percentile(const hist_t *, double);
+
+uint64_t telemetry_now_ns(void);
+void telemetry_init(telemetry_t *);
+void telemetry_record(telemetry_t *, uint64_t, uint64_t, uint64_t);
+void telemetry_print(const telemetry_t *, FILE *);
+
+#endif
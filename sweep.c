@@ -0,0 +1,434 @@
+/*
+ * Offline parameter sweep. Runs every combination of a grid of settings over
+ * the reports of a recorded session (see --record), and prints one CSV line
+ * of metrics per combination, so a profile can be tuned without the mouse.
+ * "make sweep" builds this with the same release flags as the benchmarks.
+ *
+ * The session is decoded once and shared by every thread. Each thread takes
+ * the next combination from an atomic counter, builds its settings with the
+ * config loader and runs the whole session through them. Plans without a
+ * velocity window or fixed point run through accelerate_batch, which uses
+ * the SIMD sens kernels; the others run report by report through the plan,
+ * as the driver does.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/config.h"
+#include "src/mouse_accel.h"
+#include "src/report_layout.h"
+#include "src/report_log.h"
+#include "src/sweep_grid.h"
+
+/* Combinations in one sweep */
+#define SWEEP_MAX_CANDIDATES 10000000
+/* Most threads, whatever -j asks for */
+#define SWEEP_MAX_THREADS 256
+
+/**
+ * Deltas and arrival times of every report in the session.
+ */
+typedef struct session {
+  delta_t *dx;
+  delta_t *dy;
+  uint64_t *time_ns;
+  size_t count;
+} session_t;
+
+/**
+ * What one combination made of the session.
+ */
+typedef struct metrics {
+  double travel;      /* Length of the cursor's path, in counts */
+  double bound_ms;    /* Time sens was clamped to upper_bound */
+  uint64_t clipped;   /* Reports with a delta clipped to overflow_lim */
+  uint64_t saturated; /* Reports with an output limited to delta_t */
+  double path_diff;   /* RMS distance from the reference cursor, in counts */
+  bool failed;        /* The settings could not be built */
+} metrics_t;
+
+typedef struct sweep {
+  const session_t *session;
+  const accel_settings_t *base; /* Settings every combination starts from */
+  const sweep_axis_t *axes;
+  int axis_count;
+  const delta_t *ref_dx; /* The reference's output for each report */
+  const delta_t *ref_dy;
+  metrics_t *results;
+  uint64_t candidates;
+  _Atomic uint64_t next;
+} sweep_t;
+
+static void usage(const char *name) {
+  printf("Usage: %s -r session_log [-c config_file] [-R config_file] "
+         "[-j threads] -s key=values...\n",
+         name);
+  printf("  -r PATH        session recorded with --record\n");
+  printf("  -c PATH        settings every combination starts from\n");
+  printf("  -R PATH        reference for path_diff (default the -c config)\n");
+  printf("  -j N           threads (default one per CPU)\n");
+  printf("  -s KEY=VALUES  sweep a setting over a,b,c or start:stop:step,\n");
+  printf("                 at most %d times\n", SWEEP_MAX_KEYS);
+}
+
+/**
+ * Decode every report of the log at path.
+ * Returns 0 on success, -1 if the log is damaged, otherwise errno.
+ */
+static int session_load(session_t *session, const char *path) {
+  report_log_t log;
+  int err = report_log_open(&log, path);
+  if (err) {
+    return err;
+  }
+  report_plan_t decode;
+  err = report_plan_compile(&decode, &log.layout);
+  if (err) {
+    report_log_close(&log);
+    return err;
+  }
+
+  size_t size = 0;
+  memset(session, 0, sizeof(*session));
+  unsigned char buf[REPORT_MAX_SIZE];
+  uint64_t time_ns;
+  int len;
+  int got;
+  while ((got = report_log_next(&log, &time_ns, buf, &len)) == 1) {
+    mouse_report_t report;
+    if (report_decode(&decode, buf, len, &report) != 0) {
+      continue;
+    }
+    if (session->count == size) {
+      size = size ? size * 2 : 4096;
+      delta_t *dx = realloc(session->dx, size * sizeof(delta_t));
+      session->dx = dx ? dx : session->dx;
+      delta_t *dy = realloc(session->dy, size * sizeof(delta_t));
+      session->dy = dy ? dy : session->dy;
+      uint64_t *times = realloc(session->time_ns, size * sizeof(uint64_t));
+      session->time_ns = times ? times : session->time_ns;
+      if (!dx || !dy || !times) {
+        got = -ENOMEM;
+        break;
+      }
+    }
+    session->dx[session->count] = report.x;
+    session->dy[session->count] = report.y;
+    session->time_ns[session->count] = time_ns;
+    ++session->count;
+  }
+  report_log_close(&log);
+  return got == 0 ? 0 : got == -ENOMEM ? ENOMEM : -1;
+}
+
+static void session_free(session_t *session) {
+  free(session->dx);
+  free(session->dy);
+  free(session->time_ns);
+}
+
+/**
+ * Accelerate the whole session with as into dx and dy. If limits is not
+ * NULL, the limits each report ran into are left in it.
+ */
+static void session_run(const session_t *session, accel_settings_t *as,
+                        delta_t *dx, delta_t *dy, unsigned char *limits) {
+  memcpy(dx, session->dx, session->count * sizeof(delta_t));
+  memcpy(dy, session->dy, session->count * sizeof(delta_t));
+  const accel_plan_t *plan = &as->plan;
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  if (plan->window_us == 0 && plan->kernel != ACCEL_KERNEL_FIXED) {
+    accelerate_batch(dx, dy, session->count, as, &state);
+    // without a window the limits only depend on the report's own deltas.
+    for (size_t idx = 0; limits && idx < session->count; ++idx) {
+      limits[idx] =
+          accel_plan_limits(plan, &state, session->dx[idx], session->dy[idx]);
+    }
+    return;
+  }
+  for (size_t idx = 0; idx < session->count; ++idx) {
+    state.time_us = session->time_ns[idx] / 1000;
+    accel_plan_run(plan, &state, &dx[idx], &dy[idx]);
+    if (limits) {
+      limits[idx] =
+          accel_plan_limits(plan, &state, session->dx[idx], session->dy[idx]);
+    }
+  }
+}
+
+/**
+ * Measure what a plan made of the session, given its output and the limits
+ * it ran into.
+ */
+static void measure(const sweep_t *sweep, const delta_t *dx,
+                    const delta_t *dy, const unsigned char *limits,
+                    metrics_t *metrics) {
+  const session_t *session = sweep->session;
+  double x = 0, y = 0, ref_x = 0, ref_y = 0, diff_sq = 0;
+  uint64_t bound_ns = 0;
+  for (size_t idx = 0; idx < session->count; ++idx) {
+    metrics->travel += hypot(dx[idx], dy[idx]);
+    // a report accounts for the time since the one before it.
+    if ((limits[idx] & ACCEL_LIMIT_BOUND) && idx > 0) {
+      bound_ns += session->time_ns[idx] - session->time_ns[idx - 1];
+    }
+    metrics->clipped += (limits[idx] & ACCEL_LIMIT_CLIP) != 0;
+    metrics->saturated += dx[idx] == DELTA_MIN || dx[idx] == DELTA_MAX ||
+                          dy[idx] == DELTA_MIN || dy[idx] == DELTA_MAX;
+    x += dx[idx];
+    y += dy[idx];
+    ref_x += sweep->ref_dx[idx];
+    ref_y += sweep->ref_dy[idx];
+    diff_sq += (x - ref_x) * (x - ref_x) + (y - ref_y) * (y - ref_y);
+  }
+  metrics->bound_ms = bound_ns / 1e6;
+  metrics->path_diff =
+      session->count ? sqrt(diff_sq / session->count) : 0;
+}
+
+/**
+ * True if every axis names a setting the config loader knows.
+ */
+static bool axes_valid(const sweep_axis_t *axes, int axis_count,
+                       const accel_settings_t *base) {
+  for (int axis = 0; axis < axis_count; ++axis) {
+    char text[SWEEP_KEY_LENGTH + SWEEP_VALUE_LENGTH];
+    snprintf(text, sizeof(text), "%.*s=%.17g\n", SWEEP_KEY_LENGTH - 1,
+             axes[axis].key, axes[axis].values[0]);
+    config_profile_t profile;
+    profile.settings = *base;
+    int profiles, line;
+    if (parse_config(text, &profile, 1, &profiles, &line) != 0) {
+      fprintf(stderr, "Unknown setting or bad value: %s", text);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void *sweep_worker(void *arg) {
+  sweep_t *sweep = arg;
+  const size_t count = sweep->session->count;
+  delta_t *dx = malloc((count ? count : 1) * sizeof(delta_t));
+  delta_t *dy = malloc((count ? count : 1) * sizeof(delta_t));
+  unsigned char *limits = malloc(count ? count : 1);
+  // the combination is a section, so it starts from the base settings
+  // without sharing their tables.
+  static const char header[] = "[candidate]\n";
+  char text[sizeof(header) + SWEEP_TEXT_SIZE];
+  memcpy(text, header, sizeof(header));
+  char *values = text + sizeof(header) - 1;
+  uint64_t candidate;
+  while ((candidate = atomic_fetch_add(&sweep->next, 1)) < sweep->candidates) {
+    metrics_t *metrics = &sweep->results[candidate];
+    if (!dx || !dy || !limits) {
+      metrics->failed = true;
+      continue;
+    }
+    config_profile_t profiles[2];
+    profiles[0].settings = *sweep->base;
+    accel_settings_t *as = &profiles[1].settings;
+    sweep_candidate_text(sweep->axes, sweep->axis_count, candidate, values,
+                         SWEEP_TEXT_SIZE);
+    int count, line;
+    if (parse_config(text, profiles, 2, &count, &line) != 0) {
+      metrics->failed = true;
+      continue;
+    }
+    if (build_config(as) != 0) {
+      metrics->failed = true;
+      free_config(as);
+      continue;
+    }
+    session_run(sweep->session, as, dx, dy, limits);
+    measure(sweep, dx, dy, limits, metrics);
+    free_config(as);
+  }
+  free(dx);
+  free(dy);
+  free(limits);
+  return NULL;
+}
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  static sweep_axis_t axes[SWEEP_MAX_KEYS];
+  int axis_count = 0;
+  const char *log_path = NULL;
+  const char *config_path = NULL;
+  const char *ref_path = NULL;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  int opt;
+  while ((opt = getopt(argc, argv, "r:c:R:j:s:h")) != -1) {
+    switch (opt) {
+    case 'r':
+      log_path = optarg;
+      break;
+    case 'c':
+      config_path = optarg;
+      break;
+    case 'R':
+      ref_path = optarg;
+      break;
+    case 'j':
+      threads = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      if (axis_count == SWEEP_MAX_KEYS ||
+          sweep_axis_parse(optarg, &axes[axis_count]) != 0) {
+        fprintf(stderr, "Bad sweep: %s\n", optarg);
+        return 1;
+      }
+      ++axis_count;
+      break;
+    case 'h':
+      usage(argv[0]);
+      return 0;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!log_path || axis_count == 0 || threads <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  threads = threads < SWEEP_MAX_THREADS ? threads : SWEEP_MAX_THREADS;
+
+  uint64_t candidates = 1;
+  for (int axis = 0; axis < axis_count; ++axis) {
+    candidates *= axes[axis].count;
+    if (candidates > SWEEP_MAX_CANDIDATES) {
+      fprintf(stderr, "More than %d combinations.\n", SWEEP_MAX_CANDIDATES);
+      return 1;
+    }
+  }
+
+  session_t session;
+  int err = session_load(&session, log_path);
+  if (err) {
+    fprintf(stderr, "Could not read the session in %s: %s\n", log_path,
+            err < 0 ? "damaged log" : strerror(err));
+    return 1;
+  }
+  accel_settings_t base, ref;
+  default_config(&base);
+  err = config_path ? load_config(&base, config_path) : 0;
+  if (!err) {
+    const char *path = ref_path ? ref_path : config_path;
+    default_config(&ref);
+    err = path ? load_config(&ref, path) : 0;
+    if (err) {
+      free_config(&base);
+    }
+  }
+  if (err) {
+    fprintf(stderr, "Could not load the config.\n");
+    session_free(&session);
+    return 1;
+  }
+
+  if (!axes_valid(axes, axis_count, &base)) {
+    free_config(&ref);
+    free_config(&base);
+    session_free(&session);
+    return 1;
+  }
+
+  const size_t count = session.count ? session.count : 1;
+  delta_t *ref_dx = malloc(count * sizeof(delta_t));
+  delta_t *ref_dy = malloc(count * sizeof(delta_t));
+  metrics_t *results = calloc(candidates, sizeof(metrics_t));
+  pthread_t *workers = calloc(threads, sizeof(pthread_t));
+  if (!ref_dx || !ref_dy || !results || !workers) {
+    fprintf(stderr, "Out of memory.\n");
+    free(workers);
+    free(results);
+    free(ref_dx);
+    free(ref_dy);
+    free_config(&ref);
+    free_config(&base);
+    session_free(&session);
+    return 1;
+  }
+  session_run(&session, &ref, ref_dx, ref_dy, NULL);
+
+  sweep_t sweep = {.session = &session,
+                   .base = &base,
+                   .axes = axes,
+                   .axis_count = axis_count,
+                   .ref_dx = ref_dx,
+                   .ref_dy = ref_dy,
+                   .results = results,
+                   .candidates = candidates};
+  atomic_init(&sweep.next, 0);
+  const uint64_t start_ns = now_ns();
+  long started = 0;
+  while (started < threads &&
+         pthread_create(&workers[started], NULL, sweep_worker, &sweep) == 0) {
+    ++started;
+  }
+  if (started == 0) {
+    sweep_worker(&sweep);
+  }
+  for (long idx = 0; idx < started; ++idx) {
+    pthread_join(workers[idx], NULL);
+  }
+  const double seconds = (now_ns() - start_ns) / 1e9;
+
+  printf("candidate");
+  for (int axis = 0; axis < axis_count; ++axis) {
+    printf(",%s", axes[axis].key);
+  }
+  printf(",travel,bound_ms,clipped,saturated,path_diff\n");
+  uint64_t failed = 0;
+  for (uint64_t candidate = 0; candidate < candidates; ++candidate) {
+    const metrics_t *metrics = &results[candidate];
+    if (metrics->failed) {
+      ++failed;
+      continue;
+    }
+    printf("%" PRIu64, candidate);
+    double values[SWEEP_MAX_KEYS];
+    sweep_candidate_values(axes, axis_count, candidate, values);
+    for (int axis = 0; axis < axis_count; ++axis) {
+      printf(",%g", values[axis]);
+    }
+    printf(",%.1f,%.3f,%" PRIu64 ",%" PRIu64 ",%.3f\n", metrics->travel,
+           metrics->bound_ms, metrics->clipped, metrics->saturated,
+           metrics->path_diff);
+  }
+  fprintf(stderr,
+          "%" PRIu64 " combinations of %zu reports on %ld threads (%s) "
+          "in %.2f s, %" PRIu64 " failed.\n",
+          candidates, session.count, started ? started : 1, accel_simd_name(),
+          seconds, failed);
+
+  free(workers);
+  free(results);
+  free(ref_dx);
+  free(ref_dy);
+  free_config(&ref);
+  free_config(&base);
+  session_free(&session);
+  return failed == candidates ? 1 : 0;
+}
@@ -5,13 +5,35 @@
  * simplicty and to avoid any requirements for running unit tests.
  */
 
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include <libusb-1.0/libusb.h>
+#include <linux/input-event-codes.h>
+#include <linux/uinput.h>
+
+#include "src/config.h"
+#include "src/hot_reload.h"
+#include "src/live_ring.h"
+#include "src/loading_util.h"
+#include "src/marley_api.h"
 #include "src/marley_map.h"
 #include "src/mouse_accel.h"
+#include "src/mouse_driver.h"
+#include "src/output_sink.h"
+#include "src/report_layout.h"
+#include "src/report_log.h"
+#include "src/report_ring.h"
+#include "src/sweep_grid.h"
+#include "src/telemetry.h"
 
 /* Framework implementation */
 
@@ -56,9 +78,7 @@ accel_settings_t basic = {.accel = quake_accel,
                           .pre_scalar_x = 1.0,
                           .pre_scalar_y = 1.0,
                           .post_scalar_x = 1.0,
-                          .post_scalar_y = 1.0,
-                          .carry_dx = 0,
-                          .carry_dy = 0};
+                          .post_scalar_y = 1.0};
 
 static char *test_quake_accel_no_change() {
   /*
@@ -108,10 +128,11 @@ static char *test_accelerate_small_change() {
   /*
    * With small or no change, deltas should not be affected.
    */
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
   for (delta_t i = 0; i < 4; ++i) {
     delta_t dx = i;
     delta_t dy = 0;
-    accelerate(&dx, &dy, &basic);
+    accelerate(&dx, &dy, &basic, &state);
     create_msg(__func__, "dx != i or dy != 0", "nonzero");
     mu_assert(dst, dx == i && dy == 0);
   }
@@ -122,6 +143,7 @@ static char *test_accelerate_large_change() {
   /*
    * with a large change, deltas should be scaled larger.
    */
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
   for (delta_t i = 110; i < 125; ++i) {
     delta_t dx = i;
     delta_t dy = i - 3;
@@ -131,13 +153,902 @@ static char *test_accelerate_large_change() {
     create_msg(__func__, "accel_value <= base", accel_value_str);
     mu_assert(dst, accel_value > basic.base);
 
-    accelerate(&dx, &dy, &basic);
+    accelerate(&dx, &dy, &basic, &state);
     create_msg(__func__, "dx or dy not scaled", "bad");
     mu_assert(dst, dx > i && dy > i - 3);
   }
   return 0;
 }
 
+/*
+ * Deterministic deltas for comparing the batch and scalar paths.
+ */
+static void fill_deltas(delta_t *dx, delta_t *dy, int n) {
+  unsigned int seed = 12345;
+  for (int i = 0; i < n; ++i) {
+    seed = seed * 1103515245 + 12345;
+    dx[i] = (int)((seed >> 16) % 255) - 127;
+    seed = seed * 1103515245 + 12345;
+    dy[i] = (int)((seed >> 16) % 255) - 127;
+  }
+}
+
+static char *check_batch_matches(accel_settings_t settings) {
+  enum { N = 1000 };
+  delta_t dx[N], dy[N], batch_dx[N], batch_dy[N];
+  fill_deltas(dx, dy, N);
+  memcpy(batch_dx, dx, sizeof(dx));
+  memcpy(batch_dy, dy, sizeof(dy));
+
+  accel_state_t scalar_state = {.carry_dx = 0, .carry_dy = 0};
+  accel_state_t batch_state = {.carry_dx = 0, .carry_dy = 0};
+  for (int i = 0; i < N; ++i) {
+    accelerate(&dx[i], &dy[i], &settings, &scalar_state);
+  }
+  accelerate_batch(batch_dx, batch_dy, N, &settings, &batch_state);
+  for (int i = 0; i < N; ++i) {
+    // rounding differences can move a count between consecutive reports.
+    mu_assert("batch and scalar deltas differ",
+              abs(dx[i] - batch_dx[i]) <= 1 && abs(dy[i] - batch_dy[i]) <= 1);
+  }
+  return 0;
+}
+
+static char *test_accelerate_batch_quake() {
+  accel_settings_t as = basic;
+  as.overflow_lim = 100;
+  as.pre_scalar_y = 0.5;
+  return check_batch_matches(as);
+}
+
+static char *test_accelerate_batch_fractional_power() {
+  accel_settings_t as = basic;
+  as.power = 2.5;
+  as.accel_rate = 0.05;
+  return check_batch_matches(as);
+}
+
+static char *test_accelerate_batch_pow() {
+  accel_settings_t as = basic;
+  as.accel = pow_accel;
+  as.power = 1.5;
+  as.accel_rate = 0.01;
+  return check_batch_matches(as);
+}
+
+static char *check_lut_matches(bool single) {
+  accel_settings_t as = basic;
+  as.overflow_lim = 100;
+  as.lut_size = 1024;
+  as.lut_single = single;
+  mu_assert("lut not built", accel_lut_build(&as) == 0 && as.lut);
+  for (delta_t dx = -127; dx <= 127; dx += 3) {
+    for (delta_t dy = -127; dy <= 127; dy += 5) {
+      const scalar_t expected = quake_accel(dx, dy, &as);
+      const scalar_t actual = accel_lut_sens(as.lut, dx, dy);
+      char actual_str[30];
+      gcvt(actual, 20, actual_str);
+      create_msg(__func__, "lut sens too far from quake_accel", actual_str);
+      mu_assert(dst, fabs(expected - actual) < 1e-3 * expected);
+    }
+  }
+  accel_lut_free(&as);
+  mu_assert("lut not freed", as.lut == NULL);
+  return 0;
+}
+
+static char *test_lut_double() { return check_lut_matches(false); }
+
+static char *test_lut_float() { return check_lut_matches(true); }
+
+static char *test_lut_past_saturation() {
+  /*
+   * The table ends where quake_accel reaches upper_bound, so anything faster
+   * should read the bound.
+   */
+  accel_settings_t as = basic;
+  as.upper_bound = 4;
+  as.lut_size = 64;
+  mu_assert("lut not built", accel_lut_build(&as) == 0 && as.lut);
+  const scalar_t sens = accel_lut_sens(as.lut, 5000, -5000);
+  accel_lut_free(&as);
+  mu_assert("sens past the table is not the upper bound", sens == 4);
+
+  // pow_accel never flattens out, so past the table it is evaluated.
+  accel_settings_t power = basic;
+  power.accel = pow_accel;
+  power.accel_rate = 0.1;
+  power.lut_size = 512;
+  mu_assert("pow lut not built", accel_lut_build(&power) == 0 && power.lut);
+  const scalar_t vels[] = {100, 400, 1000, 5000};
+  for (size_t idx = 0; idx < sizeof(vels) / sizeof(*vels); ++idx) {
+    const scalar_t expected = pow_accel(vels[idx], 0, &power);
+    const scalar_t actual = accel_lut_sens(power.lut, vels[idx], 0);
+    if (fabs(actual - expected) > 1e-3 * expected) {
+      accel_lut_free(&power);
+      mu_assert("pow sens past the table is not the curve", false);
+    }
+  }
+  accel_lut_free(&power);
+  return 0;
+}
+
+static char *check_plan_matches(accel_settings_t settings,
+                                accel_kernel_t kernel) {
+  enum { N = 1000 };
+  delta_t dx[N], dy[N];
+  fill_deltas(dx, dy, N);
+  accel_plan_compile(&settings);
+  mu_assert("plan compiled to the wrong kernel",
+            settings.plan.kernel == kernel);
+
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  accel_state_t reference = {.carry_dx = 0, .carry_dy = 0};
+  for (int i = 0; i < N; ++i) {
+    delta_t plan_dx = dx[i];
+    delta_t plan_dy = dy[i];
+    accelerate(&dx[i], &dy[i], &settings, &reference);
+    accel_plan_run(&settings.plan, &state, &plan_dx, &plan_dy);
+    // folded constants can move a count between consecutive reports.
+    mu_assert("plan and accelerate deltas differ",
+              abs(dx[i] - plan_dx) <= 1 && abs(dy[i] - plan_dy) <= 1);
+  }
+  return 0;
+}
+
+static char *test_plan_quake_linear() {
+  accel_settings_t as = basic;
+  as.overflow_lim = 100;
+  as.game_sens = 2.5;
+  return check_plan_matches(as, ACCEL_KERNEL_QUAKE_LINEAR);
+}
+
+static char *test_plan_quake_int() {
+  accel_settings_t as = basic;
+  as.power = 3;
+  as.accel_rate = 0.1;
+  return check_plan_matches(as, ACCEL_KERNEL_QUAKE_INT);
+}
+
+static char *test_plan_quake() {
+  accel_settings_t as = basic;
+  as.power = 2.5;
+  as.accel_rate = 0.05;
+  return check_plan_matches(as, ACCEL_KERNEL_QUAKE);
+}
+
+static char *test_plan_pow() {
+  accel_settings_t as = basic;
+  as.accel = pow_accel;
+  as.power = 1.5;
+  as.accel_rate = 0.01;
+  return check_plan_matches(as, ACCEL_KERNEL_POW);
+}
+
+static char *test_plan_constant() {
+  accel_settings_t as = basic;
+  as.accel_rate = 0;
+  as.base = 1.5;
+  as.post_scalar_y = 0.5;
+  return check_plan_matches(as, ACCEL_KERNEL_CONSTANT);
+}
+
+static char *test_plan_passthrough() {
+  /*
+   * The identity profile should leave deltas untouched.
+   */
+  accel_settings_t as = basic;
+  as.accel_rate = 0;
+  accel_plan_compile(&as);
+  mu_assert("identity not compiled to passthrough",
+            as.plan.kernel == ACCEL_KERNEL_PASSTHROUGH);
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  for (delta_t i = -127; i <= 127; ++i) {
+    delta_t dx = i;
+    delta_t dy = -i;
+    accel_plan_run(&as.plan, &state, &dx, &dy);
+    mu_assert("passthrough changed deltas", dx == i && dy == -i);
+  }
+  return 0;
+}
+
+static char *test_fixed_error_bound() {
+  /*
+   * The fixed point sens should stay within 1/1000 of the double reference
+   * over the whole 8 bit range.
+   */
+  accel_settings_t as = basic;
+  as.overflow_lim = 100;
+  as.fixed_point = true;
+  as.lut_size = 1024;
+  mu_assert("fixed table not built", accel_fixed_build(&as) == 0 && as.fixed);
+  const scalar_t error = accel_fixed_max_error(&as);
+  accel_fixed_free(&as);
+  char error_str[30];
+  gcvt(error, 20, error_str);
+  create_msg(__func__, "fixed point sens error too large", error_str);
+  mu_assert(dst, error < 1e-3 * as.upper_bound);
+  return 0;
+}
+
+static char *test_plan_fixed() {
+  accel_settings_t as = basic;
+  as.fixed_point = true;
+  as.lut_size = 1024;
+  as.post_scalar_x = 0.75;
+  mu_assert("fixed table not built", accel_fixed_build(&as) == 0);
+  char *message = check_plan_matches(as, ACCEL_KERNEL_FIXED);
+  accel_fixed_free(&as);
+  return message;
+}
+
+static accel_settings_t point_curve(bool spline) {
+  accel_settings_t as = basic;
+  as.accel = curve_accel;
+  const scalar_t vel[] = {0, 10, 20, 40};
+  const scalar_t sens[] = {1, 2, 2, 4};
+  for (int i = 0; i < 4; ++i) {
+    as.curve_vel[i] = vel[i];
+    as.curve_sens[i] = sens[i];
+  }
+  as.curve_points = 4;
+  as.curve_knots = 81;
+  as.curve_spline = spline;
+  return as;
+}
+
+static char *test_curve_linear() {
+  /*
+   * Knots every half count line up with the points, so a linear curve
+   * should be exact at and between them.
+   */
+  accel_settings_t as = point_curve(false);
+  mu_assert("curve not built", accel_curve_build(&as) == 0 && as.curve);
+  mu_assert("sens at point", curve_accel(10, 0, &as) == 2);
+  mu_assert("sens between points", fabs(curve_accel(3, 4, &as) - 1.5) < 1e-9);
+  mu_assert("sens on flat segment", curve_accel(0, -15, &as) == 2);
+  mu_assert("sens past last point", curve_accel(100, 100, &as) == 4);
+  accel_curve_free(&as);
+  return 0;
+}
+
+static char *test_curve_spline_monotone() {
+  /*
+   * The spline goes through the points and never leaves the range of the
+   * neighbouring points, so the flat segment stays flat.
+   */
+  accel_settings_t as = point_curve(true);
+  mu_assert("curve not built", accel_curve_build(&as) == 0 && as.curve);
+  scalar_t last = 0;
+  for (scalar_t vel = 0; vel <= 40; vel += 0.25) {
+    const scalar_t sens = curve_accel(vel, 0, &as);
+    mu_assert("spline not monotone", sens >= last);
+    last = sens;
+  }
+  mu_assert("spline overshoots flat segment", curve_accel(15, 0, &as) == 2);
+  accel_curve_free(&as);
+  return 0;
+}
+
+static char *test_curve_bad_points() {
+  accel_settings_t as = point_curve(false);
+  as.curve_vel[2] = 5;
+  mu_assert("unordered points accepted", accel_curve_build(&as) != 0);
+  return 0;
+}
+
+static char *test_plan_curve() {
+  accel_settings_t as = point_curve(true);
+  as.game_sens = 2;
+  mu_assert("curve not built", accel_curve_build(&as) == 0);
+  char *message = check_plan_matches(as, ACCEL_KERNEL_CURVE);
+  accel_curve_free(&as);
+  return message;
+}
+
+static char *test_report_16_bit() {
+  report_layout_t layout;
+  mu_assert("no 16 bit preset", report_layout_preset(&layout, 16) == 0);
+  // dx = 1000, dy = -300
+  const unsigned char buf[] = {0x01, 0xE8, 0x03, 0xD4, 0xFE, 0x00};
+  mu_assert("16 bit dx", report_field_read(buf, &layout.x) == 1000);
+  mu_assert("16 bit dy", report_field_read(buf, &layout.y) == -300);
+  return 0;
+}
+
+static char *test_report_12_bit() {
+  report_layout_t layout;
+  mu_assert("no 12 bit preset", report_layout_preset(&layout, 12) == 0);
+  // dx = -2 (0xFFE), dy = 1500 (0x5DC)
+  const unsigned char buf[] = {0x00, 0xFE, 0xCF, 0x5D, 0x00};
+  mu_assert("12 bit dx", report_field_read(buf, &layout.x) == -2);
+  mu_assert("12 bit dy", report_field_read(buf, &layout.y) == 1500);
+  return 0;
+}
+
+static char *test_report_8_bit() {
+  report_layout_t layout;
+  mu_assert("no 8 bit preset", report_layout_preset(&layout, 8) == 0);
+  const unsigned char buf[] = {0x00, 0x80, 0x7F, 0x00};
+  mu_assert("8 bit dx", report_field_read(buf, &layout.x) == -128);
+  mu_assert("8 bit dy", report_field_read(buf, &layout.y) == 127);
+  mu_assert("unknown width accepted", report_layout_preset(&layout, 10) != 0);
+  return 0;
+}
+
+/* Gaming mouse: report ID 2, 16 buttons, 16 bit X/Y, wheel and AC Pan */
+static const unsigned char gaming_descriptor[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00,
+    0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x95, 0x10,
+    0x75, 0x01, 0x81, 0x02, 0x05, 0x01, 0x16, 0x01, 0x80, 0x26, 0xFF, 0x7F,
+    0x75, 0x10, 0x95, 0x02, 0x09, 0x30, 0x09, 0x31, 0x81, 0x06, 0x15, 0x81,
+    0x25, 0x7F, 0x75, 0x08, 0x95, 0x01, 0x09, 0x38, 0x81, 0x06, 0x05, 0x0C,
+    0x0A, 0x38, 0x02, 0x95, 0x01, 0x81, 0x06, 0xC0, 0xC0};
+
+static char *test_descriptor_gaming() {
+  report_layout_t layout;
+  mu_assert("gaming descriptor not parsed",
+            report_layout_parse(&layout, gaming_descriptor,
+                                sizeof(gaming_descriptor)) == 0);
+  mu_assert("report id", layout.report_id == 2);
+  mu_assert("buttons", layout.buttons.offset == 8 &&
+                           layout.buttons.bits == 16 &&
+                           !layout.buttons.is_signed);
+  mu_assert("x", layout.x.offset == 24 && layout.x.bits == 16 &&
+                     layout.x.is_signed);
+  mu_assert("y", layout.y.offset == 40 && layout.y.bits == 16);
+  mu_assert("wheel", layout.wheel.offset == 56 && layout.wheel.bits == 8 &&
+                         layout.wheel.is_signed);
+  mu_assert("hwheel", layout.hwheel.offset == 64 && layout.hwheel.bits == 8);
+
+  report_plan_t decode;
+  mu_assert("layout not compiled", report_plan_compile(&decode, &layout) == 0);
+  const unsigned char report[] = {0x02, 0x01, 0x08, 0x18, 0xFC,
+                                  0xE8, 0x03, 0xFF, 0x01};
+  mouse_report_t decoded;
+  mu_assert("report not decoded",
+            report_decode(&decode, report, sizeof(report), &decoded) == 0);
+  mu_assert("decoded buttons", decoded.buttons == 0x0801);
+  mu_assert("decoded x and y", decoded.x == -1000 && decoded.y == 1000);
+  mu_assert("decoded wheels", decoded.wheel == -1 && decoded.hwheel == 1);
+  const unsigned char other[] = {0x03, 0x01, 0x00, 0x00, 0x00,
+                                 0x00, 0x00, 0x00, 0x00};
+  mu_assert("other report id decoded",
+            report_decode(&decode, other, sizeof(other), &decoded) != 0);
+  return 0;
+}
+
+static char *test_descriptor_boot() {
+  /*
+   * Boot mouse with 3 buttons, constant padding and 8 bit X, Y and wheel.
+   */
+  const unsigned char desc[] = {
+      0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05,
+      0x09, 0x19, 0x01, 0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03,
+      0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x03, 0x05,
+      0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F,
+      0x75, 0x08, 0x95, 0x03, 0x81, 0x06, 0xC0, 0xC0};
+  report_layout_t layout;
+  mu_assert("boot descriptor not parsed",
+            report_layout_parse(&layout, desc, sizeof(desc)) == 0);
+  mu_assert("boot report id", layout.report_id == 0);
+  mu_assert("boot buttons",
+            layout.buttons.offset == 0 && layout.buttons.bits == 3);
+  mu_assert("boot x", layout.x.offset == 8 && layout.x.bits == 8);
+  mu_assert("boot y", layout.y.offset == 16);
+  mu_assert("boot wheel", layout.wheel.offset == 24);
+  mu_assert("boot hwheel", layout.hwheel.bits == 0);
+  const unsigned char keyboard[] = {0x05, 0x01, 0x09, 0x06, 0xA1,
+                                    0x01, 0x05, 0x07, 0xC0};
+  mu_assert("keyboard parsed as a mouse",
+            report_layout_parse(&layout, keyboard, sizeof(keyboard)) != 0);
+  return 0;
+}
+
+static char *test_accelerate_wide_delta() {
+  /*
+   * Deltas past the range of a signed char should not saturate.
+   */
+  accel_settings_t as = basic;
+  as.accel_rate = 0;
+  as.base = 2;
+  accel_plan_compile(&as);
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  delta_t dx = 3000;
+  delta_t dy = -20000;
+  accel_plan_run(&as.plan, &state, &dx, &dy);
+  mu_assert("wide deltas saturated", dx == 6000 && dy == -40000);
+  dx = 3000;
+  dy = -20000;
+  accel_state_t reference = {.carry_dx = 0, .carry_dy = 0};
+  accelerate(&dx, &dy, &as, &reference);
+  mu_assert("wide deltas saturated in accelerate",
+            dx == 6000 && dy == -40000);
+  return 0;
+}
+
+static char *test_frame_changes_only() {
+  /*
+   * Held buttons are only sent when they change and zero axes are left out.
+   */
+  accel_settings_t as = basic;
+  as.accel_rate = 0;
+  accel_plan_compile(&as);
+  report_layout_t layout;
+  report_layout_preset(&layout, 8);
+  report_plan_t decode;
+  report_plan_compile(&decode, &layout);
+  mouse_state_t state = {.accel = {.carry_dx = 0, .carry_dy = 0},
+                         .buttons = 0};
+  event_frame_t frame;
+  unsigned char press[] = {0x01, 0x05, 0x00, 0x00};
+  mu_assert("press frame length",
+            map_to_frame(&frame, press, 4, &decode, &as.plan, &state) == 3);
+  mu_assert("press not sent", frame.events[0].type == EV_KEY &&
+                                  frame.events[0].code == BTN_LEFT &&
+                                  frame.events[0].value == 1);
+  mu_assert("dx not sent", frame.events[1].code == REL_X &&
+                               frame.events[1].value == 5);
+  mu_assert("frame not synced", frame.events[2].type == EV_SYN);
+  unsigned char hold[] = {0x01, 0x00, 0xFE, 0x00};
+  mu_assert("held button sent again",
+            map_to_frame(&frame, hold, 4, &decode, &as.plan, &state) == 2);
+  mu_assert("dy not sent", frame.events[0].code == REL_Y &&
+                               frame.events[0].value == -2);
+  unsigned char release[] = {0x00, 0x00, 0x00, 0x00};
+  mu_assert("release frame length",
+            map_to_frame(&frame, release, 4, &decode, &as.plan, &state) == 2);
+  mu_assert("release not sent", frame.events[0].code == BTN_LEFT &&
+                                    frame.events[0].value == 0);
+  return 0;
+}
+
+static char *test_frame_empty() {
+  /*
+   * A report that changes nothing produces no events, not even a SYN.
+   */
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  report_layout_t layout;
+  report_layout_preset(&layout, 8);
+  report_plan_t decode;
+  report_plan_compile(&decode, &layout);
+  mouse_state_t state = {.accel = {.carry_dx = 0, .carry_dy = 0},
+                         .buttons = 0};
+  event_frame_t frame;
+  unsigned char idle[] = {0x00, 0x00, 0x00, 0x00};
+  mu_assert("idle report produced events",
+            map_to_frame(&frame, idle, 4, &decode, &as.plan, &state) == 0);
+  return 0;
+}
+
+static char *test_shared_profile() {
+  /*
+   * Mice that share a profile keep their own carry, on their own cache line.
+   */
+  accel_settings_t as = basic;
+  as.post_scalar_x = 0.5;
+  accel_plan_compile(&as);
+  mouse_state_t mice[2] = {
+      {.accel = {.carry_dx = 0, .carry_dy = 0}, .buttons = 0},
+      {.accel = {.carry_dx = 0, .carry_dy = 0}, .buttons = 0}};
+  mu_assert("mouse state not cache line aligned",
+            _Alignof(mouse_state_t) >= MOUSE_STATE_ALIGN &&
+                sizeof(mouse_state_t) % MOUSE_STATE_ALIGN == 0);
+
+  delta_t dx = 1, dy = 0;
+  accel_plan_run(&as.plan, &mice[0].accel, &dx, &dy);
+  mu_assert("half a count was moved", dx == 0);
+  dx = 1;
+  accel_plan_run(&as.plan, &mice[1].accel, &dx, &dy);
+  mu_assert("carry leaked to the other mouse", dx == 0);
+  dx = 1;
+  accel_plan_run(&as.plan, &mice[0].accel, &dx, &dy);
+  mu_assert("carry was not kept", dx == 1);
+  return 0;
+}
+
+static char *test_hist_percentiles() {
+  /*
+   * Percentiles are never below the real value and off by at most
+   * 1 / HIST_SUB_COUNT of it.
+   */
+  static hist_t hist;
+  hist_clear(&hist);
+  mu_assert("empty histogram has a percentile",
+            hist_percentile(&hist, 50) == 0);
+  for (uint64_t value = 1; value <= 100000; ++value) {
+    hist_record(&hist, value);
+  }
+  const double pcts[] = {50, 99, 99.9};
+  const uint64_t expected[] = {50000, 99000, 99900};
+  for (int idx = 0; idx < 3; ++idx) {
+    const uint64_t value = hist_percentile(&hist, pcts[idx]);
+    mu_assert("percentile below the real value", value >= expected[idx]);
+    mu_assert("percentile too far off",
+              value - expected[idx] <= expected[idx] / HIST_SUB_COUNT);
+  }
+  mu_assert("max not exact", hist_percentile(&hist, 100) == 100000);
+  for (int bucket = 1; bucket < HIST_BUCKETS; ++bucket) {
+    const uint64_t low = hist_bucket_max(bucket - 1) + 1;
+    mu_assert("buckets not contiguous", hist_bucket(low) == bucket);
+  }
+  mu_assert("largest value out of range",
+            hist_bucket(UINT64_MAX) == HIST_BUCKETS - 1);
+  return 0;
+}
+
+static char *test_plan_limits() {
+  /*
+   * Telemetry sees when overflow_lim clips a delta and when the sens is
+   * clamped to upper_bound.
+   */
+  accel_settings_t as = basic;
+  as.overflow_lim = 20;
+  as.upper_bound = 2;
+  accel_plan_compile(&as);
+  const accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  // sens reaches 2 at velocity offset + 1 / accel_rate.
+  mu_assert("slow movement limited",
+            accel_plan_limits(&as.plan, &state, 3, 0) == 0);
+  mu_assert("fast movement not bounded",
+            accel_plan_limits(&as.plan, &state, 6, 0) == ACCEL_LIMIT_BOUND);
+  mu_assert("delta not clipped",
+            accel_plan_limits(&as.plan, &state, 30, 0) ==
+                (ACCEL_LIMIT_CLIP | ACCEL_LIMIT_BOUND));
+  return 0;
+}
+
+static char *test_frame_16_buttons() {
+  /*
+   * Buttons past the first 5 are decoded from a 16 bit button mask.
+   */
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  const report_layout_t layout = {
+      .buttons = {.offset = 0, .bits = 16, .is_signed = false},
+      .x = {.offset = 16, .bits = 8, .is_signed = true},
+      .y = {.offset = 24, .bits = 8, .is_signed = true}};
+  report_plan_t decode;
+  report_plan_compile(&decode, &layout);
+  mouse_state_t state = {.accel = {.carry_dx = 0, .carry_dy = 0},
+                         .buttons = 0};
+  event_frame_t frame;
+  unsigned char press[] = {0x21, 0x08, 0x00, 0x00, 0x00};
+  mu_assert("press frame length",
+            map_to_frame(&frame, press, 5, &decode, &as.plan, &state) == 4);
+  mu_assert("left not pressed", frame.events[0].code == BTN_LEFT &&
+                                    frame.events[0].value == 1);
+  mu_assert("forward not pressed", frame.events[1].code == BTN_FORWARD &&
+                                       frame.events[1].value == 1);
+  mu_assert("button 12 not pressed", frame.events[2].code == BTN_MOUSE + 11 &&
+                                         frame.events[2].value == 1);
+  unsigned char release[] = {0x20, 0x08, 0x00, 0x00, 0x00};
+  mu_assert("release frame length",
+            map_to_frame(&frame, release, 5, &decode, &as.plan, &state) == 2);
+  mu_assert("left not released", frame.events[0].code == BTN_LEFT &&
+                                      frame.events[0].value == 0);
+  return 0;
+}
+
+static char *test_evdev_collect() {
+  /*
+   * Events from an event device are collected into one report per frame.
+   */
+  const struct input_event events[] = {
+      {.type = EV_KEY, .code = BTN_SIDE, .value = 1},
+      {.type = EV_REL, .code = REL_X, .value = 3},
+      {.type = EV_REL, .code = REL_X, .value = 4},
+      {.type = EV_REL, .code = REL_HWHEEL, .value = -1},
+      {.type = EV_KEY, .code = KEY_A, .value = 1},
+      {.type = EV_SYN, .code = SYN_REPORT, .value = 0}};
+  mouse_report_t report = {
+      .buttons = 0x1, .x = 0, .y = 0, .wheel = 0, .hwheel = 0};
+  for (int idx = 0; idx < 5; ++idx) {
+    mu_assert("frame ended early", !evdev_collect(&report, &events[idx]));
+  }
+  mu_assert("frame not ended", evdev_collect(&report, &events[5]));
+  mu_assert("buttons not collected", report.buttons == 0x9);
+  mu_assert("motion not summed", report.x == 7 && report.y == 0);
+  mu_assert("hwheel not collected", report.hwheel == -1);
+  const struct input_event release = {
+      .type = EV_KEY, .code = BTN_LEFT, .value = 0};
+  evdev_collect(&report, &release);
+  mu_assert("button not released", report.buttons == 0x8);
+  return 0;
+}
+
+static char *test_report_log_replay() {
+  /*
+   * A recorded log keeps the layout and reports, and replaying it writes the
+   * same events the mouse would have.
+   */
+  char path[] = "/tmp/marley_log_XXXXXX";
+  close(mkstemp(path));
+  report_log_t log = {.vendor_id = 0x046d, .product_id = 0xc08b};
+  report_layout_preset(&log.layout, 8);
+  mu_assert("log not created", report_log_create(&log, path) == 0);
+  const unsigned char reports[][4] = {{0x01, 0x03, 0x00, 0x00},
+                                      {0x01, 0x00, 0xfe, 0x00},
+                                      {0x00, 0x00, 0x00, 0x00}};
+  for (int idx = 0; idx < 3; ++idx) {
+    report_log_append(&log, 1000 * idx, reports[idx], 4);
+  }
+  report_log_close(&log);
+
+  report_log_t replay;
+  mu_assert("log not opened", report_log_open(&replay, path) == 0);
+  mu_assert("ids lost",
+            replay.vendor_id == 0x046d && replay.product_id == 0xc08b);
+  mu_assert("layout lost", replay.layout.y.offset == log.layout.y.offset &&
+                               replay.layout.y.is_signed);
+  mouse_dev_t dev = {.evdev_fd = -1, .layout = replay.layout};
+  report_plan_compile(&dev.decode, &dev.layout);
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  const driver_opts_t opts = {.reader_cpu = -1, .writer_cpu = -1};
+  driver_stats_t stats = {.reports = 0, .telemetry = NULL};
+  output_sink_t sink;
+  output_sink_memory(&sink, 16);
+  mu_assert("replay failed",
+            accel_replay(&sink, &dev, &as, &opts, &stats, &replay, false) == 0);
+  report_log_close(&replay);
+  mu_assert("reports not replayed", stats.reports == 3);
+
+  // press + x + syn, y + syn, release + syn.
+  mu_assert("wrong number of events", sink.written == 7);
+  const struct input_event *press = output_sink_event(&sink, 0);
+  const struct input_event *x = output_sink_event(&sink, 1);
+  const struct input_event *y = output_sink_event(&sink, 3);
+  const struct input_event *release = output_sink_event(&sink, 5);
+  mu_assert("press not replayed", press->code == BTN_LEFT && press->value == 1);
+  mu_assert("x not replayed", x->code == REL_X && x->value == 3);
+  mu_assert("y not replayed", y->code == REL_Y && y->value == -2);
+  mu_assert("release not replayed",
+            release->code == BTN_LEFT && release->value == 0);
+  output_sink_close(&sink);
+
+  // a record cut short is an error, not the end of the log.
+  FILE *file = fopen(path, "ab");
+  fputc(0x01, file);
+  fclose(file);
+  report_log_open(&replay, path);
+  uint64_t time_ns;
+  unsigned char buf[REPORT_MAX_SIZE];
+  int len;
+  for (int idx = 0; idx < 3; ++idx) {
+    report_log_next(&replay, &time_ns, buf, &len);
+  }
+  mu_assert("timing lost", time_ns == 2000);
+  mu_assert("truncated record read",
+            report_log_next(&replay, &time_ns, buf, &len) == -1);
+  report_log_close(&replay);
+  unlink(path);
+  return 0;
+}
+
+static char *test_output_sink_memory() {
+  /*
+   * A memory sink keeps the newest events, and map_to_uinput writes a whole
+   * frame to it at once.
+   */
+  output_sink_t sink;
+  mu_assert("ring not allocated", output_sink_memory(&sink, 3) == 0);
+  mu_assert("capacity not a power of two", sink.mask == 3);
+  mu_assert("unwritten event read", output_sink_event(&sink, 0) == NULL);
+
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  report_layout_t layout;
+  report_layout_preset(&layout, 8);
+  report_plan_t decode;
+  report_plan_compile(&decode, &layout);
+  mouse_state_t state = {.accel = {.carry_dx = 0, .carry_dy = 0},
+                         .buttons = 0};
+  const unsigned char move[] = {0x00, 0x01, 0x02, 0x00};
+  map_to_uinput(&sink, move, 4, &decode, &as.plan, &state);
+  mu_assert("frame not written", sink.written == 3);
+  mu_assert("frame not in order", output_sink_event(&sink, 0)->code == REL_X &&
+                                      output_sink_event(&sink, 2)->type ==
+                                          EV_SYN);
+
+  map_to_uinput(&sink, move, 4, &decode, &as.plan, &state);
+  mu_assert("overwritten event read", output_sink_event(&sink, 1) == NULL);
+  mu_assert("newest event lost", output_sink_event(&sink, 4)->code == REL_Y);
+  output_sink_close(&sink);
+
+  output_sink_null(&sink);
+  map_to_uinput(&sink, move, 4, &decode, &as.plan, &state);
+  mu_assert("null sink lost count", sink.written == 3);
+  output_sink_close(&sink);
+  return 0;
+}
+
+static atomic_bool swap_done;
+
+static void *reload_profile(void *arg) {
+  hot_profile_reload(arg);
+  atomic_store(&swap_done, true);
+  return NULL;
+}
+
+static char *test_hot_profile_reload() {
+  /*
+   * A reload swaps in the new settings right away, but waits for a reader
+   * that is still using the old ones before freeing them. A config that
+   * can't be loaded keeps the settings in use.
+   */
+  char path[] = "/tmp/marley_cfg_XXXXXX";
+  FILE *config = fdopen(mkstemp(path), "w");
+  fprintf(config, "base=2\naccel_rate=0\n");
+  fclose(config);
+
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  hot_profile_t profile;
+  hot_profile_init(&profile, &as, path);
+  hot_reader_t *reader = hot_profile_reader(&profile);
+  mu_assert("no reader", reader != NULL);
+
+  const accel_plan_t *plan = hot_profile_enter(&profile, reader);
+  mu_assert("initial plan not read", plan == &as.plan);
+  atomic_store(&swap_done, false);
+  pthread_t thread;
+  pthread_create(&thread, NULL, reload_profile, &profile);
+  while (atomic_load(&profile.current) == &as) {
+    sched_yield();
+  }
+  usleep(1000);
+  mu_assert("swap did not wait for the reader", !atomic_load(&swap_done));
+  hot_profile_exit(reader);
+  pthread_join(thread, NULL);
+
+  plan = hot_profile_enter(&profile, reader);
+  hot_profile_exit(reader);
+  mu_assert("reloaded plan not read", plan != &as.plan && plan->base == 2);
+
+  profile.path = "/nonexistent/marley.cfg";
+  mu_assert("missing config loaded", hot_profile_reload(&profile) != 0);
+  mu_assert("settings lost on a failed reload",
+            hot_profile_enter(&profile, reader) == plan);
+  hot_profile_exit(reader);
+  hot_profile_free(&profile);
+  mu_assert("initial settings not restored",
+            atomic_load(&profile.current) == &as);
+  unlink(path);
+  return 0;
+}
+
+static char *test_parse_config() {
+  /*
+   * Sections start from the top-level settings. Keys ignore case and
+   * whitespace, and an error gives the line it is on.
+   */
+  const char *text = "AP = pow   # accel function\n"
+                     "base=2\n"
+                     "\n"
+                     "[Fast]\n"
+                     "accel_rate = 3\n"
+                     "points=0:1, 10:1.5 ,40:3\n"
+                     "[slow]\n"
+                     "base=0.5\n"
+                     "[extra]\n";
+  config_profile_t profiles[3];
+  default_config(&profiles[0].settings);
+  int count, line;
+  mu_assert("config not parsed",
+            parse_config(text, profiles, 3, &count, &line) == 0);
+  mu_assert("sections not counted", count == 4);
+  mu_assert("top-level not kept", profiles[0].name[0] == '\0' &&
+                                      profiles[0].settings.accel == pow_accel &&
+                                      profiles[0].settings.base == 2);
+  mu_assert("section not named", strcmp(profiles[1].name, "fast") == 0);
+  mu_assert("section lost the top-level settings",
+            profiles[1].settings.base == 2 &&
+                profiles[1].settings.accel_rate == 3 &&
+                profiles[0].settings.accel_rate == 2);
+  mu_assert("points not parsed", profiles[1].settings.curve_points == 3 &&
+                                     profiles[1].settings.curve_vel[2] == 40 &&
+                                     profiles[1].settings.curve_sens[1] == 1.5);
+  mu_assert("section not separate", profiles[2].settings.base == 0.5 &&
+                                        profiles[2].settings.curve_points == 0);
+
+  const char *bad[] = {"base=1\nbse=2\n", "base=1\nbase=2x\n",
+                       "base=1\n[a]\n[a]\n", "base=1\n[unclosed\n"};
+  const int bad_lines[] = {2, 2, 3, 2};
+  for (int idx = 0; idx < 4; ++idx) {
+    default_config(&profiles[0].settings);
+    mu_assert("bad config parsed",
+              parse_config(bad[idx], profiles, 3, &count, &line) == -1);
+    mu_assert("wrong error line", line == bad_lines[idx]);
+  }
+  return 0;
+}
+
+static char *test_report_late() {
+  /*
+   * Gaps over 2 polling intervals are late, unless they are long enough that
+   * the mouse was idle.
+   */
+  const uint32_t interval_us = 125;
+  mu_assert("on time report late", !report_is_late(interval_us, 125));
+  mu_assert("2 intervals late", !report_is_late(interval_us, 250));
+  mu_assert("missed report not late", report_is_late(interval_us, 375));
+  mu_assert("idle gap late",
+            !report_is_late(interval_us, 125 * (REPORT_IDLE_INTERVALS + 1)));
+  mu_assert("unknown interval late", !report_is_late(0, 1000));
+  return 0;
+}
+
+static char *test_report_ring() {
+  report_ring_t ring;
+  mu_assert("ring not allocated", report_ring_init(&ring, 3) == 0);
+  mu_assert("size not rounded to a power of two", ring.mask == 3);
+  mu_assert("new ring not empty", report_ring_peek(&ring) == NULL);
+  unsigned char report[] = {0x01, 0x02, 0x03};
+  for (int idx = 0; idx < 4; ++idx) {
+    report[0] = idx;
+    mu_assert("push failed", report_ring_push(&ring, report, 3, 100 + idx));
+  }
+  mu_assert("pushed into a full ring", !report_ring_push(&ring, report, 3, 0));
+  const report_slot_t *slot = report_ring_peek(&ring);
+  mu_assert("oldest report not first", slot && slot->data[0] == 0);
+  mu_assert("report length lost", slot->len == 3 && slot->data[2] == 0x03);
+  mu_assert("arrival time lost", slot->arrived_ns == 100);
+  report_ring_release(&ring);
+  mu_assert("released slot not reused", report_ring_push(&ring, report, 3, 0));
+  unsigned char big[REPORT_SLOT_SIZE + 1] = {0};
+  mu_assert("oversized report pushed",
+            !report_ring_push(&ring, big, sizeof(big), 0));
+  report_ring_free(&ring);
+  return 0;
+}
+
+static void *ring_producer(void *arg) {
+  report_ring_t *ring = arg;
+  for (uint32_t idx = 0; idx < 100000; ++idx) {
+    unsigned char report[4];
+    memcpy(report, &idx, sizeof(idx));
+    while (!report_ring_push(ring, report, sizeof(report), 0)) {
+    }
+  }
+  report_ring_close(ring);
+  return NULL;
+}
+
+static char *test_report_ring_threads() {
+  /*
+   * Reports cross threads in order, and the consumer wakes when the ring is
+   * closed.
+   */
+  report_ring_t ring;
+  report_ring_init(&ring, 16);
+  pthread_t producer;
+  pthread_create(&producer, NULL, ring_producer, &ring);
+  uint32_t expected = 0;
+  bool in_order = true;
+  while (true) {
+    const report_slot_t *slot = report_ring_peek(&ring);
+    if (slot) {
+      uint32_t idx;
+      memcpy(&idx, slot->data, sizeof(idx));
+      in_order = in_order && idx == expected++;
+      report_ring_release(&ring);
+    } else if (report_ring_closed(&ring)) {
+      if (!report_ring_peek(&ring)) {
+        break;
+      }
+    } else {
+      report_ring_wait(&ring);
+    }
+  }
+  pthread_join(producer, NULL);
+  report_ring_free(&ring);
+  mu_assert("reports out of order", in_order);
+  mu_assert("reports lost", expected == 100000);
+  return 0;
+}
+
 static char *test_marley_map_alloc() {
   const int map_size = 10;
   marley_map *map = marley_map_alloc(map_size);
@@ -214,6 +1125,385 @@ static char *test_marley_map_resize() {
   return 0;
 }
 
+static char *test_marley_map_large() {
+  /*
+   * Keys are copied, so one buffer can be reused for every key, and the map
+   * keeps finding them as it grows to 20k entries.
+   */
+  const int count = 20000;
+  marley_map *map = marley_map_alloc(1);
+  char key[32];
+  for (int idx = 0; idx < count; ++idx) {
+    snprintf(key, sizeof(key), "profile_%d", idx);
+    mu_assert("key not set",
+              marley_map_set(map, key, (void *)(intptr_t)(idx + 1)) == 0);
+  }
+  mu_assert("wrong size", map->size == count);
+  mu_assert("not doubled", map->reserved_size == 32768);
+
+  for (int idx = 0; idx < count; idx += 7) {
+    snprintf(key, sizeof(key), "profile_%d", idx);
+    marley_map_set(map, key, (void *)(intptr_t)-idx);
+  }
+  mu_assert("update added a key", map->size == count);
+  for (int idx = 0; idx < count; ++idx) {
+    snprintf(key, sizeof(key), "profile_%d", idx);
+    const intptr_t expect = idx % 7 == 0 ? -idx : idx + 1;
+    mu_assert("value not found",
+              (intptr_t)marley_map_lookup(map, key) == expect);
+  }
+  mu_assert("missing key found", marley_map_lookup(map, "profile_x") == NULL);
+  mu_assert("entries out of order",
+            strcmp(map->data[123].key, "profile_123") == 0);
+  marley_map_free(map);
+  return 0;
+}
+
+static char *test_profile_chord() {
+  /*
+   * Holding buttons 4 and 5 switches profile once per press, wraps after the
+   * last profile, and neither button reaches the frame.
+   */
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  const profile_set_t set = {.plans = {&as.plan, &as.plan, &as.plan},
+                             .names = {"default", "fast", "slow"},
+                             .count = 3,
+                             .chord = (1u << 3) | (1u << 4)};
+  mouse_state_t state = {.accel = {.carry_dx = 0, .carry_dy = 0},
+                         .buttons = 0,
+                         .profile = 0,
+                         .chord_held = false};
+  event_frame_t frame;
+  mouse_report_t report = {.buttons = 1u << 3};
+  mu_assert("switched on half chord", !map_chord(&set, &report, &state));
+  mu_assert("chord button kept", report.buttons == 0);
+  report.buttons = (1u << 3) | (1u << 4) | 1u;
+  mu_assert("not switched", map_chord(&set, &report, &state));
+  mu_assert("wrong profile", state.profile == 1);
+  mu_assert("left masked", report.buttons == 1u);
+  mu_assert("chord forwarded",
+            map_report_to_frame(&frame, &report, &as.plan, &state) == 2 &&
+                frame.events[0].code == BTN_LEFT);
+  report.buttons = (1u << 3) | (1u << 4);
+  mu_assert("switched while held", !map_chord(&set, &report, &state));
+  for (int press = 0; press < 2; ++press) {
+    report.buttons = 0;
+    map_chord(&set, &report, &state);
+    report.buttons = (1u << 3) | (1u << 4);
+    map_chord(&set, &report, &state);
+  }
+  mu_assert("did not wrap", state.profile == 0);
+  return 0;
+}
+
+/**
+ * Run a hand speed of 16 counts per ms through plan for 32 ms at the given
+ * polling interval. Returns the x counts output in the last 16 ms.
+ */
+static delta_t run_polled(const accel_plan_t *plan, uint64_t interval_us,
+                          accel_state_t *state) {
+  const delta_t counts = 16 * interval_us / 1000;
+  delta_t total = 0;
+  for (uint64_t time_us = interval_us; time_us <= 32000;
+       time_us += interval_us) {
+    delta_t dx = counts;
+    delta_t dy = 0;
+    state->time_us = 1000000 + time_us;
+    accel_plan_run(plan, state, &dx, &dy);
+    total += time_us > 16000 ? dx : 0;
+  }
+  return total;
+}
+
+static char *test_timed_velocity() {
+  /*
+   * With a velocity window, the same hand speed gets the same accel at 125,
+   * 1000 and 8000 Hz, and the polling interval is detected.
+   */
+  accel_settings_t as = basic;
+  as.vel_window = 1;
+  accel_plan_compile(&as);
+  mu_assert("window not compiled", as.plan.window_us == 1000);
+  // sens is 1 + 1.04 * (16 - 4) at 16 counts per ms.
+  const delta_t expect = 16 * 16 * (1 + 1.04 * 12);
+  const uint64_t intervals[] = {8000, 1000, 125};
+  for (int idx = 0; idx < 3; ++idx) {
+    accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+    const delta_t total = run_polled(&as.plan, intervals[idx], &state);
+    mu_assert("accel depends on polling rate", abs(total - expect) <= 1);
+    mu_assert("interval not detected",
+              accel_window_interval(&state.window) == intervals[idx]);
+  }
+
+  accel_settings_t fixed = as;
+  fixed.lut_size = 1024;
+  fixed.lut_max_vel = 64;
+  fixed.fixed_point = true;
+  mu_assert("table not built", accel_fixed_build(&fixed) == 0);
+  accel_plan_compile(&fixed);
+  accel_state_t fast = {.carry_dx = 0, .carry_dy = 0};
+  accel_state_t slow = {.carry_dx = 0, .carry_dy = 0};
+  const delta_t fast_total = run_polled(&fixed.plan, 125, &fast);
+  mu_assert("fixed point rates differ",
+            abs(fast_total - run_polled(&fixed.plan, 1000, &slow)) <= 2 &&
+                abs(fast_total - expect) <= 4);
+  accel_fixed_free(&fixed);
+
+  accel_settings_t untimed = basic;
+  accel_plan_compile(&untimed);
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  mu_assert("untimed plan was rate independent",
+            run_polled(&untimed.plan, 125, &state) < expect / 4);
+
+  // reports in one transfer share a time, and the ring never overflows.
+  for (int idx = 0; idx < 3 * ACCEL_WINDOW_SIZE; ++idx) {
+    accel_window_push(&state.window, 1000, 5000000, 1, 0);
+  }
+  mu_assert("window overflowed", state.window.len == ACCEL_WINDOW_SIZE &&
+                                     state.window.sum_dx == ACCEL_WINDOW_SIZE);
+  return 0;
+}
+
+static char *test_marley_api() {
+  /*
+   * The library API evaluates the same sens the driver runs with, for flat
+   * and velocity dependent plans, and reports the line of a config error.
+   */
+  int line;
+  marley_profile_t *profile = marley_profile_parse(
+      "ap=quake\naccel_rate=0.5\noverflow_lim=0\npost_scalar_x=2\n", &line);
+  mu_assert("profile not parsed", profile != NULL);
+  mu_assert("wrong kernel",
+            strcmp(marley_profile_kernel(profile), "quake_linear") == 0);
+  const double vel[] = {0, 3, 10};
+  double gain[3];
+  marley_eval_curve(profile, vel, gain, 3);
+  mu_assert("wrong curve", gain[0] == 2 && gain[1] == 5 && gain[2] == 12);
+  const double dx[] = {3, -6};
+  const double dy[] = {4, 8};
+  double sens[2];
+  marley_eval_sens(profile, dx, dy, sens, 2);
+  mu_assert("wrong sens", sens[0] == 3.5 && sens[1] == 6);
+  marley_profile_free(profile);
+
+  int err;
+  profile = marley_profile_load(NULL, &err);
+  mu_assert("defaults not loaded", profile != NULL && err == 0);
+  marley_profile_free(profile);
+  profile = marley_profile_parse("base=1.5\naccel_rate=0\n", &line);
+  marley_eval_sens(profile, dx, dy, sens, 1);
+  mu_assert("wrong flat sens", sens[0] == 1.5);
+  marley_profile_free(profile);
+
+  profile = marley_profile_parse("base=1\n\nbase=one\n", &line);
+  mu_assert("bad config parsed", profile == NULL && line == 3);
+  mu_assert("wrong version", marley_api_version() == MARLEY_API_VERSION);
+  return 0;
+}
+
+static char *test_live_ring() {
+  /*
+   * Kernels leave the velocity and sens of each report in the state, and
+   * samples can be read back from the shared ring until they are lapped.
+   */
+  accel_settings_t as = basic;
+  accel_plan_compile(&as);
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  delta_t dx = 6;
+  delta_t dy = 8;
+  accel_plan_run(&as.plan, &state, &dx, &dy);
+  mu_assert("velocity not kept", state.vel_dx == 6 && state.vel_dy == 8);
+  mu_assert("sens not kept", fabs(state.sens - (1 + 1.04 * 6)) < 1e-9);
+
+  live_ring_t *ring;
+  mu_assert("ring not opened", live_ring_open(&ring) == 0);
+  mu_assert("bad header", ring->magic == LIVE_RING_MAGIC &&
+                              ring->size == LIVE_RING_SIZE &&
+                              ring->slot_size == sizeof(live_slot_t));
+  const uint64_t count = LIVE_RING_SIZE + 10;
+  for (uint64_t idx = 0; idx < count; ++idx) {
+    const live_sample_t sample = {.time_ns = idx, .in_dx = (int32_t)idx};
+    live_ring_publish(ring, &sample);
+  }
+  live_sample_t sample;
+  mu_assert("wrong head", atomic_load(&ring->head) == count);
+  mu_assert("lapped sample read", !live_ring_read(ring, 5, &sample));
+  mu_assert("sample not read", live_ring_read(ring, count - 1, &sample) &&
+                                   sample.in_dx == (int32_t)(count - 1));
+  mu_assert("future sample read", !live_ring_read(ring, count, &sample));
+  live_ring_close(ring);
+  mu_assert("segment left behind",
+            access("/dev/shm" LIVE_RING_NAME, F_OK) != 0);
+  return 0;
+}
+
+static char *test_fixed_limits() {
+  /*
+   * Fixed point plans find the same limits as the double plan, over the
+   * whole 8 bit range.
+   */
+  accel_settings_t as = basic;
+  as.overflow_lim = 20;
+  as.upper_bound = 2;
+  as.pre_scalar_y = 0.5;
+  accel_plan_compile(&as);
+  accel_settings_t fixed = as;
+  fixed.fixed_point = true;
+  mu_assert("fixed table not built", accel_fixed_build(&fixed) == 0);
+  accel_plan_compile(&fixed);
+  const accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  bool same = fixed.plan.kernel == ACCEL_KERNEL_FIXED;
+  for (delta_t dx = -127; dx <= 127 && same; ++dx) {
+    for (delta_t dy = -127; dy <= 127 && same; ++dy) {
+      same = accel_plan_limits(&fixed.plan, &state, dx, dy) ==
+             accel_plan_limits(&as.plan, &state, dx, dy);
+    }
+  }
+  accel_fixed_free(&fixed);
+  mu_assert("fixed limits differ", same);
+  return 0;
+}
+
+static char *test_sweep_axis_parse() {
+  /*
+   * Axes are lists or ranges that include their stop. A range missing its
+   * stop or step is rejected, even with -ffast-math.
+   */
+  static sweep_axis_t axis;
+  mu_assert("list not parsed", sweep_axis_parse("power=2,2.5,3", &axis) == 0);
+  mu_assert("list key", strcmp(axis.key, "power") == 0);
+  mu_assert("list values", axis.count == 3 && axis.values[0] == 2 &&
+                               axis.values[1] == 2.5 && axis.values[2] == 3);
+  mu_assert("range not parsed",
+            sweep_axis_parse("accel_rate=0.5:2:0.1", &axis) == 0);
+  mu_assert("range lost its stop",
+            axis.count == 16 && fabs(axis.values[15] - 2) < 1e-9);
+  mu_assert("single value not parsed", sweep_axis_parse("base=1", &axis) == 0);
+  mu_assert("single value", axis.count == 1 && axis.values[0] == 1);
+
+  const char *bad[] = {"power=1:2", "power=1:2:", "power=1::0.5",
+                       "power=:2:1", "power=2:1:0.5", "power=1:2:0",
+                       "power=1:2:-1", "power=1:2:0.5x", "power=1,,2",
+                       "power=1,", "power=", "=1", "power",
+                       "power=0:2000:1"};
+  for (size_t idx = 0; idx < sizeof(bad) / sizeof(*bad); ++idx) {
+    create_msg(__func__, "bad axis accepted", bad[idx]);
+    mu_assert(dst, sweep_axis_parse(bad[idx], &axis) != 0);
+  }
+  return 0;
+}
+
+static char *test_sweep_candidates() {
+  /*
+   * Combinations count like a mixed radix number, with the last axis
+   * changing fastest, and their config text sets every axis in order.
+   */
+  static sweep_axis_t axes[2];
+  mu_assert("axes not parsed",
+            sweep_axis_parse("upper_bound=2,4,8", &axes[0]) == 0 &&
+                sweep_axis_parse("power=2,3", &axes[1]) == 0);
+  const double expected[6][2] = {{2, 2}, {2, 3}, {4, 2},
+                                 {4, 3}, {8, 2}, {8, 3}};
+  for (uint64_t candidate = 0; candidate < 6; ++candidate) {
+    double values[2];
+    sweep_candidate_values(axes, 2, candidate, values);
+    mu_assert("wrong values", values[0] == expected[candidate][0] &&
+                                  values[1] == expected[candidate][1]);
+  }
+  char text[SWEEP_TEXT_SIZE];
+  sweep_candidate_text(axes, 2, 3, text, sizeof(text));
+  mu_assert("wrong text", strcmp(text, "upper_bound=4\npower=3\n") == 0);
+
+  // the text is read by the config loader, like in the sweep.
+  config_profile_t profile;
+  default_config(&profile.settings);
+  int count, line;
+  mu_assert("text not parsed",
+            parse_config(text, &profile, 1, &count, &line) == 0);
+  mu_assert("text not applied", profile.settings.upper_bound == 4 &&
+                                    profile.settings.power == 3);
+  return 0;
+}
+
+static char *test_profile_tables() {
+  /*
+   * A section starts from the top-level settings without sharing their
+   * tables, so each profile builds and frees its own.
+   */
+  const char *text = "lut_size=64\n"
+                     "points=0:1,10:2\n"
+                     "fixed_point=1\n"
+                     "[fast]\n"
+                     "base=2\n";
+  config_profile_t profiles[2];
+  default_config(&profiles[0].settings);
+  int count, line;
+  mu_assert("config not parsed",
+            parse_config(text, profiles, 1, &count, &line) == 0);
+  mu_assert("tables not built", build_config(&profiles[0].settings) == 0 &&
+                                    profiles[0].settings.lut &&
+                                    profiles[0].settings.curve &&
+                                    profiles[0].settings.fixed);
+  mu_assert("config not parsed",
+            parse_config(text, profiles, 2, &count, &line) == 0);
+  mu_assert("tables shared", !profiles[1].settings.lut &&
+                                 !profiles[1].settings.curve &&
+                                 !profiles[1].settings.fixed);
+  mu_assert("section tables not built",
+            build_config(&profiles[1].settings) == 0 &&
+                profiles[1].settings.lut != profiles[0].settings.lut);
+  free_config(&profiles[1].settings);
+  mu_assert("top-level tables freed", profiles[0].settings.lut &&
+                                          profiles[0].settings.lut->sens.d);
+  free_config(&profiles[0].settings);
+  return 0;
+}
+
+/**
+ * Run a hand speed of speed counts per ms through plan for 32 ms at 125 Hz.
+ * Returns the limits the last report ran into.
+ */
+static unsigned limits_polled(const accel_plan_t *plan, delta_t speed) {
+  accel_state_t state = {.carry_dx = 0, .carry_dy = 0};
+  unsigned limits = 0;
+  for (uint64_t time_us = 8000; time_us <= 32000; time_us += 8000) {
+    delta_t dx = speed * 8;
+    delta_t dy = 0;
+    state.time_us = 1000000 + time_us;
+    accel_plan_run(plan, &state, &dx, &dy);
+    limits = accel_plan_limits(plan, &state, speed * 8, 0);
+  }
+  return limits;
+}
+
+static char *test_timed_limits() {
+  /*
+   * Timed plans are bounded by the velocity of their window, not by the
+   * deltas of one report, which are 8 ms of movement at 125 Hz.
+   */
+  accel_settings_t as = basic;
+  as.upper_bound = 2;
+  as.vel_window = 16;
+  accel_plan_compile(&as);
+  // sens reaches 2 at 4.96 counts per ms.
+  mu_assert("slow hand bounded", limits_polled(&as.plan, 2) == 0);
+  mu_assert("fast hand not bounded",
+            limits_polled(&as.plan, 8) == ACCEL_LIMIT_BOUND);
+
+  accel_settings_t fixed = as;
+  fixed.fixed_point = true;
+  mu_assert("fixed table not built", accel_fixed_build(&fixed) == 0);
+  accel_plan_compile(&fixed);
+  const bool slow = fixed.plan.kernel == ACCEL_KERNEL_FIXED &&
+                    limits_polled(&fixed.plan, 2) == 0;
+  const bool fast = limits_polled(&fixed.plan, 8) == ACCEL_LIMIT_BOUND;
+  accel_fixed_free(&fixed);
+  mu_assert("fixed point slow hand bounded", slow);
+  mu_assert("fixed point fast hand not bounded", fast);
+  return 0;
+}
+
 static char *test_marley_map_set_resize() {
   const int map_size = 1;
   marley_map *map = marley_map_alloc(map_size);
@@ -245,6 +1535,54 @@ static char *all_tests() {
   mu_run_test(test_marley_map_lookup);        // 8
   mu_run_test(test_marley_map_resize);        // 9
   mu_run_test(test_marley_map_set_resize);    // 10
+  mu_run_test(test_accelerate_batch_quake);   // 11
+  mu_run_test(test_accelerate_batch_fractional_power); // 12
+  mu_run_test(test_accelerate_batch_pow);     // 13
+  mu_run_test(test_lut_double);               // 14
+  mu_run_test(test_lut_float);                // 15
+  mu_run_test(test_lut_past_saturation);      // 16
+  mu_run_test(test_plan_quake_linear);        // 17
+  mu_run_test(test_plan_quake_int);           // 18
+  mu_run_test(test_plan_quake);               // 19
+  mu_run_test(test_plan_pow);                 // 20
+  mu_run_test(test_plan_constant);            // 21
+  mu_run_test(test_plan_passthrough);         // 22
+  mu_run_test(test_fixed_error_bound);        // 23
+  mu_run_test(test_plan_fixed);               // 24
+  mu_run_test(test_curve_linear);             // 25
+  mu_run_test(test_curve_spline_monotone);    // 26
+  mu_run_test(test_curve_bad_points);         // 27
+  mu_run_test(test_plan_curve);               // 28
+  mu_run_test(test_report_16_bit);            // 29
+  mu_run_test(test_report_12_bit);            // 30
+  mu_run_test(test_report_8_bit);             // 31
+  mu_run_test(test_accelerate_wide_delta);    // 32
+  mu_run_test(test_frame_changes_only);       // 33
+  mu_run_test(test_frame_empty);              // 34
+  mu_run_test(test_report_late);              // 35
+  mu_run_test(test_report_ring);              // 36
+  mu_run_test(test_report_ring_threads);      // 37
+  mu_run_test(test_frame_16_buttons);         // 38
+  mu_run_test(test_descriptor_gaming);        // 39
+  mu_run_test(test_descriptor_boot);          // 40
+  mu_run_test(test_evdev_collect);            // 41
+  mu_run_test(test_shared_profile);           // 42
+  mu_run_test(test_hist_percentiles);         // 43
+  mu_run_test(test_plan_limits);              // 44
+  mu_run_test(test_report_log_replay);        // 45
+  mu_run_test(test_output_sink_memory);       // 46
+  mu_run_test(test_hot_profile_reload);       // 47
+  mu_run_test(test_parse_config);             // 48
+  mu_run_test(test_marley_map_large);         // 49
+  mu_run_test(test_profile_chord);            // 50
+  mu_run_test(test_timed_velocity);           // 51
+  mu_run_test(test_marley_api);               // 52
+  mu_run_test(test_live_ring);                // 53
+  mu_run_test(test_fixed_limits);             // 54
+  mu_run_test(test_sweep_axis_parse);         // 55
+  mu_run_test(test_sweep_candidates);         // 56
+  mu_run_test(test_profile_tables);           // 57
+  mu_run_test(test_timed_limits);             // 58
   return 0;
 }
 